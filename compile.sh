@@ -8,11 +8,11 @@ cd "$SCRIPTPATH"
 # Add emscripten environment variables
 source emsdk/emsdk_env.sh
 
-emcc -o jolly.html src/main.c src/icons.c \
-  -O2 -Wall raylib/src/libraylib.a \
+emcc -o jolly.html src/main.c src/icons.c src/platform_web.c src/render.c src/undo.c src/fill.c src/stroke.c src/document.c src/matrix.c src/kernels.c src/transform.c src/png.c src/frames.c src/gif.c src/palette.c src/import.c src/profile.c src/input.c src/workspace.c src/journal.c src/select.c \
+  -O2 -msimd128 -Wall raylib/src/libraylib.a \
   -I. -Iraylib/src/ -L. -Lraylib/src/ -s USE_GLFW=3 -s ASYNCIFY \
-  --shell-file minshell.html -DPLATFORM_WEB \
+  --shell-file minshell.html -DPLATFORM_WEB --preload-file palettes \
   -s EXPORTED_RUNTIME_METHODS=['setValue'] -lidbfs.js
 
 mv jolly.html index.html
-zip index.zip index.html jolly.js jolly.wasm
+zip index.zip index.html jolly.js jolly.wasm jolly.data
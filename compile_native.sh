@@ -0,0 +1,26 @@
+#!/bin/bash -x
+
+SCRIPT=$(realpath -s "$0")
+SCRIPTPATH=$(dirname "$SCRIPT")
+
+cd "$SCRIPTPATH"
+
+# Needs raylib built for PLATFORM_DESKTOP and visible to pkg-config.
+# Frame pointers are kept so perf can unwind the editor's hot paths, and
+# -march=native lets the cell kernels use AVX2 where the machine has it.
+gcc -o jolly src/main.c src/icons.c src/platform_native.c src/render.c src/undo.c src/fill.c src/stroke.c src/document.c src/matrix.c src/kernels.c src/transform.c src/png.c src/frames.c src/gif.c src/palette.c src/import.c src/profile.c src/input.c src/workspace.c src/journal.c src/select.c \
+  -O2 -march=native -g -fno-omit-frame-pointer -Wall \
+  -I. $(pkg-config --cflags raylib) \
+  $(pkg-config --libs raylib) -lm -lpthread -ldl
+
+# Command line converter for saved documents, on the same core
+gcc -o jolly-batch src/batch.c src/platform_native.c src/document.c src/matrix.c src/kernels.c src/frames.c src/png.c src/palette.c \
+  -O2 -march=native -g -Wall \
+  -I. $(pkg-config --cflags raylib) \
+  $(pkg-config --libs raylib) -lm -lpthread -ldl
+
+# Benchmark of the hot paths, main.c comes in through bench.c
+gcc -o jolly-bench src/bench.c src/icons.c src/platform_native.c src/render.c src/undo.c src/fill.c src/stroke.c src/document.c src/matrix.c src/kernels.c src/transform.c src/png.c src/frames.c src/gif.c src/palette.c src/import.c src/profile.c src/input.c src/workspace.c src/journal.c src/select.c \
+  -O2 -march=native -g -fno-omit-frame-pointer -Wall \
+  -I. $(pkg-config --cflags raylib) \
+  $(pkg-config --libs raylib) -lm -lpthread -ldl
@@ -0,0 +1,428 @@
+// Command line converter for saved documents, built by compile_native.sh
+// as jolly-batch. Each document becomes a PNG like the editor exports, and
+// optionally a sprite in a texture atlas. Worker threads take the next
+// document from a shared counter until none are left.
+#define _POSIX_C_SOURCE 200809L
+
+#include <raylib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "document.h"
+#include "kernels.h"
+#include "palette.h"
+#include "platform.h"
+#include "png.h"
+#include "state.h"
+
+#define THREADS_MAX 256
+#define SCALE_MAX 16
+#define ATLAS_SIZE 2048 // Default side of atlas pages
+
+struct job
+{
+    const char *path;
+    char name[256]; // Path flattened to a file name, without extension
+    bool ok;
+    int side;            // Sprite side in pixels
+    unsigned char *rgba; // Sprite for the atlas
+    int page, x, y;      // Where the atlas has it, page -1 if nowhere
+};
+
+static struct
+{
+    const char *out_dir;
+    int scale;
+    int pal; // -1 to keep the one of each document
+    bool png;
+    const char *atlas; // Base name of the atlas files, NULL for none
+    int atlas_size;
+    int threads;
+
+    struct job *jobs;
+    int count, cap;
+    atomic_int next;
+} batch = {
+    .out_dir = ".",
+    .scale = 1,
+    .pal = -1,
+    .png = true,
+    .atlas_size = ATLAS_SIZE,
+};
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [options] FILE|DIR...\n"
+            "  -o DIR          directory for the images (default .)\n"
+            "  --scale N       pixels per cell, 1 to %d (default 1)\n"
+            "  --palette P     palette name, index or file to use instead of\n"
+            "                  the one of each document\n"
+            "  --atlas NAME    also pack every sprite into NAME-0.png, ...,\n"
+            "                  listed in NAME.json\n"
+            "  --atlas-size N  side of each atlas page (default %d)\n"
+            "  --no-png        skip the image of each document\n"
+            "  -j N            worker threads (default one per core)\n"
+            "Directories are searched for .data documents.\n", name, SCALE_MAX, ATLAS_SIZE);
+    exit(1);
+}
+
+static void add_job(const char *path)
+{
+    if (batch.count == batch.cap)
+    {
+        batch.cap = batch.cap ? 2 * batch.cap : 64;
+        batch.jobs = realloc(batch.jobs, batch.cap * sizeof(batch.jobs[0]));
+        if (!batch.jobs)
+        {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+    struct job *job = &batch.jobs[batch.count++];
+    memset(job, 0, sizeof(*job));
+    job->path = strdup(path);
+    job->page = -1;
+
+    // "docs/a/state.data" becomes "docs-a-state", so documents with the
+    // same file name in different directories don't clash
+    while (path[0] == '.' && path[1] == '/')
+        path += 2;
+    while (path[0] == '/')
+        path += 1;
+    snprintf(job->name, sizeof(job->name), "%s", path);
+    char *dot = strrchr(job->name, '.');
+    if (dot && !strchr(dot, '/'))
+        *dot = '\0';
+    for (char *c = job->name; *c; ++c)
+    {
+        if (*c == '/')
+            *c = '-';
+    }
+}
+
+// Index of the palette named by arg: an index, a loaded palette name or a
+// palette file. -1 if none.
+static int find_palette(const char *arg)
+{
+    char *end;
+    long i = strtol(arg, &end, 10);
+    if (*end == '\0')
+        return (i >= 0 && i < palette_count()) ? i : -1;
+    for (int p = 0; p < palette_count(); ++p)
+    {
+        if (strcasecmp(palette_get(p)->name, arg) == 0)
+            return p;
+    }
+    return FileExists(arg) ? palettes_load_file(arg) : -1;
+}
+
+static bool write_file(const char *path, const unsigned char *data, int len)
+{
+    FILE *f = fopen(path, "wb");
+    bool ok = f && fwrite(data, 1, len, f) == (size_t)len;
+    if (f && fclose(f) != 0)
+        ok = false;
+    return ok;
+}
+
+// The canvas as side x side RGBA pixels, each cell scale x scale of them.
+static unsigned char *sprite_rgba(const struct state *st, const struct palette *pal, int scale)
+{
+    int side = st->size * scale;
+    unsigned char *rgba = malloc((size_t)side * side * 4);
+    unsigned char *cells = malloc(st->size);
+    unsigned char *wide = malloc(side);
+    if (!rgba || !cells || !wide)
+    {
+        free(rgba);
+        rgba = NULL;
+    }
+    for (int y = 0; rgba && y < st->size; ++y)
+    {
+        matrix_read_row(&st->mat, 0, y, st->size, cells);
+        for (int x = 0; x < side; ++x)
+            wide[x] = cells[x / scale];
+        unsigned char *row = &rgba[(size_t)y * scale * side * 4];
+        kernel_expand_rgba(wide, side, (const unsigned char *)pal->colors, row);
+        for (int k = 1; k < scale; ++k)
+            memcpy(row + (size_t)k * side * 4, row, (size_t)side * 4);
+    }
+    free(cells);
+    free(wide);
+    return rgba;
+}
+
+static void convert(struct job *job)
+{
+    struct state *st = calloc(1, sizeof(*st));
+    if (!st || !document_load(job->path, st))
+    {
+        fprintf(stderr, "%s: not a document\n", job->path);
+        free(st);
+        return;
+    }
+    const struct palette *pal = palette_get((batch.pal >= 0) ? batch.pal : st->pal);
+
+    job->ok = true;
+    if (batch.png)
+    {
+        int len = 0;
+        unsigned char *png = png_encode(st, pal->colors, batch.scale, &len);
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s.png", batch.out_dir, job->name);
+        job->ok = png && write_file(path, png, len);
+        if (!job->ok)
+            fprintf(stderr, "%s: could not write %s\n", job->path, path);
+        free(png);
+    }
+    if (job->ok && batch.atlas)
+    {
+        job->side = st->size * batch.scale;
+        job->rgba = sprite_rgba(st, pal, batch.scale);
+        job->ok = job->rgba != NULL;
+        if (!job->ok)
+            fprintf(stderr, "%s: out of memory\n", job->path);
+    }
+    matrix_free(&st->mat);
+    frames_free(&st->frames);
+    free(st);
+}
+
+static void *worker(void *data)
+{
+    (void)data;
+    for (;;)
+    {
+        int i = atomic_fetch_add(&batch.next, 1);
+        if (i >= batch.count)
+            break;
+        convert(&batch.jobs[i]);
+    }
+    return NULL;
+}
+
+// Big sprites first, then by name, so atlases come out the same every time.
+static int compare_sprites(const void *a, const void *b)
+{
+    const struct job *ja = *(struct job *const *)a;
+    const struct job *jb = *(struct job *const *)b;
+    if (ja->side != jb->side)
+        return jb->side - ja->side;
+    return strcmp(ja->name, jb->name);
+}
+
+static void json_string(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; ++s)
+    {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', f);
+        if ((unsigned char)*s >= 0x20)
+            fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+// Packs the sprites on shelves, in pages of atlas_size square trimmed to
+// what they hold. Returns false if a page could not be written.
+static bool atlas_write(void)
+{
+    struct job **sprites = malloc(batch.count * sizeof(sprites[0]));
+    if (!sprites)
+        return false;
+    int count = 0;
+    for (int i = 0; i < batch.count; ++i)
+    {
+        if (batch.jobs[i].rgba)
+            sprites[count++] = &batch.jobs[i];
+    }
+    qsort(sprites, count, sizeof(sprites[0]), compare_sprites);
+
+    // Place them: shelves as tall as their first sprite, left to right
+    int pages = 0;
+    int x = 0, y = 0, shelf = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        struct job *s = sprites[i];
+        if (s->side > batch.atlas_size)
+        {
+            fprintf(stderr, "%s: too big for the atlas\n", s->path);
+            continue;
+        }
+        if (x + s->side > batch.atlas_size)
+        {
+            x = 0;
+            y += shelf;
+            shelf = 0;
+        }
+        if (pages == 0 || y + s->side > batch.atlas_size)
+        {
+            pages += 1;
+            x = y = shelf = 0;
+        }
+        s->page = pages - 1;
+        s->x = x;
+        s->y = y;
+        x += s->side;
+        shelf = (shelf > s->side) ? shelf : s->side;
+    }
+
+    bool ok = true;
+    for (int p = 0; p < pages; ++p)
+    {
+        int w = 0, h = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            const struct job *s = sprites[i];
+            if (s->page != p)
+                continue;
+            w = (s->x + s->side > w) ? s->x + s->side : w;
+            h = (s->y + s->side > h) ? s->y + s->side : h;
+        }
+        unsigned char *pixels = calloc((size_t)w * h, 4);
+        if (!pixels)
+        {
+            ok = false;
+            break;
+        }
+        for (int i = 0; i < count; ++i)
+        {
+            const struct job *s = sprites[i];
+            if (s->page != p)
+                continue;
+            for (int r = 0; r < s->side; ++r)
+                memcpy(&pixels[((size_t)(s->y + r) * w + s->x) * 4], &s->rgba[(size_t)r * s->side * 4], (size_t)s->side * 4);
+        }
+        Image page = {pixels, w, h, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8};
+        ok = ExportImage(page, TextFormat("%s/%s-%d.png", batch.out_dir, batch.atlas, p)) && ok;
+        free(pixels);
+    }
+
+    FILE *f = fopen(TextFormat("%s/%s.json", batch.out_dir, batch.atlas), "w");
+    if (f)
+    {
+        fprintf(f, "{\n  \"pages\": [");
+        for (int p = 0; p < pages; ++p)
+        {
+            fputs(p ? ", " : "", f);
+            json_string(f, TextFormat("%s-%d.png", batch.atlas, p));
+        }
+        fprintf(f, "],\n  \"sprites\": [");
+        bool first = true;
+        for (int i = 0; i < count; ++i)
+        {
+            const struct job *s = sprites[i];
+            if (s->page < 0)
+                continue;
+            fprintf(f, first ? "\n    {\"name\": " : ",\n    {\"name\": ");
+            json_string(f, s->name);
+            fprintf(f, ", \"page\": %d, \"x\": %d, \"y\": %d, \"w\": %d, \"h\": %d}",
+                    s->page, s->x, s->y, s->side, s->side);
+            first = false;
+        }
+        fprintf(f, "\n  ]\n}\n");
+        ok = (fclose(f) == 0) && ok;
+    }
+    else
+    {
+        ok = false;
+    }
+    free(sprites);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    SetTraceLogLevel(LOG_WARNING);
+    palettes_init();
+    palettes_load_dir("palettes");
+
+    batch.threads = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 1; i < argc; ++i)
+    {
+        const char *arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(arg, "-o") == 0 && has_value)
+            batch.out_dir = argv[++i];
+        else if (strcmp(arg, "--scale") == 0 && has_value)
+            batch.scale = atoi(argv[++i]);
+        else if (strcmp(arg, "--palette") == 0 && has_value)
+        {
+            batch.pal = find_palette(argv[++i]);
+            if (batch.pal < 0)
+            {
+                fprintf(stderr, "Unknown palette %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(arg, "--atlas") == 0 && has_value)
+            batch.atlas = argv[++i];
+        else if (strcmp(arg, "--atlas-size") == 0 && has_value)
+            batch.atlas_size = atoi(argv[++i]);
+        else if (strcmp(arg, "--no-png") == 0)
+            batch.png = false;
+        else if (strcmp(arg, "-j") == 0 && has_value)
+            batch.threads = atoi(argv[++i]);
+        else if (arg[0] == '-')
+            usage(argv[0]);
+        else if (DirectoryExists(arg))
+        {
+            FilePathList files = LoadDirectoryFilesEx(arg, ".data", true);
+            for (unsigned int f = 0; f < files.count; ++f)
+                add_job(files.paths[f]);
+            UnloadDirectoryFiles(files);
+        }
+        else
+            add_job(arg);
+    }
+    if (batch.count == 0 || batch.scale < 1 || batch.scale > SCALE_MAX || batch.atlas_size < 1)
+        usage(argv[0]);
+    if (batch.threads < 1)
+        batch.threads = 1;
+    if (batch.threads > THREADS_MAX)
+        batch.threads = THREADS_MAX;
+    if (batch.threads > batch.count)
+        batch.threads = batch.count;
+
+    double start = platform_time();
+    pthread_t threads[THREADS_MAX];
+    int started = 0;
+    for (; started < batch.threads; ++started)
+    {
+        if (pthread_create(&threads[started], NULL, worker, NULL) != 0)
+            break;
+    }
+    // Without any thread, this one does the work
+    if (started == 0)
+        worker(NULL);
+    for (int t = 0; t < started; ++t)
+        pthread_join(threads[t], NULL);
+    double converted = platform_time();
+
+    int ok = 0;
+    for (int i = 0; i < batch.count; ++i)
+        ok += batch.jobs[i].ok;
+    bool atlas_ok = !batch.atlas || atlas_write();
+    double end = platform_time();
+
+    printf("%d of %d files in %.3f s with %d threads: %.1f files/s\n",
+            ok, batch.count, converted - start, started ? started : 1,
+            (converted > start) ? batch.count / (converted - start) : 0.0);
+    if (batch.atlas)
+        printf("atlas in %.3f s\n", end - converted);
+
+    for (int i = 0; i < batch.count; ++i)
+    {
+        free((void *)batch.jobs[i].path);
+        free(batch.jobs[i].rgba);
+    }
+    free(batch.jobs);
+    return (ok == batch.count && atlas_ok) ? 0 : 1;
+}
@@ -0,0 +1,427 @@
+// Benchmark of the editor's hot paths, built by compile_native.sh as
+// jolly-bench. It includes main.c, so the layout and whole frames are
+// measured with the editor's own code, run headless. Results go out as
+// JSON: time per operation, heap allocations per operation and the heap
+// high-water mark of each case.
+//
+// Allocations are counted by wrapping malloc and friends, which needs
+// glibc.
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <malloc.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#define JOLLY_BENCH
+#include "main.c"
+
+#define MIN_TIME 0.25 // Default seconds each case runs for
+
+static const int BENCH_SIZES[] = {32, 256, 1024, 4096};
+
+// Heap use, counted from the start of the process. The journal's worker
+// thread allocates too, so the counters are atomic.
+static struct
+{
+    atomic_ullong count, bytes; // Allocations made and their bytes
+    atomic_size_t live, peak;
+} heap;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *p);
+
+static void *heap_add(void *p)
+{
+    if (!p)
+        return p;
+    size_t n = malloc_usable_size(p);
+    atomic_fetch_add_explicit(&heap.count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&heap.bytes, n, memory_order_relaxed);
+    size_t live = atomic_fetch_add_explicit(&heap.live, n, memory_order_relaxed) + n;
+    size_t peak = atomic_load_explicit(&heap.peak, memory_order_relaxed);
+    while (live > peak && !atomic_compare_exchange_weak_explicit(&heap.peak, &peak, live,
+                memory_order_relaxed, memory_order_relaxed))
+        ;
+    return p;
+}
+
+static void heap_remove(void *p)
+{
+    if (p)
+        atomic_fetch_sub_explicit(&heap.live, malloc_usable_size(p), memory_order_relaxed);
+}
+
+void *malloc(size_t size)
+{
+    return heap_add(__libc_malloc(size));
+}
+
+void *calloc(size_t n, size_t size)
+{
+    return heap_add(__libc_calloc(n, size));
+}
+
+void *realloc(void *p, size_t size)
+{
+    size_t old = p ? malloc_usable_size(p) : 0;
+    void *q = __libc_realloc(p, size);
+    if (q || size == 0)
+    {
+        atomic_fetch_sub_explicit(&heap.live, old, memory_order_relaxed);
+        heap_add(q);
+    }
+    return q;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return heap_add(__libc_memalign(alignment, size));
+}
+
+int posix_memalign(void **p, size_t alignment, size_t size)
+{
+    *p = heap_add(__libc_memalign(alignment, size));
+    return *p ? 0 : ENOMEM;
+}
+
+void free(void *p)
+{
+    heap_remove(p);
+    __libc_free(p);
+}
+
+static struct
+{
+    FILE *out;
+    double min_time;
+    int cases;
+    unsigned int seed;
+    struct app app; // Its state is the canvas of every case
+} bench = {
+    .min_time = MIN_TIME,
+    .seed = 1,
+};
+
+static unsigned int bench_random(void)
+{
+    bench.seed = bench.seed * 1103515245 + 12345;
+    return bench.seed >> 8;
+}
+
+// Runs op in rounds, each twice as long as the last, until they take
+// min_time, and writes the case to the JSON.
+static void measure(const char *name, int size, void (*op)(void))
+{
+    op(); // Warm up, and first allocations out of the way
+    journal_wait(&journal);
+    unsigned long long count = atomic_load(&heap.count);
+    unsigned long long bytes = atomic_load(&heap.bytes);
+    size_t live = atomic_load(&heap.live);
+    atomic_store(&heap.peak, live);
+
+    long long ops = 0;
+    double elapsed = 0;
+    for (long long round = 1; elapsed < bench.min_time; round *= 2)
+    {
+        double start = platform_time();
+        for (long long i = 0; i < round; ++i)
+            op();
+        elapsed += platform_time() - start;
+        ops += round;
+    }
+    // A snapshot the case started counts for it, allocations and all
+    journal_wait(&journal);
+
+    fprintf(bench.out, "%s\n    {\"name\": \"%s\", \"size\": %d, \"ops\": %lld, \"ns_per_op\": %.1f, "
+            "\"allocs_per_op\": %.2f, \"bytes_per_op\": %.1f, \"peak_bytes\": %zu}",
+            bench.cases ? "," : "", name, size, ops, 1e9 * elapsed / ops,
+            (double)(atomic_load(&heap.count) - count) / ops, (double)(atomic_load(&heap.bytes) - bytes) / ops,
+            atomic_load(&heap.peak) - live);
+    fflush(bench.out);
+    bench.cases += 1;
+}
+
+// Starts a case on an empty canvas of size, history included.
+static struct state *canvas_reset(int size)
+{
+    struct state *st = &bench.app.st;
+    matrix_free(&st->mat);
+    frames_free(&st->frames);
+    st->size = size;
+    state_touch_rect(st, 0, 0, MAX_CANVAS_SIZE, MAX_CANVAS_SIZE);
+    undostack_reset(st, &bench.app.stack);
+    return st;
+}
+
+static void canvas_noise(struct state *st)
+{
+    for (int y = 0; y < st->size; ++y)
+    {
+        for (int x = 0; x < st->size; ++x)
+            state_set(st, x, y, bench_random() % 16);
+    }
+}
+
+static int fill_color;
+
+// One corridor winding through every other row, the longest region a
+// canvas can have, one span per row.
+static void fill_serpentine_op(void)
+{
+    fill_color = (fill_color == 1) ? 2 : 1;
+    flood_fill(&bench.app.st, 0, 0, fill_color, false);
+}
+
+// Cells of one color touching only by their corners: every span is one
+// cell long.
+static void fill_checker_op(void)
+{
+    fill_color = (fill_color == 1) ? 2 : 1;
+    flood_fill(&bench.app.st, 0, 0, fill_color, true);
+}
+
+static void bench_fill(int size)
+{
+    struct state *st = canvas_reset(size);
+    for (int y = 1; y < size; y += 2)
+    {
+        for (int x = 0; x < size; ++x)
+            state_set(st, x, y, 3);
+        state_set(st, ((y / 2) % 2) ? 0 : size - 1, y, 0);
+    }
+    fill_color = 0;
+    measure("flood_fill_serpentine", size, fill_serpentine_op);
+
+    st = canvas_reset(size);
+    for (int y = 0; y < size; ++y)
+    {
+        for (int x = 0; x < size; ++x)
+            state_set(st, x, y, ((x + y) % 2) ? 3 : 0);
+    }
+    fill_color = 0;
+    measure("flood_fill_checker_diagonal", size, fill_checker_op);
+}
+
+// A stroke's worth of cells and its undo level, the history already full.
+static void undo_save_op(void)
+{
+    struct state *st = &bench.app.st;
+    for (int i = 0; i < 16; ++i)
+        state_set(st, bench_random() % st->size, bench_random() % st->size, bench_random() % 16);
+    undostack_save(st, &bench.app.stack);
+}
+
+static void bench_undo(int size)
+{
+    struct state *st = canvas_reset(size);
+    canvas_noise(st);
+    undostack_reset(st, &bench.app.stack);
+    for (int i = 0; i < UNDO_LEVELS; ++i)
+        undo_save_op();
+    measure("undostack_save_full", size, undo_save_op);
+}
+
+static void shift_x_op(void)
+{
+    transform_shift(&bench.app.st, 1, 0);
+}
+
+static void shift_y_op(void)
+{
+    transform_shift(&bench.app.st, 0, 1);
+}
+
+static void rotate_op(void)
+{
+    transform_rotate(&bench.app.st, true);
+}
+
+static void bench_transform(int size)
+{
+    canvas_noise(canvas_reset(size));
+    measure("transform_shift_x", size, shift_x_op);
+    measure("transform_shift_y", size, shift_y_op);
+    measure("transform_rotate", size, rotate_op);
+}
+
+static struct image blit_image;
+static int blit_x;
+
+// A selection half the canvas across dropped a bit further each time,
+// wrapping around the edges, with a transparent color.
+static void blit_op(void)
+{
+    blit_x += 7;
+    image_blit(&bench.app.st, &blit_image, blit_x, blit_x / 2, 0, true);
+}
+
+static void bench_select(int size)
+{
+    struct state *st = canvas_reset(size);
+    canvas_noise(st);
+    struct selection sel = {0};
+    selection_rect(&sel, 0, 0, size / 2 + 1, size / 2 + 1);
+    selection_copy(&sel, st, &blit_image);
+    selection_clear(&sel);
+    blit_x = 0;
+    measure("image_blit_wrap", size, blit_op);
+    image_free(&blit_image);
+}
+
+// What image_save does, short of writing the file: the cache is emptied
+// first, or every call after the first would be a cache hit.
+static void image_op(bool big)
+{
+    struct png_cache *cache = &bench.app.exports[big];
+    png_cache_free(cache);
+    int len;
+    png_cache_get(cache, &bench.app.st, palette_get(bench.app.st.pal)->colors, export_scale(&bench.app.st, big), &len);
+}
+
+static void image_normal_op(void)
+{
+    image_op(false);
+}
+
+static void image_big_op(void)
+{
+    image_op(true);
+}
+
+static void bench_image(int size)
+{
+    canvas_noise(canvas_reset(size));
+    measure("image_save_normal", size, image_normal_op);
+    measure("image_save_big", size, image_big_op);
+}
+
+static void encode_op(void)
+{
+    int len;
+    free(document_encode(&bench.app.st, &len));
+}
+
+static unsigned char *document;
+static int document_len;
+static struct state decoded;
+
+static void decode_op(void)
+{
+    document_decode(document, document_len, &decoded);
+}
+
+static void bench_document(int size)
+{
+    struct state *st = canvas_reset(size);
+    canvas_noise(st);
+    measure("document_encode", size, encode_op);
+
+    document = document_encode(st, &document_len);
+    measure("document_decode", size, decode_op);
+    free(document);
+    matrix_free(&decoded.mat);
+    frames_free(&decoded.frames);
+}
+
+static struct layout layout_sink;
+
+static void layout_op(void)
+{
+    layout_sink = compute_layout();
+}
+
+// A frame of the editor while something changes, like during a stroke, so
+// the autosave has work when it is due.
+static void frame_op(void)
+{
+    struct state *st = &bench.app.st;
+    state_set(st, bench_random() % st->size, bench_random() % st->size, bench_random() % 16);
+    app_frame(&bench.app);
+}
+
+static void bench_frame(int size)
+{
+    canvas_noise(canvas_reset(size));
+    autosave_init(&bench.app.autosave, &bench.app.st);
+    measure("frame", size, frame_op);
+    autosave_flush(&bench.app.autosave, &bench.app.st);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [--out FILE] [--min-time S]\n"
+            "  --out FILE    write the JSON to FILE instead of stdout\n"
+            "  --min-time S  seconds each case runs for (default %.2f)\n", name, MIN_TIME);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    bench.out = stdout;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+        {
+            bench.out = fopen(argv[++i], "w");
+            if (!bench.out)
+            {
+                fprintf(stderr, "Could not write %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc)
+            bench.min_time = atof(argv[++i]);
+        else
+            usage(argv[0]);
+    }
+
+    // The editor runs headless, saving to a directory of its own
+    char dir[] = "/tmp/jolly-bench-XXXXXX";
+    if (!mkdtemp(dir))
+    {
+        fprintf(stderr, "Could not create a data directory\n");
+        return 1;
+    }
+    char *editor_argv[] = {argv[0], "--headless", "--data", dir, NULL};
+    platform_init(4, editor_argv);
+    platform_storage_init();
+    palettes_init();
+    palettes_load_dir("palettes");
+    state_load(&bench.app.st);
+    input_poll(); // The layout takes the screen size from the input
+
+    fprintf(bench.out, "{\n  \"isa\": \"%s\",\n  \"min_time\": %.3f,\n  \"cases\": [",
+            kernel_isa(), bench.min_time);
+    measure("compute_layout", 0, layout_op);
+    for (int i = 0; i < ARRAY_SIZE(BENCH_SIZES); ++i)
+    {
+        int size = BENCH_SIZES[i];
+        bench_fill(size);
+        bench_undo(size);
+        bench_transform(size);
+        bench_select(size);
+        bench_image(size);
+        bench_document(size);
+        bench_frame(size);
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(bench.out, "\n  ],\n  \"max_rss_kb\": %ld\n}\n", usage.ru_maxrss);
+
+    canvas_reset(0);
+    png_cache_free(&bench.app.exports[0]);
+    png_cache_free(&bench.app.exports[1]);
+    remove(TextFormat("%s/state.data", dir));
+    remove(TextFormat("%s/state.data.journal", dir));
+    rmdir(dir);
+    if (bench.out != stdout)
+        fclose(bench.out);
+    return 0;
+}
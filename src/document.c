@@ -0,0 +1,548 @@
+#include "document.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernels.h"
+#include "platform.h"
+
+#define HEADER_SIZE 16
+#define CHUNK_HEADER_SIZE 8
+#define META_SIZE 8
+#define PIXL_HEADER_SIZE 12
+#define ANIM_SIZE 8
+#define FRAM_HEADER_SIZE 8
+
+// Largest packed region, and its worst case run-length encoding: one
+// length byte per 128 literal bytes.
+#define PACKED_MAX (DOCUMENT_CHUNK_SIZE * DOCUMENT_CHUNK_SIZE / 2)
+#define RLE_MAX (PACKED_MAX + PACKED_MAX / 128 + 1)
+#define PIXL_MAX (CHUNK_HEADER_SIZE + PIXL_HEADER_SIZE + RLE_MAX)
+
+// Saves of older versions are the struct state up to the change tracking,
+// written by the wasm build: 32x32 cells, then size, pal, col1 and col2 as
+// 32-bit ints and grid as a byte, padded to 1044 bytes.
+#define LEGACY_CANVAS_SIZE 32
+#define LEGACY_CELLS 0
+#define LEGACY_SIZE 1024
+#define LEGACY_PAL 1028
+#define LEGACY_COL1 1032
+#define LEGACY_COL2 1036
+#define LEGACY_GRID 1040
+#define LEGACY_MIN_LENGTH 1041
+
+static void put_u16(unsigned char *p, unsigned int v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+}
+
+static void put_u32(unsigned char *p, unsigned int v)
+{
+    put_u16(p, v & 0xFFFF);
+    put_u16(p + 2, v >> 16);
+}
+
+static unsigned int get_u16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static unsigned int get_u32(const unsigned char *p)
+{
+    return get_u16(p) | (get_u16(p + 2) << 16);
+}
+
+// Cells of a region, one per byte, on their way in or out of a chunk. One
+// per thread, so the batch converter can decode several documents at once.
+static _Thread_local unsigned char region[DOCUMENT_CHUNK_SIZE * DOCUMENT_CHUNK_SIZE + 1];
+
+// Packs the w x h cells at (x0, y0) two per byte, returns the byte count.
+static int pack_region(const struct matrix *mat, int x0, int y0, int w, int h, unsigned char *out)
+{
+    for (int y = 0; y < h; ++y)
+        matrix_read_row(mat, x0, y0 + y, w, &region[y * w]);
+    int n = w * h;
+    region[n] = 0; // Pads odd counts with a 0 cell
+    kernel_pack(region, (n + 1) / 2, out);
+    return (n + 1) / 2;
+}
+
+static void unpack_region(struct matrix *mat, int x0, int y0, int w, int h, const unsigned char *in)
+{
+    kernel_unpack(in, (w * h + 1) / 2, region);
+    // Regions are clipped to the canvas, not rejected
+    int cols = (x0 + w > MAX_CANVAS_SIZE) ? MAX_CANVAS_SIZE - x0 : w;
+    for (int y = 0; y < h && y0 + y < MAX_CANVAS_SIZE; ++y)
+        matrix_write_row(mat, x0, y0 + y, cols, &region[y * w]);
+}
+
+// PackBits: a byte n < 128 is followed by n + 1 literal bytes, a byte
+// n >= 128 by one byte repeated n - 126 times.
+static int rle_encode(const unsigned char *in, int len, unsigned char *out)
+{
+    int o = 0;
+    int i = 0;
+    while (i < len)
+    {
+        int run = 1;
+        while (i + run < len && run < 129 && in[i + run] == in[i])
+            run += 1;
+        if (run >= 2)
+        {
+            out[o++] = run + 126;
+            out[o++] = in[i];
+            i += run;
+            continue;
+        }
+
+        // Literals up to the next run
+        int start = i;
+        int n = 0;
+        while (i < len && n < 128 && !(i + 1 < len && in[i + 1] == in[i]))
+        {
+            i += 1;
+            n += 1;
+        }
+        out[o++] = n - 1;
+        memcpy(&out[o], &in[start], n);
+        o += n;
+    }
+    return o;
+}
+
+static bool rle_decode(const unsigned char *in, int len, unsigned char *out, int out_len)
+{
+    int o = 0;
+    int i = 0;
+    while (i < len && o < out_len)
+    {
+        int n = in[i++];
+        if (n < 128)
+        {
+            n += 1;
+            if (i + n > len || o + n > out_len)
+                return false;
+            memcpy(&out[o], &in[i], n);
+            i += n;
+        }
+        else
+        {
+            n -= 126;
+            if (i >= len || o + n > out_len)
+                return false;
+            memset(&out[o], in[i++], n);
+        }
+        o += n;
+    }
+    return o == out_len;
+}
+
+// Whether every tile under the region is unallocated, so it reads as 0.
+static bool region_empty(const struct matrix *mat, int x0, int y0, int w, int h)
+{
+    for (int ty = y0 / TILE_SIZE; ty * TILE_SIZE < y0 + h; ++ty)
+    {
+        for (int tx = x0 / TILE_SIZE; tx * TILE_SIZE < x0 + w; ++tx)
+        {
+            if (matrix_tile(mat, tx, ty))
+                return false;
+        }
+    }
+    return true;
+}
+
+static int region_count(const struct matrix *mat, int size)
+{
+    int count = 0;
+    for (int y = 0; y < size; y += DOCUMENT_CHUNK_SIZE)
+    {
+        for (int x = 0; x < size; x += DOCUMENT_CHUNK_SIZE)
+        {
+            if (!region_empty(mat, x, y, DOCUMENT_CHUNK_SIZE, DOCUMENT_CHUNK_SIZE))
+                count += 1;
+        }
+    }
+    return count;
+}
+
+// Writes a PIXL chunk for each region of mat with cells in it, there must
+// be room for region_count of them. Returns the bytes written.
+static int pixels_encode(const struct matrix *mat, int size, unsigned char *out, int *chunks)
+{
+    // Only the cells inside the canvas are kept, regions that were never
+    // painted are left out
+    unsigned char packed[PACKED_MAX];
+    unsigned char rle[RLE_MAX];
+    int o = 0;
+    for (int y = 0; y < size; y += DOCUMENT_CHUNK_SIZE)
+    {
+        for (int x = 0; x < size; x += DOCUMENT_CHUNK_SIZE)
+        {
+            if (region_empty(mat, x, y, DOCUMENT_CHUNK_SIZE, DOCUMENT_CHUNK_SIZE))
+                continue;
+            int w = (size - x < DOCUMENT_CHUNK_SIZE) ? size - x : DOCUMENT_CHUNK_SIZE;
+            int h = (size - y < DOCUMENT_CHUNK_SIZE) ? size - y : DOCUMENT_CHUNK_SIZE;
+            int packed_len = pack_region(mat, x, y, w, h, packed);
+            int rle_len = rle_encode(packed, packed_len, rle);
+            bool use_rle = rle_len < packed_len;
+            int payload = use_rle ? rle_len : packed_len;
+
+            unsigned char *chunk = out + o;
+            memcpy(chunk, "PIXL", 4);
+            put_u32(chunk + 4, PIXL_HEADER_SIZE + payload);
+            put_u16(chunk + 8, x);
+            put_u16(chunk + 10, y);
+            put_u16(chunk + 12, w);
+            put_u16(chunk + 14, h);
+            chunk[16] = use_rle ? DOCUMENT_RLE : DOCUMENT_RAW;
+            memset(chunk + 17, 0, 3);
+            memcpy(chunk + CHUNK_HEADER_SIZE + PIXL_HEADER_SIZE, use_rle ? rle : packed, payload);
+            o += CHUNK_HEADER_SIZE + PIXL_HEADER_SIZE + payload;
+            *chunks += 1;
+        }
+    }
+    return o;
+}
+
+// Appends a FRAM chunk for each frame other than the current one, growing
+// data as needed. Returns the new length, or -1 if out of memory.
+static int frames_encode(const struct state *st, unsigned char **data, int o, int *chunks)
+{
+    const struct frames *fr = &st->frames;
+    struct matrix frame = {0};
+    for (int i = 0; i < fr->count; ++i)
+    {
+        if (i == fr->current)
+            continue;
+        frames_read(st, i, &frame);
+        int cap = o + CHUNK_HEADER_SIZE + FRAM_HEADER_SIZE + region_count(&frame, st->size) * PIXL_MAX;
+        unsigned char *grown = realloc(*data, cap);
+        if (!grown)
+        {
+            matrix_free(&frame);
+            return -1;
+        }
+        *data = grown;
+
+        unsigned char *chunk = grown + o;
+        int regions = 0;
+        int pixels = pixels_encode(&frame, st->size, chunk + CHUNK_HEADER_SIZE + FRAM_HEADER_SIZE, &regions);
+        memcpy(chunk, "FRAM", 4);
+        put_u32(chunk + 4, FRAM_HEADER_SIZE + pixels);
+        put_u16(chunk + 8, i);
+        put_u16(chunk + 10, fr->list[i].duration);
+        put_u32(chunk + 12, 0);
+        o += CHUNK_HEADER_SIZE + FRAM_HEADER_SIZE + pixels;
+        *chunks += 1;
+    }
+    matrix_free(&frame);
+    return o;
+}
+
+unsigned char *document_encode(const struct state *st, int *len)
+{
+    int size = st->size;
+    const struct frames *fr = &st->frames;
+    unsigned char *data = malloc(HEADER_SIZE + CHUNK_HEADER_SIZE + META_SIZE
+            + CHUNK_HEADER_SIZE + ANIM_SIZE + region_count(&st->mat, size) * PIXL_MAX);
+    if (!data)
+        return NULL;
+
+    memcpy(data, "JPNT", 4);
+    put_u16(data + 4, DOCUMENT_VERSION);
+    put_u16(data + 6, HEADER_SIZE);
+    put_u32(data + 12, 0);
+    int o = HEADER_SIZE;
+    int chunks = 0;
+
+    unsigned char *chunk = data + o;
+    memcpy(chunk, "META", 4);
+    put_u32(chunk + 4, META_SIZE);
+    put_u16(chunk + 8, size);
+    put_u16(chunk + 10, size);
+    chunk[12] = st->pal;
+    chunk[13] = st->col1;
+    chunk[14] = st->col2;
+    chunk[15] = st->grid ? 1 : 0;
+    o += CHUNK_HEADER_SIZE + META_SIZE;
+    chunks += 1;
+
+    o += pixels_encode(&st->mat, size, data + o, &chunks);
+
+    if (fr->count > 0)
+    {
+        chunk = data + o;
+        memcpy(chunk, "ANIM", 4);
+        put_u32(chunk + 4, ANIM_SIZE);
+        put_u16(chunk + 8, fr->count);
+        put_u16(chunk + 10, fr->current);
+        put_u16(chunk + 12, fr->list[fr->current].duration);
+        chunk[14] = fr->onion ? 1 : 0;
+        chunk[15] = 0;
+        o += CHUNK_HEADER_SIZE + ANIM_SIZE;
+        chunks += 1;
+
+        o = frames_encode(st, &data, o, &chunks);
+        if (o < 0)
+        {
+            free(data);
+            return NULL;
+        }
+    }
+
+    put_u32(data + 8, chunks);
+    *len = o;
+    return data;
+}
+
+static bool settings_valid(int size, int col1, int col2)
+{
+    return size > 0 && size <= MAX_CANVAS_SIZE && col1 >= 0 && col1 < 16 && col2 >= 0 && col2 < 16;
+}
+
+// Document contents before they replace the ones of the state.
+struct decoded
+{
+    struct matrix mat;
+    int size, pal, col1, col2;
+    bool grid;
+    struct frames frames;
+    int frame_count, current, duration; // From ANIM, frame_count 0 without it
+    bool onion;
+};
+
+static bool legacy_decode(const unsigned char *data, int len, struct decoded *doc)
+{
+    if (len < LEGACY_MIN_LENGTH)
+        return false;
+    int size, pal, col1, col2;
+    memcpy(&size, data + LEGACY_SIZE, sizeof(int));
+    memcpy(&pal, data + LEGACY_PAL, sizeof(int));
+    memcpy(&col1, data + LEGACY_COL1, sizeof(int));
+    memcpy(&col2, data + LEGACY_COL2, sizeof(int));
+    if (!settings_valid(size, col1, col2) || size > LEGACY_CANVAS_SIZE || pal < 0)
+        return false;
+
+    const unsigned char *cells = data + LEGACY_CELLS;
+    for (int i = 0; i < LEGACY_CANVAS_SIZE * LEGACY_CANVAS_SIZE; ++i)
+    {
+        if (cells[i] >= 16)
+            return false;
+    }
+    for (int y = 0; y < LEGACY_CANVAS_SIZE; ++y)
+    {
+        for (int x = 0; x < LEGACY_CANVAS_SIZE; ++x)
+            matrix_set(&doc->mat, x, y, cells[y * LEGACY_CANVAS_SIZE + x]);
+    }
+    doc->size = size;
+    doc->pal = pal;
+    doc->col1 = col1;
+    doc->col2 = col2;
+    doc->grid = data[LEGACY_GRID] != 0;
+    return true;
+}
+
+static bool pixels_decode(const unsigned char *p, unsigned int len, struct matrix *mat)
+{
+    if (len < PIXL_HEADER_SIZE)
+        return false;
+    int x = get_u16(p);
+    int y = get_u16(p + 2);
+    int w = get_u16(p + 4);
+    int h = get_u16(p + 6);
+    int encoding = p[8];
+    if (w > DOCUMENT_CHUNK_SIZE || h > DOCUMENT_CHUNK_SIZE)
+        return false;
+    // Regions outside the canvas are skipped without decoding
+    if (x >= MAX_CANVAS_SIZE || y >= MAX_CANVAS_SIZE)
+        return true;
+
+    const unsigned char *payload = p + PIXL_HEADER_SIZE;
+    int payload_len = len - PIXL_HEADER_SIZE;
+    int packed_len = (w * h + 1) / 2;
+    unsigned char packed[PACKED_MAX];
+    if (encoding == DOCUMENT_RAW)
+    {
+        if (payload_len < packed_len)
+            return false;
+        unpack_region(mat, x, y, w, h, payload);
+    }
+    else if (encoding == DOCUMENT_RLE)
+    {
+        if (!rle_decode(payload, payload_len, packed, packed_len))
+            return false;
+        unpack_region(mat, x, y, w, h, packed);
+    }
+    else
+        return false;
+    return true;
+}
+
+static bool frame_decode(const unsigned char *p, unsigned int len, struct decoded *doc)
+{
+    if (len < FRAM_HEADER_SIZE)
+        return false;
+    int index = get_u16(p);
+    int duration = get_u16(p + 2);
+
+    // The payload is PIXL chunks, like the ones of the current frame
+    struct matrix mat = {0};
+    bool ok = true;
+    unsigned int o = FRAM_HEADER_SIZE;
+    while (ok && len - o >= CHUNK_HEADER_SIZE)
+    {
+        const unsigned char *chunk = p + o;
+        unsigned int chunk_len = get_u32(chunk + 4);
+        o += CHUNK_HEADER_SIZE;
+        if (chunk_len > len - o)
+            ok = false;
+        else if (memcmp(chunk, "PIXL", 4) == 0)
+            ok = pixels_decode(p + o, chunk_len, &mat);
+        o += chunk_len;
+    }
+    ok = ok && frames_put(&doc->frames, index, &mat, duration);
+    matrix_free(&mat);
+    return ok;
+}
+
+static bool chunks_decode(const unsigned char *data, int len, struct decoded *doc)
+{
+    unsigned int version = get_u16(data + 4);
+    unsigned int header_size = get_u16(data + 6);
+    unsigned int chunks = get_u32(data + 8);
+    if (version > DOCUMENT_VERSION || header_size < HEADER_SIZE || header_size > (unsigned)len)
+        return false;
+
+    bool meta = false;
+    unsigned int o = header_size;
+    for (unsigned int i = 0; i < chunks; ++i)
+    {
+        if (len - o < CHUNK_HEADER_SIZE)
+            return false;
+        const unsigned char *chunk = data + o;
+        unsigned int chunk_len = get_u32(chunk + 4);
+        o += CHUNK_HEADER_SIZE;
+        if (chunk_len > len - o)
+            return false;
+        const unsigned char *payload = data + o;
+        o += chunk_len;
+
+        if (memcmp(chunk, "META", 4) == 0 && chunk_len >= META_SIZE)
+        {
+            doc->size = get_u16(payload);
+            doc->pal = payload[4];
+            doc->col1 = payload[5];
+            doc->col2 = payload[6];
+            doc->grid = payload[7] & 1;
+            // Only square canvases for now
+            if (get_u16(payload + 2) != (unsigned)doc->size || !settings_valid(doc->size, doc->col1, doc->col2))
+                return false;
+            meta = true;
+        }
+        else if (memcmp(chunk, "PIXL", 4) == 0)
+        {
+            if (!pixels_decode(payload, chunk_len, &doc->mat))
+                return false;
+        }
+        else if (memcmp(chunk, "ANIM", 4) == 0 && chunk_len >= ANIM_SIZE)
+        {
+            doc->frame_count = get_u16(payload);
+            doc->current = get_u16(payload + 2);
+            doc->duration = get_u16(payload + 4);
+            doc->onion = payload[6] & 1;
+            if (doc->frame_count < 1 || doc->frame_count > FRAMES_MAX || doc->current >= doc->frame_count)
+                return false;
+        }
+        else if (memcmp(chunk, "FRAM", 4) == 0)
+        {
+            if (!frame_decode(payload, chunk_len, doc))
+                return false;
+        }
+    }
+    if (!meta || doc->frames.count > doc->frame_count)
+        return false;
+
+    // The current frame is in the state matrix, its entry is filled in
+    // when it is first stored
+    if (doc->frame_count > 0)
+    {
+        struct matrix blank = {0};
+        if (doc->frames.count < doc->frame_count && !frames_put(&doc->frames, doc->frame_count - 1, &blank, FRAME_DURATION))
+            return false;
+        if (!frames_put(&doc->frames, doc->current, &blank, doc->duration))
+            return false;
+        doc->frames.current = doc->current;
+        doc->frames.onion = doc->onion;
+    }
+    return true;
+}
+
+bool document_decode(const unsigned char *data, int len, struct state *st)
+{
+    struct decoded doc = {0};
+    bool ok;
+    if (len < HEADER_SIZE || memcmp(data, "JPNT", 4) != 0)
+        ok = legacy_decode(data, len, &doc);
+    else
+        ok = chunks_decode(data, len, &doc);
+    if (!ok)
+    {
+        matrix_free(&doc.mat);
+        frames_free(&doc.frames);
+        return false;
+    }
+
+    matrix_free(&st->mat);
+    frames_free(&st->frames);
+    st->mat = doc.mat;
+    st->frames = doc.frames;
+    st->size = doc.size;
+    st->pal = doc.pal;
+    st->col1 = doc.col1;
+    st->col2 = doc.col2;
+    st->grid = doc.grid;
+    state_touch_rect(st, 0, 0, MAX_CANVAS_SIZE, MAX_CANVAS_SIZE);
+    st->frames.revision = st->revision;
+    return true;
+}
+
+bool document_write(const char *path, const unsigned char *data, int len)
+{
+    // Write next to the document and swap it in, a failed write can't
+    // leave a truncated document behind
+    char tmp[1024];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "wb");
+    bool ok = f && fwrite(data, 1, len, f) == (size_t)len;
+    if (f && fclose(f) != 0)
+        ok = false;
+    if (ok)
+        ok = rename(tmp, path) == 0;
+    if (!ok)
+        remove(tmp);
+    return ok;
+}
+
+bool document_save(const char *path, const struct state *st)
+{
+    int len = 0;
+    unsigned char *data = document_encode(st, &len);
+    if (!data)
+        return false;
+    bool ok = document_write(path, data, len);
+    free(data);
+    return ok;
+}
+
+bool document_load(const char *path, struct state *st)
+{
+    int len = 0;
+    const unsigned char *data = platform_map_file(path, &len);
+    if (!data)
+        return false;
+    bool ok = document_decode(data, len, st);
+    platform_unmap_file(data, len);
+    return ok;
+}
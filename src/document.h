@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "state.h"
+
+// Saved documents, all numbers little endian:
+//
+//   header  "JPNT", u16 version, u16 header size, u32 chunk count, u32 reserved
+//   chunks  u32 tag, u32 payload length, payload
+//
+// "META"  u16 width, u16 height, u8 palette, u8 col1, u8 col2, u8 flags (1: grid)
+// "PIXL"  u16 x, u16 y, u16 w, u16 h, u8 encoding, 3 reserved bytes, data
+// "ANIM"  u16 frame count, u16 current frame, u16 its duration in ms,
+//         u8 flags (1: onion skin), u8 reserved
+// "FRAM"  u16 frame index, u16 duration in ms, u32 reserved, PIXL chunks
+//
+// PIXL data holds the w x h cells of a region row by row, two 4-bit cells
+// per byte (high nibble first), either as is (DOCUMENT_RAW) or PackBits
+// style run-length encoded (DOCUMENT_RLE). Regions are at most
+// DOCUMENT_CHUNK_SIZE wide and high, so readers can skip the ones they do
+// not need. Cells in no region are color 0, so blank parts of large
+// canvases take no space. document_encode writes every region each time.
+// Unknown chunks and extra payload bytes are skipped, so fields can be added.
+//
+// Top level PIXL chunks hold the frame being edited, so readers that know
+// nothing of animations still get it. Every other frame has a FRAM chunk
+// with its own PIXL chunks nested inside.
+#define DOCUMENT_VERSION 1
+#define DOCUMENT_CHUNK_SIZE 64
+
+#define DOCUMENT_RAW 0
+#define DOCUMENT_RLE 1
+
+// Serializes st into a buffer to release with free.
+unsigned char *document_encode(const struct state *st, int *len);
+// Reads a document, or the raw struct state saved by older versions.
+bool document_decode(const unsigned char *data, int len, struct state *st);
+
+// Replaces the file at path with data, all at once.
+bool document_write(const char *path, const unsigned char *data, int len);
+bool document_save(const char *path, const struct state *st);
+bool document_load(const char *path, struct state *st);
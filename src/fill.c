@@ -0,0 +1,97 @@
+#include "fill.h"
+
+#include <stdlib.h>
+
+// Seeds waiting to be filled, grown on demand and kept between fills since
+// a canvas can hold millions of cells.
+static struct seed
+{
+    short x, y;
+} *stack;
+static int stack_cap;
+
+static bool stack_push(int *len, int x, int y)
+{
+    if (*len == stack_cap)
+    {
+        int cap = stack_cap ? 2 * stack_cap : 1024;
+        struct seed *grown = realloc(stack, cap * sizeof(*stack));
+        if (!grown)
+            return false;
+        stack = grown;
+        stack_cap = cap;
+    }
+    stack[*len].x = x;
+    stack[*len].y = y;
+    *len += 1;
+    return true;
+}
+
+int flood_fill(struct state *st, int x, int y, int color, bool diagonal)
+{
+    int size = st->size;
+    if (x < 0 || y < 0 || x >= size || y >= size)
+        return 0;
+    struct matrix *mat = &st->mat;
+    int target = matrix_get(mat, x, y);
+    if (target == color)
+        return 0;
+
+    int filled = 0;
+    int x_min = x, x_max = x;
+    int y_min = y, y_max = y;
+    int len = 0;
+    stack_push(&len, x, y);
+
+    while (len > 0)
+    {
+        len -= 1;
+        x = stack[len].x;
+        y = stack[len].y;
+
+        if (matrix_get(mat, x, y) != target)
+            continue; // Filled after being pushed
+
+        // Grow the span both ways and fill it
+        int left = x, right = x;
+        while (left > 0 && matrix_get(mat, left - 1, y) == target)
+            left -= 1;
+        while (right < size - 1 && matrix_get(mat, right + 1, y) == target)
+            right += 1;
+        matrix_fill_row(mat, left, y, right - left + 1, color);
+        filled += right - left + 1;
+        if (left < x_min) x_min = left;
+        if (right > x_max) x_max = right;
+        if (y < y_min) y_min = y;
+        if (y > y_max) y_max = y;
+
+        // Seed one cell per run of target cells next to the span
+        if (diagonal)
+        {
+            if (left > 0) left -= 1;
+            if (right < size - 1) right += 1;
+        }
+        for (int ny = y - 1; ny <= y + 1; ny += 2)
+        {
+            if (ny < 0 || ny >= size)
+                continue;
+            bool in_run = false;
+            for (int nx = left; nx <= right; ++nx)
+            {
+                if (matrix_get(mat, nx, ny) != target)
+                {
+                    in_run = false;
+                }
+                else if (!in_run)
+                {
+                    in_run = true;
+                    if (!stack_push(&len, nx, ny))
+                        break; // Out of memory, the fill stops short
+                }
+            }
+        }
+    }
+
+    state_touch_rect(st, x_min, y_min, x_max + 1, y_max + 1);
+    return filled;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "state.h"
+
+// Fills the region of (x, y) with color, returns the number of cells filled.
+// Works by spans with an explicit stack, so it does not recurse. Landing on
+// a region of color already, like the sub-steps of a bucket drag do after
+// the first, costs a single lookup.
+int flood_fill(struct state *st, int x, int y, int color, bool diagonal);
@@ -0,0 +1,339 @@
+#include "frames.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "state.h"
+
+static const struct tile empty;
+
+// FNV-1a, a word at a time.
+static unsigned int tile_hash(const struct tile *t)
+{
+    const unsigned char *p = &t->packed[0][0];
+    unsigned int h = 2166136261u;
+    for (int i = 0; i < (int)sizeof(t->packed); i += 4)
+    {
+        unsigned int w;
+        memcpy(&w, p + i, 4);
+        h = (h ^ w) * 16777619u;
+    }
+    return h;
+}
+
+// The shared copy of t with one more reference, NULL if out of memory.
+static struct shared_tile *tile_intern(struct frames *fr, const struct tile *t)
+{
+    if (!fr->buckets)
+    {
+        fr->buckets = calloc(FRAMES_BUCKETS, sizeof(*fr->buckets));
+        if (!fr->buckets)
+            return NULL;
+    }
+    unsigned int hash = tile_hash(t);
+    struct shared_tile **bucket = &fr->buckets[hash % FRAMES_BUCKETS];
+    for (struct shared_tile *s = *bucket; s; s = s->next)
+    {
+        if (s->hash == hash && memcmp(&s->tile, t, sizeof(*t)) == 0)
+        {
+            s->refs += 1;
+            return s;
+        }
+    }
+
+    struct shared_tile *s = malloc(sizeof(*s));
+    if (!s)
+        return NULL;
+    s->tile = *t;
+    s->hash = hash;
+    s->refs = 1;
+    s->next = *bucket;
+    *bucket = s;
+    fr->shared += 1;
+    return s;
+}
+
+static void tile_release(struct frames *fr, struct shared_tile *s)
+{
+    s->refs -= 1;
+    if (s->refs > 0)
+        return;
+    struct shared_tile **p = &fr->buckets[s->hash % FRAMES_BUCKETS];
+    while (*p != s)
+        p = &(*p)->next;
+    *p = s->next;
+    free(s);
+    fr->shared -= 1;
+}
+
+static void release_tiles(struct frames *fr, struct frame_tile *tiles, int len)
+{
+    for (int i = 0; i < len; ++i)
+        tile_release(fr, tiles[i].shared);
+    free(tiles);
+}
+
+// Replaces the tiles of f with the non-empty ones of mat. With revisions,
+// tiles that did not change after since are taken from the old list
+// instead of being hashed again.
+static bool frame_store(struct frames *fr, struct frame *f, const struct matrix *mat,
+        const unsigned int (*tile_revision)[TILES_MAX], unsigned int since)
+{
+    int cap = 0;
+    for (int index = 0; mat->tiles && index < TILES_MAX * TILES_MAX; ++index)
+        cap += mat->tiles[index] != NULL;
+    struct frame_tile *tiles = malloc((cap > 0 ? cap : 1) * sizeof(*tiles));
+    if (!tiles)
+        return false;
+
+    int len = 0;
+    int old = 0;
+    for (int index = 0; mat->tiles && index < TILES_MAX * TILES_MAX; ++index)
+    {
+        const struct tile *t = mat->tiles[index];
+        if (!t)
+            continue;
+        while (old < f->len && f->tiles[old].index < index)
+            old += 1;
+        if (tile_revision && tile_revision[index / TILES_MAX][index % TILES_MAX] <= since)
+        {
+            // Tiles missing from the old list were empty then
+            if (old < f->len && f->tiles[old].index == index)
+            {
+                f->tiles[old].shared->refs += 1;
+                tiles[len++] = f->tiles[old];
+            }
+            continue;
+        }
+        if (memcmp(t, &empty, sizeof(*t)) == 0)
+            continue;
+        struct shared_tile *s = tile_intern(fr, t);
+        if (!s)
+        {
+            release_tiles(fr, tiles, len);
+            return false;
+        }
+        tiles[len++] = (struct frame_tile){index, s};
+    }
+
+    release_tiles(fr, f->tiles, f->len);
+    f->tiles = tiles;
+    f->len = len;
+    return true;
+}
+
+// Sets the cells of st to the ones of f, touching the tiles that differ.
+static void frame_load(struct state *st, const struct frame *f)
+{
+    int k = 0;
+    for (int index = 0; index < TILES_MAX * TILES_MAX; ++index)
+    {
+        const struct tile *from = NULL;
+        if (k < f->len && f->tiles[k].index == index)
+            from = &f->tiles[k++].shared->tile;
+        int tx = index % TILES_MAX;
+        int ty = index / TILES_MAX;
+        struct tile *to = matrix_tile(&st->mat, tx, ty);
+        if (!to && !from)
+            continue;
+        if (!from)
+            from = &empty;
+        if (to && memcmp(to, from, sizeof(*to)) == 0)
+            continue;
+        if (!to)
+            to = matrix_tile_alloc(&st->mat, tx, ty);
+        if (!to)
+            continue;
+        *to = *from;
+        state_touch_tile(st, tx, ty);
+    }
+}
+
+// A zeroed timeline becomes one frame on its first change.
+static void frames_begin(struct frames *fr)
+{
+    if (fr->count > 0)
+        return;
+    fr->count = 1;
+    fr->current = 0;
+    fr->list[0].duration = FRAME_DURATION;
+}
+
+static bool frames_store_current(struct state *st)
+{
+    struct frames *fr = &st->frames;
+    if (!frame_store(fr, &fr->list[fr->current], &st->mat, st->tile_revision, fr->stored_revision))
+        return false;
+    fr->stored_revision = st->revision;
+    return true;
+}
+
+// Loads the current frame after the timeline changed.
+static void frames_changed(struct state *st, bool load)
+{
+    struct frames *fr = &st->frames;
+    if (load)
+        frame_load(st, &fr->list[fr->current]);
+    state_touch(st);
+    if (load)
+        fr->stored_revision = st->revision;
+    fr->revision = st->revision;
+}
+
+static int clamp_duration(int duration)
+{
+    if (duration < FRAME_DURATION_MIN)
+        return FRAME_DURATION_MIN;
+    if (duration > FRAME_DURATION_MAX)
+        return FRAME_DURATION_MAX;
+    return duration;
+}
+
+void frames_free(struct frames *fr)
+{
+    for (int i = 0; i < fr->count; ++i)
+        release_tiles(fr, fr->list[i].tiles, fr->list[i].len);
+    free(fr->buckets);
+    memset(fr, 0, sizeof(*fr));
+}
+
+int frames_count(const struct frames *fr)
+{
+    return (fr->count > 0) ? fr->count : 1;
+}
+
+int frames_duration(const struct frames *fr, int i)
+{
+    return (fr->count > 0) ? fr->list[i].duration : FRAME_DURATION;
+}
+
+void frames_select(struct state *st, int i)
+{
+    struct frames *fr = &st->frames;
+    frames_begin(fr);
+    if (i < 0 || i >= fr->count || i == fr->current)
+        return;
+    if (!frames_store_current(st))
+        return;
+    fr->current = i;
+    frames_changed(st, true);
+}
+
+bool frames_insert(struct state *st, bool duplicate)
+{
+    struct frames *fr = &st->frames;
+    frames_begin(fr);
+    if (fr->count == FRAMES_MAX || !frames_store_current(st))
+        return false;
+
+    struct frame *cur = &fr->list[fr->current];
+    struct frame f = {NULL, 0, cur->duration};
+    if (duplicate && cur->len > 0)
+    {
+        f.tiles = malloc(cur->len * sizeof(*f.tiles));
+        if (!f.tiles)
+            return false;
+        memcpy(f.tiles, cur->tiles, cur->len * sizeof(*f.tiles));
+        f.len = cur->len;
+        for (int k = 0; k < f.len; ++k)
+            f.tiles[k].shared->refs += 1;
+    }
+
+    int at = fr->current + 1;
+    memmove(&fr->list[at + 1], &fr->list[at], (fr->count - at) * sizeof(fr->list[0]));
+    fr->list[at] = f;
+    fr->count += 1;
+    fr->current = at;
+    frames_changed(st, true);
+    return true;
+}
+
+void frames_delete(struct state *st)
+{
+    struct frames *fr = &st->frames;
+    frames_begin(fr);
+    if (fr->count <= 1)
+        return;
+
+    int gone = fr->current;
+    release_tiles(fr, fr->list[gone].tiles, fr->list[gone].len);
+    memmove(&fr->list[gone], &fr->list[gone + 1], (fr->count - gone - 1) * sizeof(fr->list[0]));
+    fr->count -= 1;
+    memset(&fr->list[fr->count], 0, sizeof(fr->list[0]));
+    fr->current = (gone < fr->count) ? gone : fr->count - 1;
+    frames_changed(st, true);
+}
+
+void frames_move(struct state *st, int delta)
+{
+    struct frames *fr = &st->frames;
+    frames_begin(fr);
+    int to = fr->current + delta;
+    to = (to < 0) ? 0 : (to >= fr->count) ? fr->count - 1 : to;
+    if (to == fr->current)
+        return;
+
+    struct frame f = fr->list[fr->current];
+    if (to < fr->current)
+        memmove(&fr->list[to + 1], &fr->list[to], (fr->current - to) * sizeof(f));
+    else
+        memmove(&fr->list[fr->current], &fr->list[fr->current + 1], (to - fr->current) * sizeof(f));
+    fr->list[to] = f;
+    fr->current = to;
+    frames_changed(st, false);
+}
+
+void frames_set_duration(struct state *st, int duration)
+{
+    struct frames *fr = &st->frames;
+    frames_begin(fr);
+    fr->list[fr->current].duration = clamp_duration(duration);
+    frames_changed(st, false);
+}
+
+void frames_read(const struct state *st, int i, struct matrix *out)
+{
+    const struct frames *fr = &st->frames;
+    if (fr->count == 0 || i == fr->current)
+    {
+        for (int ty = 0; ty < TILES_MAX; ++ty)
+        {
+            for (int tx = 0; tx < TILES_MAX; ++tx)
+                matrix_copy_tile(out, &st->mat, tx, ty);
+        }
+        return;
+    }
+
+    const struct frame *f = &fr->list[i];
+    int k = 0;
+    for (int index = 0; index < TILES_MAX * TILES_MAX; ++index)
+    {
+        int tx = index % TILES_MAX;
+        int ty = index / TILES_MAX;
+        struct tile *to = matrix_tile(out, tx, ty);
+        if (k < f->len && f->tiles[k].index == index)
+        {
+            if (!to)
+                to = matrix_tile_alloc(out, tx, ty);
+            if (to)
+                *to = f->tiles[k].shared->tile;
+            k += 1;
+        }
+        else if (to)
+            memset(to, 0, sizeof(*to));
+    }
+}
+
+bool frames_put(struct frames *fr, int i, const struct matrix *mat, int duration)
+{
+    frames_begin(fr);
+    if (i < 0 || i >= FRAMES_MAX)
+        return false;
+    while (fr->count <= i)
+    {
+        fr->list[fr->count].duration = FRAME_DURATION;
+        fr->count += 1;
+    }
+    fr->list[i].duration = clamp_duration(duration);
+    return frame_store(fr, &fr->list[i], mat, NULL, 0);
+}
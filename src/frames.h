@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "matrix.h"
+
+#define FRAMES_MAX 256
+#define FRAME_DURATION 100      // Milliseconds a new frame is shown
+#define FRAME_DURATION_MIN 10
+#define FRAME_DURATION_MAX 10000
+#define FRAMES_BUCKETS 4096     // Hash table size for shared tiles
+
+// A tile stored once for every frame, and every place in them, that has
+// the same cells.
+struct shared_tile
+{
+    struct tile tile;
+    unsigned int hash;
+    int refs;
+    struct shared_tile *next; // Next one in the same bucket
+};
+
+struct frame_tile
+{
+    int index; // ty * TILES_MAX + tx
+    struct shared_tile *shared;
+};
+
+// Non-empty tiles of a frame, sorted by index.
+struct frame
+{
+    struct frame_tile *tiles;
+    int len;
+    int duration; // Milliseconds
+};
+
+// Animation timeline. The frame being edited lives in the state matrix, so
+// painting, undo and rendering don't know about frames; the others are
+// kept as lists of shared tiles, interned by content hash, so a frame costs
+// only the tiles that differ from every other frame. A zeroed struct is a
+// single frame.
+struct frames
+{
+    struct frame list[FRAMES_MAX];
+    int count;
+    int current;
+    bool onion; // Show the neighbors of the current frame
+    // The entry of the current frame holds the tiles as of this revision,
+    // the ones changed since are interned when it is stored
+    unsigned int stored_revision;
+    // State revision of the last change to the timeline or to a frame other
+    // than the current one, for whoever shows or saves them
+    unsigned int revision;
+    struct shared_tile **buckets;
+    int shared; // Tiles in the table
+};
+
+struct state;
+
+void frames_free(struct frames *fr);
+int frames_count(const struct frames *fr);
+int frames_duration(const struct frames *fr, int i);
+
+// Makes frame i the one being edited.
+void frames_select(struct state *st, int i);
+// Adds a frame after the current one, blank or a copy of it, and selects it.
+bool frames_insert(struct state *st, bool duplicate);
+// Removes the current frame, unless it is the only one.
+void frames_delete(struct state *st);
+// Moves the current frame by delta places in the timeline.
+void frames_move(struct state *st, int delta);
+void frames_set_duration(struct state *st, int duration);
+
+// Cells of frame i, into out. Tiles out already has are reused.
+void frames_read(const struct state *st, int i, struct matrix *out);
+// Sets frame i, which isn't the current one, to the cells of mat. For
+// loading: frames up to i that were not set are blank.
+bool frames_put(struct frames *fr, int i, const struct matrix *mat, int duration);
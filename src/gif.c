@@ -0,0 +1,309 @@
+#include "gif.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernels.h"
+
+#define LZW_MIN_CODE_SIZE 4 // Bits per pixel, for 16 colors
+#define LZW_CLEAR (1 << LZW_MIN_CODE_SIZE)
+#define LZW_END (LZW_CLEAR + 1)
+#define LZW_CODES 4096
+#define BLOCK_MAX 255
+
+static unsigned char row_a[MAX_CANVAS_SIZE];
+static unsigned char row_b[MAX_CANVAS_SIZE];
+
+// Output that grows as it is written, failed once an allocation fails.
+struct output
+{
+    unsigned char *data;
+    size_t len, cap;
+    bool failed;
+};
+
+static void put_bytes(struct output *out, const void *bytes, size_t n)
+{
+    if (out->failed)
+        return;
+    if (out->len + n > out->cap)
+    {
+        size_t cap = out->cap ? out->cap : 4096;
+        while (cap < out->len + n)
+            cap *= 2;
+        unsigned char *data = realloc(out->data, cap);
+        if (!data)
+        {
+            out->failed = true;
+            return;
+        }
+        out->data = data;
+        out->cap = cap;
+    }
+    memcpy(&out->data[out->len], bytes, n);
+    out->len += n;
+}
+
+static void put_byte(struct output *out, unsigned int b)
+{
+    unsigned char byte = b;
+    put_bytes(out, &byte, 1);
+}
+
+static void put_u16(struct output *out, unsigned int v)
+{
+    unsigned char bytes[2] = {v & 0xFF, (v >> 8) & 0xFF};
+    put_bytes(out, bytes, 2);
+}
+
+// LZW compressor. The string table is a trie with a child per pixel value,
+// codes go out LSB first in data sub-blocks of up to BLOCK_MAX bytes.
+struct lzw
+{
+    unsigned short child[LZW_CODES][16]; // 0 for none, no string has that code
+    int prefix; // Code of the string matched so far, -1 before the first pixel
+    int next;   // Next free code
+    int code_size;
+    unsigned int bits;
+    int bit_count;
+    unsigned char block[BLOCK_MAX];
+    int block_len;
+    struct output *out;
+};
+
+static void lzw_flush_block(struct lzw *z)
+{
+    if (z->block_len == 0)
+        return;
+    put_byte(z->out, z->block_len);
+    put_bytes(z->out, z->block, z->block_len);
+    z->block_len = 0;
+}
+
+static void lzw_put_byte(struct lzw *z, unsigned int b)
+{
+    z->block[z->block_len++] = b;
+    if (z->block_len == BLOCK_MAX)
+        lzw_flush_block(z);
+}
+
+static void lzw_put(struct lzw *z, int code)
+{
+    z->bits |= code << z->bit_count;
+    z->bit_count += z->code_size;
+    while (z->bit_count >= 8)
+    {
+        lzw_put_byte(z, z->bits & 0xFF);
+        z->bits >>= 8;
+        z->bit_count -= 8;
+    }
+}
+
+static void lzw_reset(struct lzw *z)
+{
+    memset(z->child, 0, sizeof(z->child));
+    z->next = LZW_END + 1;
+    z->code_size = LZW_MIN_CODE_SIZE + 1;
+}
+
+static void lzw_begin(struct lzw *z, struct output *out)
+{
+    z->out = out;
+    z->prefix = -1;
+    z->bits = 0;
+    z->bit_count = 0;
+    z->block_len = 0;
+    put_byte(out, LZW_MIN_CODE_SIZE);
+    lzw_reset(z);
+    lzw_put(z, LZW_CLEAR);
+}
+
+static void lzw_pixel(struct lzw *z, int pixel)
+{
+    if (z->prefix < 0)
+    {
+        z->prefix = pixel;
+        return;
+    }
+    int code = z->child[z->prefix][pixel];
+    if (code)
+    {
+        z->prefix = code;
+        return;
+    }
+
+    lzw_put(z, z->prefix);
+    if (z->next < LZW_CODES)
+    {
+        // Codes get wider once the next one doesn't fit
+        if (z->next == (1 << z->code_size))
+            z->code_size += 1;
+        z->child[z->prefix][pixel] = z->next++;
+    }
+    else
+    {
+        lzw_put(z, LZW_CLEAR);
+        lzw_reset(z);
+    }
+    z->prefix = pixel;
+}
+
+static void lzw_end(struct lzw *z)
+{
+    if (z->prefix >= 0)
+        lzw_put(z, z->prefix);
+    // Decoders add a code for the last string too, and widen for it
+    if (z->next < LZW_CODES && z->next == (1 << z->code_size))
+        z->code_size += 1;
+    lzw_put(z, LZW_END);
+    if (z->bit_count > 0)
+        lzw_put_byte(z, z->bits & 0xFF);
+    lzw_flush_block(z);
+    put_byte(z->out, 0); // Block terminator
+}
+
+// Smallest rectangle [x0, x1) x [y0, y1) holding the cells where a and b
+// differ, false if there are none. Equal tiles are skipped whole.
+static bool changed_rect(const struct matrix *a, const struct matrix *b, int size,
+        int *x0, int *y0, int *x1, int *y1)
+{
+    static const struct tile empty;
+    int tiles = (size + TILE_SIZE - 1) / TILE_SIZE;
+    int tx0 = tiles, ty0 = tiles, tx1 = 0, ty1 = 0;
+    for (int ty = 0; ty < tiles; ++ty)
+    {
+        for (int tx = 0; tx < tiles; ++tx)
+        {
+            const struct tile *ta = matrix_tile(a, tx, ty);
+            const struct tile *tb = matrix_tile(b, tx, ty);
+            if (memcmp(ta ? ta : &empty, tb ? tb : &empty, sizeof(empty)) == 0)
+                continue;
+            tx0 = (tx < tx0) ? tx : tx0;
+            ty0 = (ty < ty0) ? ty : ty0;
+            tx1 = (tx + 1 > tx1) ? tx + 1 : tx1;
+            ty1 = (ty + 1 > ty1) ? ty + 1 : ty1;
+        }
+    }
+
+    int xs = tx0 * TILE_SIZE;
+    int n = ((tx1 * TILE_SIZE < size) ? tx1 * TILE_SIZE : size) - xs;
+    int ye = (ty1 * TILE_SIZE < size) ? ty1 * TILE_SIZE : size;
+    *x0 = *y0 = size;
+    *x1 = *y1 = 0;
+    for (int y = ty0 * TILE_SIZE; y < ye; ++y)
+    {
+        matrix_read_row(a, xs, y, n, row_a);
+        matrix_read_row(b, xs, y, n, row_b);
+        int first = kernel_mismatch(row_a, row_b, n, 0);
+        if (first == n)
+            continue;
+        int last = n - 1;
+        while (row_a[last] == row_b[last])
+            last -= 1;
+        *x0 = (xs + first < *x0) ? xs + first : *x0;
+        *x1 = (xs + last + 1 > *x1) ? xs + last + 1 : *x1;
+        *y0 = (y < *y0) ? y : *y0;
+        *y1 = y + 1;
+    }
+    return *x1 > *x0;
+}
+
+static void put_delay(struct output *out, size_t at, int ms)
+{
+    if (out->failed)
+        return;
+    int cs = (ms + 5) / 10;
+    out->data[at] = cs & 0xFF;
+    out->data[at + 1] = (cs >> 8) & 0xFF;
+}
+
+unsigned char *gif_encode(const struct state *st, const Color colors[16], int scale, int *len)
+{
+    int size = st->size;
+    if (size * scale > 0xFFFF)
+        return NULL;
+    struct lzw *z = malloc(sizeof(*z));
+    if (!z)
+        return NULL;
+
+    struct output out = {0};
+    put_bytes(&out, "GIF89a", 6);
+    put_u16(&out, size * scale);
+    put_u16(&out, size * scale);
+    put_byte(&out, 0xF3); // Global color table of 16 colors, 8 bits per channel
+    put_byte(&out, 0);    // Background color
+    put_byte(&out, 0);    // Square pixels
+    for (int c = 0; c < 16; ++c)
+    {
+        put_byte(&out, colors[c].r);
+        put_byte(&out, colors[c].g);
+        put_byte(&out, colors[c].b);
+    }
+    // Loop forever
+    put_bytes(&out, "\x21\xFF\x0BNETSCAPE2.0\x03\x01\x00\x00\x00", 19);
+
+    struct matrix prev = {0};
+    struct matrix cur = {0};
+    size_t delay_at = 0;
+    int delay = 0; // Milliseconds the last written frame is shown
+    int count = frames_count(&st->frames);
+    for (int i = 0; i < count; ++i)
+    {
+        frames_read(st, i, &cur);
+        int x0 = 0, y0 = 0, x1 = size, y1 = size;
+        if (i > 0 && !changed_rect(&prev, &cur, size, &x0, &y0, &x1, &y1))
+        {
+            delay += frames_duration(&st->frames, i);
+            put_delay(&out, delay_at, delay);
+            continue;
+        }
+
+        // Graphic control extension: leave the frame for the next one to
+        // draw over, no transparency
+        put_bytes(&out, "\x21\xF9\x04\x04", 4);
+        delay = frames_duration(&st->frames, i);
+        delay_at = out.len;
+        put_u16(&out, 0);
+        put_delay(&out, delay_at, delay);
+        put_byte(&out, 0);
+        put_byte(&out, 0);
+
+        put_byte(&out, 0x2C);
+        put_u16(&out, x0 * scale);
+        put_u16(&out, y0 * scale);
+        put_u16(&out, (x1 - x0) * scale);
+        put_u16(&out, (y1 - y0) * scale);
+        put_byte(&out, 0); // No local color table, not interlaced
+
+        lzw_begin(z, &out);
+        for (int y = y0; y < y1; ++y)
+        {
+            matrix_read_row(&cur, x0, y, x1 - x0, row_a);
+            for (int k = 0; k < scale; ++k)
+            {
+                for (int x = 0; x < x1 - x0; ++x)
+                {
+                    for (int s = 0; s < scale; ++s)
+                        lzw_pixel(z, row_a[x]);
+                }
+            }
+        }
+        lzw_end(z);
+
+        struct matrix swap = prev;
+        prev = cur;
+        cur = swap;
+    }
+    put_byte(&out, 0x3B); // Trailer
+
+    matrix_free(&prev);
+    matrix_free(&cur);
+    free(z);
+    if (out.failed)
+    {
+        free(out.data);
+        return NULL;
+    }
+    *len = out.len;
+    return out.data;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <raylib.h>
+
+#include "state.h"
+
+// Animated GIF export of every frame, looping forever, with the 16 palette
+// colors (alpha ignored) as the global color table. The first frame is
+// stored whole; each later one only as the smallest rectangle holding the
+// cells that differ from the previous frame, drawn over it. Frames equal
+// to the previous one just extend its delay.
+
+// Each cell becomes a scale x scale square. Returns a buffer to release
+// with free, NULL if out of memory.
+unsigned char *gif_encode(const struct state *st, const Color colors[16], int scale, int *len);
@@ -0,0 +1,201 @@
+#include "import.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernels.h"
+
+// OKLab goes to the kernels in fixed point, with 1 as OKLAB_ONE. Dithered
+// values are kept within OKLAB_LIMIT, far enough from the palette colors
+// for the kernels.
+#define OKLAB_ONE 1024
+#define OKLAB_LIMIT (4 * OKLAB_ONE)
+
+static const unsigned char BAYER[8][8] = {
+    { 0, 32,  8, 40,  2, 34, 10, 42},
+    {48, 16, 56, 24, 50, 18, 58, 26},
+    {12, 44,  4, 36, 14, 46,  6, 38},
+    {60, 28, 52, 20, 62, 30, 54, 22},
+    { 3, 35, 11, 43,  1, 33,  9, 41},
+    {51, 19, 59, 27, 49, 17, 57, 25},
+    {15, 47,  7, 39, 13, 45,  5, 37},
+    {63, 31, 55, 23, 61, 29, 53, 21},
+};
+
+static int points[3][MAX_CANVAS_SIZE]; // OKLab of a canvas row, one plane per component
+static unsigned char cells[MAX_CANVAS_SIZE];
+// Floyd-Steinberg error for this row and the next, 16 times the real one,
+// with a spare cell on each side
+static int errors[2][3][MAX_CANVAS_SIZE + 2];
+
+const char *dither_name(enum dither dither)
+{
+    switch (dither)
+    {
+    case DITHER_FLOYD_STEINBERG: return "Floyd-Steinberg";
+    case DITHER_BAYER: return "Bayer";
+    default: return "none";
+    }
+}
+
+static int fixed(float v)
+{
+    return v * OKLAB_ONE + ((v < 0) ? -0.5f : 0.5f);
+}
+
+static int clamp(int v, int lo, int hi)
+{
+    return (v < lo) ? lo : (v > hi) ? hi : v;
+}
+
+// Source pixels [start[i], start[i + 1]) make destination pixel i, at
+// least one each.
+static void spans(int src, int dst, int *start, int *end)
+{
+    for (int i = 0; i < dst; ++i)
+    {
+        start[i] = (long long)i * src / dst;
+        end[i] = (long long)(i + 1) * src / dst;
+        if (end[i] == start[i])
+            end[i] = start[i] + 1;
+    }
+}
+
+// Typical distance from a palette color to the closest other one, how far
+// ordered dithering has to push colors to mix them.
+static int palette_spacing(const int palette[3][16])
+{
+    float total = 0;
+    int counted = 0;
+    for (int c = 0; c < 16; ++c)
+    {
+        float closest = INFINITY;
+        for (int o = 0; o < 16; ++o)
+        {
+            float d = 0;
+            for (int k = 0; k < 3; ++k)
+                d += (float)(palette[k][c] - palette[k][o]) * (palette[k][c] - palette[k][o]);
+            if (d > 0 && d < closest)
+                closest = d;
+        }
+        if (closest < INFINITY)
+        {
+            total += sqrtf(closest);
+            counted += 1;
+        }
+    }
+    return counted ? total / counted : 0;
+}
+
+static void dither_floyd_steinberg(int y, int size, const int palette[3][16])
+{
+    int (*cur)[MAX_CANVAS_SIZE + 2] = errors[y & 1];
+    int (*next)[MAX_CANVAS_SIZE + 2] = errors[(y + 1) & 1];
+    memset(next, 0, sizeof(errors[0]));
+
+    int dir = (y & 1) ? -1 : 1;
+    for (int i = 0, x = (dir > 0) ? 0 : size - 1; i < size; ++i, x += dir)
+    {
+        int v[3];
+        for (int k = 0; k < 3; ++k)
+            v[k] = clamp(points[k][x] + cur[k][x + 1] / 16, -OKLAB_LIMIT, OKLAB_LIMIT);
+        const int *const point[3] = {&v[0], &v[1], &v[2]};
+        kernel_nearest_scalar(point, 1, palette, &cells[x]);
+        for (int k = 0; k < 3; ++k)
+        {
+            int e = v[k] - palette[k][cells[x]];
+            cur[k][x + 1 + dir] += 7 * e;
+            next[k][x + 1 - dir] += 3 * e;
+            next[k][x + 1] += 5 * e;
+            next[k][x + 1 + dir] += e;
+        }
+    }
+}
+
+bool import_image(struct state *st, const unsigned char *rgba, int width, int height,
+        const struct palette *pal, enum dither dither)
+{
+    int size = st->size;
+    float *sums = malloc(3 * sizeof(float) * width);
+    int *bounds = malloc(4 * sizeof(int) * size);
+    if (!sums || !bounds)
+    {
+        free(sums);
+        free(bounds);
+        return false;
+    }
+    int *col_start = bounds, *col_end = bounds + size;
+    int *row_start = bounds + 2 * size, *row_end = bounds + 3 * size;
+    spans(width, size, col_start, col_end);
+    spans(height, size, row_start, row_end);
+
+    float linear[256];
+    for (int v = 0; v < 256; ++v)
+        linear[v] = palette_srgb_to_linear(v);
+    int palette[3][16];
+    for (int c = 0; c < 16; ++c)
+    {
+        palette[0][c] = fixed(pal->oklab[c].x);
+        palette[1][c] = fixed(pal->oklab[c].y);
+        palette[2][c] = fixed(pal->oklab[c].z);
+    }
+    int spacing = palette_spacing(palette);
+    memset(errors, 0, sizeof(errors));
+
+    for (int y = 0; y < size; ++y)
+    {
+        // Sum the source rows of this one by columns, then the columns of
+        // each cell
+        memset(sums, 0, 3 * sizeof(float) * width);
+        for (int sy = row_start[y]; sy < row_end[y]; ++sy)
+        {
+            const unsigned char *px = &rgba[(size_t)sy * width * 4];
+            for (int sx = 0; sx < width; ++sx)
+            {
+                sums[3 * sx] += linear[px[4 * sx]];
+                sums[3 * sx + 1] += linear[px[4 * sx + 1]];
+                sums[3 * sx + 2] += linear[px[4 * sx + 2]];
+            }
+        }
+        int rows = row_end[y] - row_start[y];
+        for (int x = 0; x < size; ++x)
+        {
+            Vector3 sum = {0};
+            for (int sx = col_start[x]; sx < col_end[x]; ++sx)
+            {
+                sum.x += sums[3 * sx];
+                sum.y += sums[3 * sx + 1];
+                sum.z += sums[3 * sx + 2];
+            }
+            float n = rows * (col_end[x] - col_start[x]);
+            Vector3 lab = palette_linear_to_oklab((Vector3){sum.x / n, sum.y / n, sum.z / n});
+            points[0][x] = fixed(lab.x);
+            points[1][x] = fixed(lab.y);
+            points[2][x] = fixed(lab.z);
+        }
+
+        if (dither == DITHER_FLOYD_STEINBERG)
+        {
+            dither_floyd_steinberg(y, size, palette);
+        }
+        else
+        {
+            // Ordered dithering moves the lightness by up to half the
+            // palette spacing either way
+            if (dither == DITHER_BAYER)
+            {
+                for (int x = 0; x < size; ++x)
+                    points[0][x] += (2 * BAYER[y % 8][x % 8] - 63) * spacing / 128;
+            }
+            const int *const planes[3] = {points[0], points[1], points[2]};
+            kernel_nearest(planes, size, palette, cells);
+        }
+        matrix_write_row(&st->mat, 0, y, size, cells);
+    }
+    state_touch_rect(st, 0, 0, size, size);
+
+    free(sums);
+    free(bounds);
+    return true;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "palette.h"
+#include "state.h"
+
+// Image import: the image is resampled to the canvas and each pixel takes
+// the nearest palette color in OKLab, optionally dithered.
+
+enum dither
+{
+    DITHER_NONE,
+    DITHER_FLOYD_STEINBERG, // Error diffusion, rows in alternating directions
+    DITHER_BAYER,           // Ordered, with an 8x8 threshold matrix
+    DITHER_COUNT,
+};
+
+const char *dither_name(enum dither dither);
+
+// Replaces the cells of the canvas with the width x height RGBA pixels
+// stretched over it: averaged in linear light where it shrinks, repeated
+// where it grows. Alpha is ignored. False if out of memory, the cells are
+// left untouched then.
+bool import_image(struct state *st, const unsigned char *rgba, int width, int height,
+        const struct palette *pal, enum dither dither);
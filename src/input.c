@@ -0,0 +1,486 @@
+#include "input.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "document.h"
+#include "platform.h"
+
+#define DROPS_MAX 64 // Files per frame, more in one drop are ignored
+#define BUTTONS 3    // Left, right and middle
+
+// Keys the editor has shortcuts on, at most 64.
+static const int TRACKED_KEYS[] = {
+    KEY_LEFT_SHIFT, KEY_RIGHT_SHIFT, KEY_LEFT_CONTROL, KEY_RIGHT_CONTROL,
+    KEY_LEFT, KEY_RIGHT, KEY_UP, KEY_DOWN,
+    KEY_A, KEY_D, KEY_G, KEY_H, KEY_I, KEY_K, KEY_N, KEY_O, KEY_P, KEY_R,
+    KEY_S, KEY_T, KEY_V, KEY_W, KEY_X, KEY_Y, KEY_Z,
+    KEY_ZERO, KEY_EIGHT, KEY_EQUAL, KEY_MINUS, KEY_KP_ADD, KEY_KP_SUBTRACT,
+    KEY_COMMA, KEY_PERIOD, KEY_LEFT_BRACKET, KEY_RIGHT_BRACKET, KEY_DELETE,
+    KEY_F3, KEY_F4, KEY_B, KEY_C, KEY_M, KEY_ENTER,
+};
+
+_Static_assert(sizeof(TRACKED_KEYS)/sizeof(TRACKED_KEYS[0]) <= 64, "Key masks are 64 bits");
+
+struct input_frame
+{
+    Vector2 mouse, delta;
+    float wheel;
+    unsigned int buttons;
+    unsigned long long keys_down, keys_pressed;
+    int width, height;
+};
+
+static struct
+{
+    struct input_frame frame, last; // Polled, and the one before in the log
+    int drop_count;
+    char *drops[DROPS_MAX];
+
+    FILE *record;
+    const unsigned char *replay; // Mapped log
+    int replay_len, replay_pos;
+    bool ended;
+
+    int frames;
+    double polled; // When the last frame was polled
+    float *times;  // Seconds each replayed frame took
+    int time_count, time_cap;
+} input;
+
+static void drops_clear(void)
+{
+    for (int i = 0; i < input.drop_count; ++i)
+        free(input.drops[i]);
+    input.drop_count = 0;
+}
+
+static void drops_add(const char *path)
+{
+    if (input.drop_count == DROPS_MAX)
+        return;
+    char *copy = malloc(strlen(path) + 1);
+    if (!copy)
+        return;
+    strcpy(copy, path);
+    input.drops[input.drop_count++] = copy;
+}
+
+static int key_index(int key)
+{
+    for (int i = 0; i < (int)(sizeof(TRACKED_KEYS)/sizeof(TRACKED_KEYS[0])); ++i)
+    {
+        if (TRACKED_KEYS[i] == key)
+            return i;
+    }
+    return -1;
+}
+
+static void read_raylib(struct input_frame *f)
+{
+    f->mouse = GetMousePosition();
+    f->delta = GetMouseDelta();
+    f->wheel = GetMouseWheelMove();
+    f->buttons = 0;
+    for (int b = 0; b < BUTTONS; ++b)
+    {
+        f->buttons |= IsMouseButtonDown(b) << b;
+        f->buttons |= IsMouseButtonPressed(b) << (BUTTONS + b);
+        f->buttons |= IsMouseButtonReleased(b) << (2*BUTTONS + b);
+    }
+    f->keys_down = 0;
+    f->keys_pressed = 0;
+    for (int i = 0; i < (int)(sizeof(TRACKED_KEYS)/sizeof(TRACKED_KEYS[0])); ++i)
+    {
+        f->keys_down |= (unsigned long long)IsKeyDown(TRACKED_KEYS[i]) << i;
+        f->keys_pressed |= (unsigned long long)IsKeyPressed(TRACKED_KEYS[i]) << i;
+    }
+    f->width = platform_screen_width();
+    f->height = platform_screen_height();
+
+    if (IsFileDropped())
+    {
+        FilePathList files = LoadDroppedFiles();
+        for (unsigned int i = 0; i < files.count; ++i)
+            drops_add(files.paths[i]);
+        UnloadDroppedFiles(files);
+    }
+}
+
+// Log writing, numbers little endian.
+
+static void put_bytes(const void *bytes, size_t n)
+{
+    fwrite(bytes, 1, n, input.record);
+}
+
+static void put_u16(unsigned int v)
+{
+    unsigned char bytes[2] = {v & 0xFF, (v >> 8) & 0xFF};
+    put_bytes(bytes, 2);
+}
+
+static void put_u32(unsigned int v)
+{
+    put_u16(v & 0xFFFF);
+    put_u16(v >> 16);
+}
+
+static void put_u64(unsigned long long v)
+{
+    put_u32(v & 0xFFFFFFFF);
+    put_u32(v >> 32);
+}
+
+static void put_f32(float v)
+{
+    unsigned int bits;
+    memcpy(&bits, &v, sizeof(bits));
+    put_u32(bits);
+}
+
+static void write_frame(const struct input_frame *f, const struct input_frame *last)
+{
+    unsigned int mask = 0;
+    if (f->mouse.x != last->mouse.x || f->mouse.y != last->mouse.y)
+        mask |= INPUT_MOUSE;
+    if (f->delta.x != last->delta.x || f->delta.y != last->delta.y)
+        mask |= INPUT_DELTA;
+    if (f->wheel != last->wheel)
+        mask |= INPUT_WHEEL;
+    if (f->buttons != last->buttons)
+        mask |= INPUT_BUTTONS;
+    if (f->keys_down != last->keys_down || f->keys_pressed != last->keys_pressed)
+        mask |= INPUT_KEYS;
+    if (f->width != last->width || f->height != last->height)
+        mask |= INPUT_SCREEN;
+    if (input.drop_count > 0)
+        mask |= INPUT_DROPS;
+
+    unsigned char byte = mask;
+    put_bytes(&byte, 1);
+    if (mask & INPUT_MOUSE)
+    {
+        put_f32(f->mouse.x);
+        put_f32(f->mouse.y);
+    }
+    if (mask & INPUT_DELTA)
+    {
+        put_f32(f->delta.x);
+        put_f32(f->delta.y);
+    }
+    if (mask & INPUT_WHEEL)
+        put_f32(f->wheel);
+    if (mask & INPUT_BUTTONS)
+        put_u16(f->buttons);
+    if (mask & INPUT_KEYS)
+    {
+        put_u64(f->keys_down);
+        put_u64(f->keys_pressed);
+    }
+    if (mask & INPUT_SCREEN)
+    {
+        put_u16(f->width);
+        put_u16(f->height);
+    }
+    if (mask & INPUT_DROPS)
+    {
+        byte = input.drop_count;
+        put_bytes(&byte, 1);
+        for (int i = 0; i < input.drop_count; ++i)
+            put_bytes(input.drops[i], strlen(input.drops[i]) + 1);
+    }
+}
+
+// Log reading, false past the end of the log.
+
+static bool get_bytes(void *bytes, int n)
+{
+    if (input.replay_len - input.replay_pos < n)
+        return false;
+    memcpy(bytes, &input.replay[input.replay_pos], n);
+    input.replay_pos += n;
+    return true;
+}
+
+static bool get_u16(unsigned int *v)
+{
+    unsigned char b[2];
+    if (!get_bytes(b, 2))
+        return false;
+    *v = b[0] | (b[1] << 8);
+    return true;
+}
+
+static bool get_u32(unsigned int *v)
+{
+    unsigned int lo, hi;
+    if (!get_u16(&lo) || !get_u16(&hi))
+        return false;
+    *v = lo | (hi << 16);
+    return true;
+}
+
+static bool get_u64(unsigned long long *v)
+{
+    unsigned int lo, hi;
+    if (!get_u32(&lo) || !get_u32(&hi))
+        return false;
+    *v = lo | ((unsigned long long)hi << 32);
+    return true;
+}
+
+static bool get_f32(float *v)
+{
+    unsigned int bits;
+    if (!get_u32(&bits))
+        return false;
+    memcpy(v, &bits, sizeof(bits));
+    return true;
+}
+
+static bool read_frame(struct input_frame *f)
+{
+    unsigned char mask;
+    if (!get_bytes(&mask, 1))
+        return false;
+    bool ok = true;
+    if (mask & INPUT_MOUSE)
+        ok = ok && get_f32(&f->mouse.x) && get_f32(&f->mouse.y);
+    if (mask & INPUT_DELTA)
+        ok = ok && get_f32(&f->delta.x) && get_f32(&f->delta.y);
+    if (mask & INPUT_WHEEL)
+        ok = ok && get_f32(&f->wheel);
+    if (mask & INPUT_BUTTONS)
+        ok = ok && get_u16(&f->buttons);
+    if (mask & INPUT_KEYS)
+        ok = ok && get_u64(&f->keys_down) && get_u64(&f->keys_pressed);
+    if (mask & INPUT_SCREEN)
+    {
+        unsigned int w = 0, h = 0;
+        ok = ok && get_u16(&w) && get_u16(&h);
+        f->width = w;
+        f->height = h;
+    }
+    if (ok && (mask & INPUT_DROPS))
+    {
+        unsigned char count;
+        ok = get_bytes(&count, 1);
+        for (int i = 0; ok && i < count; ++i)
+        {
+            const char *path = (const char *)&input.replay[input.replay_pos];
+            const char *end = memchr(path, 0, input.replay_len - input.replay_pos);
+            ok = end != NULL;
+            if (ok)
+            {
+                drops_add(path);
+                input.replay_pos += end - path + 1;
+            }
+        }
+    }
+    if (!ok)
+        TraceLog(LOG_WARNING, "Input log ends in the middle of a frame");
+    return ok;
+}
+
+bool input_record(const char *path, const struct state *st, unsigned int flags)
+{
+    int len;
+    unsigned char *document = document_encode(st, &len);
+    if (!document)
+        return false;
+    input.record = fopen(path, "wb");
+    if (!input.record)
+    {
+        free(document);
+        return false;
+    }
+    put_bytes("JREC", 4);
+    put_u16(INPUT_VERSION);
+    unsigned char byte = flags;
+    put_bytes(&byte, 1);
+    put_u32(len);
+    put_bytes(document, len);
+    free(document);
+    return true;
+}
+
+bool input_replay(const char *path, struct state *st, unsigned int *flags)
+{
+    input.replay = platform_map_file(path, &input.replay_len);
+    if (!input.replay)
+        return false;
+    input.replay_pos = 0;
+
+    char magic[4];
+    unsigned int version, len;
+    unsigned char byte;
+    if (!get_bytes(magic, 4) || memcmp(magic, "JREC", 4) != 0 ||
+            !get_u16(&version) || version != INPUT_VERSION ||
+            !get_bytes(&byte, 1) || !get_u32(&len) ||
+            len > (unsigned int)(input.replay_len - input.replay_pos) ||
+            !document_decode(&input.replay[input.replay_pos], len, st))
+    {
+        platform_unmap_file(input.replay, input.replay_len);
+        input.replay = NULL;
+        return false;
+    }
+    input.replay_pos += len;
+    *flags = byte;
+    return true;
+}
+
+bool input_replaying(void)
+{
+    return input.replay != NULL;
+}
+
+static void time_add(float seconds)
+{
+    if (input.time_count == input.time_cap)
+    {
+        int cap = input.time_cap ? 2*input.time_cap : 4096;
+        float *times = realloc(input.times, cap * sizeof(*times));
+        if (!times)
+            return;
+        input.times = times;
+        input.time_cap = cap;
+    }
+    input.times[input.time_count++] = seconds;
+}
+
+bool input_poll(void)
+{
+    drops_clear();
+    if (!input.replay)
+    {
+        read_raylib(&input.frame);
+        if (input.record)
+            write_frame(&input.frame, &input.last);
+        input.last = input.frame;
+        input.frames += 1;
+        return true;
+    }
+
+    // Each frame's time runs until the next one is polled
+    double now = platform_time();
+    if (input.frames > 0)
+        time_add(now - input.polled);
+    input.polled = now;
+    if (input.ended || !read_frame(&input.frame))
+    {
+        input.ended = true;
+        return false;
+    }
+    input.frames += 1;
+    return true;
+}
+
+static int compare_floats(const void *a, const void *b)
+{
+    float fa = *(const float *)a, fb = *(const float *)b;
+    return (fa > fb) - (fa < fb);
+}
+
+void input_close(unsigned long long hash)
+{
+    drops_clear();
+    if (input.record)
+    {
+        if (fclose(input.record) != 0)
+            TraceLog(LOG_WARNING, "Could not write the input log");
+        input.record = NULL;
+        printf("record: %d frames, state hash %016llx\n", input.frames, hash);
+    }
+    if (input.replay)
+    {
+        platform_unmap_file(input.replay, input.replay_len);
+        input.replay = NULL;
+
+        int n = input.time_count;
+        double total = 0;
+        for (int i = 0; i < n; ++i)
+            total += input.times[i];
+        if (n > 0)
+            qsort(input.times, n, sizeof(input.times[0]), compare_floats);
+        printf("replay: %d frames in %.3f s, ms/frame mean %.3f p50 %.3f p95 %.3f p99 %.3f max %.3f\n",
+                input.frames, total, n ? 1000*total/n : 0.0,
+                n ? 1000*input.times[n*50/100] : 0.0, n ? 1000*input.times[n*95/100] : 0.0,
+                n ? 1000*input.times[n*99/100] : 0.0, n ? 1000*input.times[n - 1] : 0.0);
+        printf("replay: state hash %016llx\n", hash);
+        free(input.times);
+        input.times = NULL;
+        input.time_count = 0;
+        input.time_cap = 0;
+    }
+}
+
+Vector2 input_mouse_position(void)
+{
+    return input.frame.mouse;
+}
+
+Vector2 input_mouse_delta(void)
+{
+    return input.frame.delta;
+}
+
+float input_mouse_wheel(void)
+{
+    return input.frame.wheel;
+}
+
+bool input_button_down(int button)
+{
+    return button >= 0 && button < BUTTONS && (input.frame.buttons >> button & 1);
+}
+
+bool input_button_pressed(int button)
+{
+    return button >= 0 && button < BUTTONS && (input.frame.buttons >> (BUTTONS + button) & 1);
+}
+
+bool input_button_released(int button)
+{
+    return button >= 0 && button < BUTTONS && (input.frame.buttons >> (2*BUTTONS + button) & 1);
+}
+
+bool input_key_down(int key)
+{
+    int i = key_index(key);
+    return i >= 0 && (input.frame.keys_down >> i & 1);
+}
+
+bool input_key_pressed(int key)
+{
+    int i = key_index(key);
+    return i >= 0 && (input.frame.keys_pressed >> i & 1);
+}
+
+int input_screen_width(void)
+{
+    return input.frame.width;
+}
+
+int input_screen_height(void)
+{
+    return input.frame.height;
+}
+
+int input_dropped_count(void)
+{
+    return input.drop_count;
+}
+
+const char *input_dropped_path(int i)
+{
+    return input.drops[i];
+}
+
+bool input_active(void)
+{
+    const struct input_frame *f = &input.frame;
+    return f->delta.x != 0 || f->delta.y != 0 || f->wheel != 0 || f->buttons != 0 ||
+        f->keys_pressed != 0 || input.drop_count > 0;
+}
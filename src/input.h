@@ -0,0 +1,77 @@
+#pragma once
+
+#include <raylib.h>
+#include <stdbool.h>
+
+#include "state.h"
+
+// Input of the editor, read once at the start of each frame: from raylib,
+// or from a log when replaying. While recording, every frame read goes to
+// the log too, so a session can be replayed later, headless as fast as it
+// runs, and ends in the same state.
+//
+// Logs, numbers little endian:
+//
+//   header  "JREC", u16 version, u8 flags, u32 document length, document
+//   frames  u8 field mask, then the fields in it, by increasing bit
+//
+// INPUT_MOUSE     f32 x, f32 y
+// INPUT_DELTA     f32 x, f32 y
+// INPUT_WHEEL     f32
+// INPUT_BUTTONS   u16, bits 0-2 down, 3-5 pressed, 6-8 released, in the
+//                 order left, right, middle
+// INPUT_KEYS      u64 keys down, u64 keys pressed, bits in TRACKED_KEYS
+//                 order (input.c)
+// INPUT_SCREEN    u16 width, u16 height
+// INPUT_DROPS     u8 count, NUL terminated paths
+//
+// Fields missing from a frame are the same as in the previous one, but for
+// dropped files, so frames without input take one byte. The document is
+// what the session started from, as saved by document_encode.
+#define INPUT_VERSION 1
+
+#define INPUT_MOUSE   1
+#define INPUT_DELTA   2
+#define INPUT_WHEEL   4
+#define INPUT_BUTTONS 8
+#define INPUT_KEYS    16
+#define INPUT_SCREEN  32
+#define INPUT_DROPS   64
+
+// Header flags, editor state that is not in the document.
+#define INPUT_FLAG_OPTIONS 1 // Options screen shown
+
+// Starts writing the frames to a log at path, after st and flags.
+bool input_record(const char *path, const struct state *st, unsigned int flags);
+// Reads the frames from a log instead, loading the state and flags it
+// starts from.
+bool input_replay(const char *path, struct state *st, unsigned int *flags);
+bool input_replaying(void);
+
+// Reads the input of a new frame, false once a replay is over.
+bool input_poll(void);
+// Ends a recording or replay, printing its frame count, frame times when
+// replaying and hash, the final state's.
+void input_close(unsigned long long hash);
+
+// Same as their raylib counterparts for the frame polled. Only the keys
+// in TRACKED_KEYS (input.c) are seen, shortcuts need their key listed there.
+Vector2 input_mouse_position(void);
+Vector2 input_mouse_delta(void);
+float input_mouse_wheel(void);
+bool input_button_down(int button);
+bool input_button_pressed(int button);
+bool input_button_released(int button);
+bool input_key_down(int key);
+bool input_key_pressed(int key);
+
+// Screen size the frame was laid out for.
+int input_screen_width(void);
+int input_screen_height(void);
+
+// Files dropped on the window during the frame.
+int input_dropped_count(void);
+const char *input_dropped_path(int i);
+
+// Whether the user did anything that could change what is on screen.
+bool input_active(void);
@@ -0,0 +1,578 @@
+#include "journal.h"
+
+#include <raylib.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "document.h"
+#include "platform.h"
+#include "transform.h"
+
+#if !defined(PLATFORM_WEB)
+#include <pthread.h>
+#endif
+
+#define HEADER_SIZE 16
+#define BATCH_HEADER_SIZE 8
+#define META_SIZE 7
+#define TILE_OP_SIZE (3 + (int)sizeof(struct tile))
+
+// Tiles changed outside of operations that go in the journal one by one,
+// past that a snapshot is cheaper.
+#define JOURNAL_TILES 64
+
+static void put_u16(unsigned char *p, unsigned int v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+}
+
+static void put_u32(unsigned char *p, unsigned int v)
+{
+    put_u16(p, v & 0xFFFF);
+    put_u16(p + 2, v >> 16);
+}
+
+static unsigned int get_u16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static unsigned int get_u32(const unsigned char *p)
+{
+    return get_u16(p) | (get_u16(p + 2) << 16);
+}
+
+static unsigned int hash(const unsigned char *data, int len)
+{
+    unsigned int h = 2166136261u;
+    for (int i = 0; i < len; ++i)
+        h = (h ^ data[i]) * 16777619u;
+    return h;
+}
+
+static void meta_get(const struct state *st, unsigned char meta[META_SIZE])
+{
+    put_u16(&meta[0], st->size);
+    meta[2] = st->pal;
+    meta[3] = st->col1;
+    meta[4] = st->col2;
+    meta[5] = (st->grid ? 1 : 0) | (st->frames.onion ? 2 : 0);
+    meta[6] = 0;
+}
+
+// Room for an operation of len bytes after its code, NULL when it needn't
+// be recorded because a snapshot is due anyway.
+static unsigned char *op_add(struct journal *j, int code, int len)
+{
+    if (j->snapshot)
+        return NULL;
+    if (j->len + 1 + len > JOURNAL_MAX)
+    {
+        // More than a journal holds, drop the batch for a snapshot
+        j->snapshot = true;
+        j->len = 0;
+        return NULL;
+    }
+    if (j->len + 1 + len > j->cap)
+    {
+        int cap = j->cap ? j->cap : 4096;
+        while (cap < j->len + 1 + len)
+            cap *= 2;
+        unsigned char *ops = realloc(j->ops, cap);
+        if (!ops)
+        {
+            j->snapshot = true;
+            j->len = 0;
+            return NULL;
+        }
+        j->ops = ops;
+        j->cap = cap;
+    }
+    unsigned char *p = &j->ops[j->len];
+    p[0] = code;
+    j->len += 1 + len;
+    return p + 1;
+}
+
+// Records what changed since the last operation: the canvas settings, and
+// the tiles changed by undo, imports and the like.
+static void journal_sync(struct journal *j, const struct state *st)
+{
+    if (st->frames.revision != j->frames_revision)
+    {
+        j->frames_revision = st->frames.revision;
+        j->snapshot = true;
+    }
+
+    unsigned char meta[META_SIZE];
+    meta_get(st, meta);
+    if (memcmp(meta, j->meta, META_SIZE) != 0)
+    {
+        // Cells left past a smaller size show again, the snapshot has none
+        if (get_u16(meta) > get_u16(j->meta))
+            j->snapshot = true;
+        unsigned char *p = op_add(j, JOURNAL_META, META_SIZE);
+        if (p)
+            memcpy(p, meta, META_SIZE);
+        memcpy(j->meta, meta, META_SIZE);
+    }
+
+    if (st->revision == j->revision)
+        return;
+    int tiles = (st->size + TILE_SIZE - 1) / TILE_SIZE;
+    int changed = 0;
+    for (int ty = 0; ty < tiles && !j->snapshot; ++ty)
+    {
+        for (int tx = 0; tx < tiles; ++tx)
+            changed += st->tile_revision[ty][tx] > j->revision;
+    }
+    if (changed > JOURNAL_TILES)
+        j->snapshot = true;
+    for (int ty = 0; ty < tiles && !j->snapshot; ++ty)
+    {
+        for (int tx = 0; tx < tiles; ++tx)
+        {
+            if (st->tile_revision[ty][tx] <= j->revision)
+                continue;
+            const struct tile *tile = matrix_tile(&st->mat, tx, ty);
+            unsigned char *p = op_add(j, JOURNAL_TILE, tile ? TILE_OP_SIZE : 3);
+            if (!p)
+                break;
+            p[0] = tx;
+            p[1] = ty;
+            p[2] = !tile;
+            if (tile)
+                memcpy(&p[3], tile, sizeof(*tile));
+        }
+    }
+    j->revision = st->revision;
+}
+
+void journal_paint(struct journal *j, struct state *st, const struct point *cells, int len, int color)
+{
+    journal_sync(j, st);
+    unsigned int revision = st->revision;
+    for (int i = 0; i < len; ++i)
+        state_set(st, cells[i].x, cells[i].y, color);
+    if (st->revision != revision)
+    {
+        unsigned char *p = op_add(j, JOURNAL_CELLS, 3 + 4*len);
+        if (p)
+        {
+            p[0] = color;
+            put_u16(&p[1], len);
+            for (int i = 0; i < len; ++i)
+            {
+                put_u16(&p[3 + 4*i], cells[i].x);
+                put_u16(&p[5 + 4*i], cells[i].y);
+            }
+        }
+    }
+    j->revision = st->revision;
+}
+
+int journal_fill(struct journal *j, struct state *st, int x, int y, int color, bool diagonal)
+{
+    journal_sync(j, st);
+    unsigned int revision = st->revision;
+    int filled = flood_fill(st, x, y, color, diagonal);
+    if (st->revision != revision)
+    {
+        unsigned char *p = op_add(j, JOURNAL_FILL, 6);
+        if (p)
+        {
+            put_u16(&p[0], x);
+            put_u16(&p[2], y);
+            p[4] = color;
+            p[5] = diagonal;
+        }
+    }
+    j->revision = st->revision;
+    return filled;
+}
+
+void journal_shift(struct journal *j, struct state *st, int dx, int dy)
+{
+    journal_sync(j, st);
+    transform_shift(st, dx, dy);
+    unsigned char *p = op_add(j, JOURNAL_SHIFT, 4);
+    if (p)
+    {
+        put_u16(&p[0], (unsigned int)dx);
+        put_u16(&p[2], (unsigned int)dy);
+    }
+    j->revision = st->revision;
+}
+
+void journal_flip(struct journal *j, struct state *st, bool vertical)
+{
+    journal_sync(j, st);
+    transform_flip(st, vertical);
+    unsigned char *p = op_add(j, JOURNAL_FLIP, 1);
+    if (p)
+        p[0] = vertical;
+    j->revision = st->revision;
+}
+
+void journal_rotate(struct journal *j, struct state *st, bool clockwise)
+{
+    journal_sync(j, st);
+    transform_rotate(st, clockwise);
+    unsigned char *p = op_add(j, JOURNAL_ROTATE, 1);
+    if (p)
+        p[0] = clockwise;
+    j->revision = st->revision;
+}
+
+void journal_transpose(struct journal *j, struct state *st)
+{
+    journal_sync(j, st);
+    transform_transpose(st);
+    op_add(j, JOURNAL_TRANSPOSE, 0);
+    j->revision = st->revision;
+}
+
+static void tile_put(struct state *st, int tx, int ty, const unsigned char *packed)
+{
+    struct tile *tile = packed ? matrix_tile_alloc(&st->mat, tx, ty) : matrix_tile(&st->mat, tx, ty);
+    if (tile && packed)
+        memcpy(tile, packed, sizeof(*tile));
+    else if (tile)
+        memset(tile, 0, sizeof(*tile));
+    state_touch_tile(st, tx, ty);
+}
+
+// Applies the operations of a batch, false if one is malformed.
+static bool replay(struct state *st, const unsigned char *p, int len)
+{
+    const unsigned char *end = p + len;
+    while (p < end)
+    {
+        int code = *p++;
+        int left = end - p;
+        if (code == JOURNAL_META && left >= META_SIZE)
+        {
+            int size = get_u16(&p[0]);
+            if (size < 1 || size > MAX_CANVAS_SIZE)
+                return false;
+            st->size = size;
+            st->pal = p[2];
+            st->col1 = p[3] & 0xF;
+            st->col2 = p[4] & 0xF;
+            st->grid = p[5] & 1;
+            st->frames.onion = p[5] & 2;
+            state_touch(st);
+            p += META_SIZE;
+        }
+        else if (code == JOURNAL_CELLS && left >= 3 && left >= 3 + 4*(int)get_u16(&p[1]))
+        {
+            int count = get_u16(&p[1]);
+            for (int i = 0; i < count; ++i)
+            {
+                int x = get_u16(&p[3 + 4*i]);
+                int y = get_u16(&p[5 + 4*i]);
+                if (x < MAX_CANVAS_SIZE && y < MAX_CANVAS_SIZE)
+                    state_set(st, x, y, p[0] & 0xF);
+            }
+            p += 3 + 4*count;
+        }
+        else if (code == JOURNAL_FILL && left >= 6)
+        {
+            flood_fill(st, get_u16(&p[0]), get_u16(&p[2]), p[4] & 0xF, p[5]);
+            p += 6;
+        }
+        else if (code == JOURNAL_SHIFT && left >= 4)
+        {
+            transform_shift(st, (short)get_u16(&p[0]), (short)get_u16(&p[2]));
+            p += 4;
+        }
+        else if (code == JOURNAL_FLIP && left >= 1)
+        {
+            transform_flip(st, p[0]);
+            p += 1;
+        }
+        else if (code == JOURNAL_ROTATE && left >= 1)
+        {
+            transform_rotate(st, p[0]);
+            p += 1;
+        }
+        else if (code == JOURNAL_TRANSPOSE)
+        {
+            transform_transpose(st);
+        }
+        else if (code == JOURNAL_TILE && left >= 3 && (p[2] || left >= TILE_OP_SIZE))
+        {
+            if (p[0] >= TILES_MAX || p[1] >= TILES_MAX)
+                return false;
+            tile_put(st, p[0], p[1], p[2] ? NULL : &p[3]);
+            p += p[2] ? 3 : TILE_OP_SIZE;
+        }
+        else
+            return false;
+    }
+    return true;
+}
+
+static void journal_path(char *out, int len, const char *path)
+{
+    snprintf(out, len, "%s.journal", path);
+}
+
+bool journal_load(struct journal *j, const char *path, struct state *st)
+{
+    int len = 0;
+    const unsigned char *data = platform_map_file(path, &len);
+    if (!data)
+        return false;
+    unsigned int base_hash = hash(data, len);
+    bool ok = document_decode(data, len, st);
+    platform_unmap_file(data, len);
+    if (!ok)
+        return false;
+
+    // Batches in order, up to the first one that doesn't check out
+    char log_path[1024];
+    journal_path(log_path, sizeof(log_path), path);
+    int log_len = 0;
+    int valid = 0;
+    const unsigned char *log = FileExists(log_path) ? platform_map_file(log_path, &log_len) : NULL;
+    if (log && log_len >= HEADER_SIZE && memcmp(log, "JJNL", 4) == 0 &&
+            get_u16(&log[4]) == JOURNAL_VERSION &&
+            get_u32(&log[8]) == (unsigned int)len && get_u32(&log[12]) == base_hash)
+    {
+        valid = HEADER_SIZE;
+        while (log_len - valid >= BATCH_HEADER_SIZE)
+        {
+            unsigned int n = get_u32(&log[valid]);
+            const unsigned char *ops = &log[valid + BATCH_HEADER_SIZE];
+            if (n > (unsigned int)(log_len - valid - BATCH_HEADER_SIZE) || hash(ops, n) != get_u32(&log[valid + 4]))
+                break;
+            if (!replay(st, ops, n))
+                break;
+            valid += BATCH_HEADER_SIZE + n;
+        }
+    }
+    if (log)
+        platform_unmap_file(log, log_len);
+
+    if (j)
+    {
+        journal_reset(j, st);
+        // Appending after a damaged batch would lose the new ones too
+        if (valid > 0 && valid == log_len)
+        {
+            j->snapshot = false;
+            j->file_len = valid;
+            j->base_len = len;
+            j->base_hash = base_hash;
+        }
+    }
+    return true;
+}
+
+void journal_reset(struct journal *j, const struct state *st)
+{
+    journal_wait(j);
+    j->len = 0;
+    j->revision = st->revision;
+    j->frames_revision = st->frames.revision;
+    meta_get(st, j->meta);
+    j->snapshot = true;
+    j->file_len = 0;
+    j->base_len = 0;
+    j->base_hash = 0;
+}
+
+// What writing a snapshot left on storage.
+struct snapshot
+{
+    bool ok;      // The document was replaced
+    bool written; // The journal starts over from it
+    int len;
+    unsigned int hash;
+};
+
+// Writes st as the document and starts its journal over, without touching
+// the journal so a worker thread can do it.
+static struct snapshot snapshot_write(const char *path, const char *log_path, const struct state *st)
+{
+    struct snapshot snap = {0};
+    unsigned char *data = document_encode(st, &snap.len);
+    if (!data)
+        return snap;
+    snap.hash = hash(data, snap.len);
+    snap.ok = document_write(path, data, snap.len);
+    free(data);
+    if (!snap.ok)
+        return snap;
+
+    // The old journal doesn't match the new document, readers skip it
+    // even if it can't be replaced
+    unsigned char header[HEADER_SIZE] = {'J', 'J', 'N', 'L'};
+    put_u16(&header[4], JOURNAL_VERSION);
+    put_u32(&header[8], snap.len);
+    put_u32(&header[12], snap.hash);
+    FILE *f = fopen(log_path, "wb");
+    snap.written = f && fwrite(header, 1, sizeof(header), f) == sizeof(header);
+    if (f && fclose(f) != 0)
+        snap.written = false;
+    return snap;
+}
+
+// Points the journal at the snapshot written. Operations recorded since
+// the state was taken go in its first batch, a failed one makes the next
+// save try again.
+static bool snapshot_done(struct journal *j, struct snapshot snap)
+{
+    if (!snap.ok)
+    {
+        j->snapshot = true;
+        return false;
+    }
+    j->file_len = snap.written ? HEADER_SIZE : 0;
+    j->base_len = snap.written ? snap.len : 0;
+    j->base_hash = snap.hash;
+    return true;
+}
+
+#if !defined(PLATFORM_WEB)
+// A snapshot written by a worker thread. It has its own copy of the cells
+// being edited, and reads the other frames of the timeline in place: the
+// caller waits for it before changing them.
+struct journal_worker
+{
+    pthread_t thread;
+    atomic_bool finished;
+    struct state st;
+    char path[1024], log_path[1024];
+    struct snapshot snap;
+};
+
+static void *worker_run(void *data)
+{
+    struct journal_worker *w = data;
+    w->snap = snapshot_write(w->path, w->log_path, &w->st);
+    atomic_store(&w->finished, true);
+    return NULL;
+}
+
+// Starts writing a snapshot of st in the background, false if it can't,
+// like when out of memory.
+static bool worker_start(struct journal *j, const char *path, const char *log_path, const struct state *st)
+{
+    struct journal_worker *w = malloc(sizeof(*w));
+    if (!w)
+        return false;
+    w->st = *st;
+    w->st.mat = (struct matrix){0};
+    atomic_init(&w->finished, false);
+    snprintf(w->path, sizeof(w->path), "%s", path);
+    snprintf(w->log_path, sizeof(w->log_path), "%s", log_path);
+    int tiles = (st->size + TILE_SIZE - 1) / TILE_SIZE;
+    bool copied = true;
+    for (int ty = 0; ty < tiles && copied; ++ty)
+    {
+        for (int tx = 0; tx < tiles && copied; ++tx)
+        {
+            matrix_copy_tile(&w->st.mat, &st->mat, tx, ty);
+            copied = !matrix_tile(&st->mat, tx, ty) || matrix_tile(&w->st.mat, tx, ty);
+        }
+    }
+    if (!copied || pthread_create(&w->thread, NULL, worker_run, w) != 0)
+    {
+        matrix_free(&w->st.mat);
+        free(w);
+        return false;
+    }
+    j->worker = w;
+    return true;
+}
+
+// Takes in the worker's snapshot once it is written, waiting for it or not.
+static void worker_finish(struct journal *j, bool wait)
+{
+    struct journal_worker *w = j->worker;
+    if (!w || (!wait && !atomic_load(&w->finished)))
+        return;
+    pthread_join(w->thread, NULL);
+    if (!snapshot_done(j, w->snap))
+        TraceLog(LOG_WARNING, "Could not write %s", w->path);
+    matrix_free(&w->st.mat);
+    free(w);
+    j->worker = NULL;
+}
+#else
+// No threads on the web, snapshots are written in place.
+static bool worker_start(struct journal *j, const char *path, const char *log_path, const struct state *st)
+{
+    return false;
+}
+
+static void worker_finish(struct journal *j, bool wait)
+{
+}
+#endif
+
+void journal_wait(struct journal *j)
+{
+    worker_finish(j, true);
+}
+
+bool journal_save(struct journal *j, const char *path, const struct state *st, bool compact)
+{
+    journal_sync(j, st);
+    // Batches wait for the snapshot being written, compacting waits for it
+    worker_finish(j, compact);
+    if (j->worker)
+        return true;
+    if (compact && journal_compacted(j) && j->len == 0 && !j->snapshot && j->base_len > 0)
+        return true;
+
+    char log_path[1024];
+    journal_path(log_path, sizeof(log_path), path);
+    if (compact || j->snapshot || j->base_len == 0 ||
+            j->file_len + BATCH_HEADER_SIZE + j->len > JOURNAL_MAX)
+    {
+        // What was recorded so far is in the snapshot
+        j->len = 0;
+        j->snapshot = false;
+        if (!compact && worker_start(j, path, log_path, st))
+            return true;
+        return snapshot_done(j, snapshot_write(path, log_path, st));
+    }
+    if (j->len == 0)
+        return true;
+
+    unsigned char header[BATCH_HEADER_SIZE];
+    put_u32(&header[0], j->len);
+    put_u32(&header[4], hash(j->ops, j->len));
+    FILE *f = fopen(log_path, "ab");
+    bool ok = f && fwrite(header, 1, sizeof(header), f) == sizeof(header) &&
+            fwrite(j->ops, 1, j->len, f) == (size_t)j->len;
+    if (f && fclose(f) != 0)
+        ok = false;
+    if (!ok)
+    {
+        // Part of the batch may be in the file, only a snapshot fixes it
+        j->snapshot = true;
+        return false;
+    }
+    j->file_len += BATCH_HEADER_SIZE + j->len;
+    j->len = 0;
+    return true;
+}
+
+bool journal_compacted(const struct journal *j)
+{
+    return !j->worker && j->file_len <= HEADER_SIZE;
+}
+
+void journal_free(struct journal *j)
+{
+    journal_wait(j);
+    free(j->ops);
+    memset(j, 0, sizeof(*j));
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "fill.h"
+#include "state.h"
+#include "stroke.h"
+
+// Edits of a document as operations appended to a journal next to it, so
+// a save writes what changed since the last one instead of the whole
+// document. The document file is the snapshot the journal starts from.
+// Once the journal grows past JOURNAL_MAX, or after changes it can't hold
+// (frame operations, large imports), the next save writes a snapshot and
+// starts an empty journal. Native builds write the snapshots of autosaves
+// on a worker thread, while the batches after them wait in memory.
+//
+// Journals, numbers little endian:
+//
+//   header  "JJNL", u16 version, u16 reserved, u32 snapshot length,
+//           u32 snapshot hash
+//   batches u32 payload length, u32 payload hash, operations
+//
+// Hashes are 32-bit FNV-1a. A journal whose header doesn't match the
+// document was left from before its last snapshot and is ignored, reading
+// stops at the first batch that is cut short or damaged.
+//
+// JOURNAL_META       u16 size, u8 palette, u8 col1, u8 col2,
+//                    u8 flags (1: grid, 2: onion skin)
+// JOURNAL_CELLS      u8 color, u16 count, count times u16 x, u16 y
+// JOURNAL_FILL       u16 x, u16 y, u8 color, u8 diagonal
+// JOURNAL_SHIFT      i16 dx, i16 dy
+// JOURNAL_FLIP       u8 vertical
+// JOURNAL_ROTATE     u8 clockwise
+// JOURNAL_TRANSPOSE
+// JOURNAL_TILE       u8 tx, u8 ty, u8 empty, the tile's packed cells
+//                    unless empty
+//
+// Operations replay on the snapshot with the functions that made them, in
+// order. Changes made some other way, like undo, go in as the tiles they
+// changed.
+#define JOURNAL_VERSION 1
+#define JOURNAL_MAX (256 * 1024) // Bytes before the next save compacts
+
+#define JOURNAL_META      1
+#define JOURNAL_CELLS     2
+#define JOURNAL_FILL      3
+#define JOURNAL_SHIFT     4
+#define JOURNAL_FLIP      5
+#define JOURNAL_ROTATE    6
+#define JOURNAL_TRANSPOSE 7
+#define JOURNAL_TILE      8
+
+struct journal
+{
+    unsigned char *ops; // Batch waiting for the next save
+    int len, cap;
+    unsigned int revision;        // State revision the operations reach
+    unsigned int frames_revision; // Of the timeline, changes to it need a snapshot
+    unsigned char meta[7];        // Last JOURNAL_META payload
+    bool snapshot;     // The next save writes a snapshot
+    int file_len;      // Bytes in the journal file
+    int base_len;      // Snapshot the journal file starts from
+    unsigned int base_hash;
+    struct journal_worker *worker; // Snapshot being written, native builds only
+};
+
+// Edits that go in the journal, each one makes the change and records it.
+// Changes made since the last one some other way are recorded first.
+void journal_paint(struct journal *j, struct state *st, const struct point *cells, int len, int color);
+int journal_fill(struct journal *j, struct state *st, int x, int y, int color, bool diagonal);
+void journal_shift(struct journal *j, struct state *st, int dx, int dy);
+void journal_flip(struct journal *j, struct state *st, bool vertical);
+void journal_rotate(struct journal *j, struct state *st, bool clockwise);
+void journal_transpose(struct journal *j, struct state *st);
+
+// Reads the document at path and replays its journal on it. With j, the
+// next saves append to that journal. Returns false when there is no
+// document at path, st is then left as is.
+bool journal_load(struct journal *j, const char *path, struct state *st);
+// Starts over from st, with no journal yet: the next save writes a snapshot.
+void journal_reset(struct journal *j, const struct state *st);
+// Saves the changes to the document at path: a batch appended to its
+// journal, or a snapshot when compacting or one is due. Compacting waits
+// for everything to be written, other snapshots may be written in the
+// background, and batches wait until they are.
+bool journal_save(struct journal *j, const char *path, const struct state *st, bool compact);
+// Whether the document at path holds everything, with no journal to replay.
+bool journal_compacted(const struct journal *j);
+// Waits for the snapshot being written, which reads the frames other than
+// the current one: call it before changing them.
+void journal_wait(struct journal *j);
+void journal_free(struct journal *j);
@@ -0,0 +1,171 @@
+// Checks each vectorized kernel against its plain C version on random
+// inputs, built by test_native.sh once per instruction set. Lengths cover
+// the vector widths, their tails and pointers off alignment.
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernels.h"
+
+#define MAX_LEN 300  // Cells per run, past a few 32 byte vectors
+#define RUNS 2000    // Random runs per kernel
+#define OFFSETS 32   // Start offsets tried for the buffers
+
+static unsigned int seed = 1;
+static int failures;
+
+static unsigned int test_random(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+// Lengths around each multiple of 16 and 32 come up more often than
+// random ones would, with 0 and 1 among them.
+static int random_len(void)
+{
+    if (test_random() % 2)
+        return test_random() % MAX_LEN;
+    int base = 16 * (test_random() % (MAX_LEN / 16));
+    int len = base + (int)(test_random() % 3) - 1;
+    return (len < 0) ? 0 : len;
+}
+
+static void fill_cells(unsigned char *cells, int n, int limit)
+{
+    for (int i = 0; i < n; ++i)
+        cells[i] = test_random() % limit;
+}
+
+static void check(bool ok, const char *kernel, int run, int n)
+{
+    if (ok)
+        return;
+    if (failures < 20)
+        fprintf(stderr, "%s: run %d, length %d differs from scalar\n", kernel, run, n);
+    failures += 1;
+}
+
+static void test_unpack_pack(void)
+{
+    static unsigned char packed[MAX_LEN + OFFSETS], cells[2 * MAX_LEN + OFFSETS];
+    static unsigned char a[2 * MAX_LEN + OFFSETS], b[2 * MAX_LEN + OFFSETS];
+    for (int run = 0; run < RUNS; ++run)
+    {
+        int bytes = random_len();
+        int off = test_random() % OFFSETS;
+        fill_cells(packed + off, bytes, 256);
+        memset(a, 0xAA, sizeof(a));
+        memset(b, 0xAA, sizeof(b));
+        kernel_unpack(packed + off, bytes, a + off);
+        kernel_unpack_scalar(packed + off, bytes, b + off);
+        check(memcmp(a, b, sizeof(a)) == 0, "kernel_unpack", run, bytes);
+
+        fill_cells(cells + off, 2 * bytes, 16);
+        memset(a, 0xAA, sizeof(a));
+        memset(b, 0xAA, sizeof(b));
+        kernel_pack(cells + off, bytes, a + off);
+        kernel_pack_scalar(cells + off, bytes, b + off);
+        check(memcmp(a, b, sizeof(a)) == 0, "kernel_pack", run, bytes);
+    }
+}
+
+static void test_mismatch(void)
+{
+    static unsigned char a[MAX_LEN + OFFSETS], b[MAX_LEN + OFFSETS];
+    for (int run = 0; run < RUNS; ++run)
+    {
+        int n = random_len();
+        int off = test_random() % OFFSETS;
+        fill_cells(a + off, n, 16);
+        memcpy(b + off, a + off, n);
+        // None, one or a few differences anywhere
+        int diffs = test_random() % 4;
+        for (int i = 0; i < diffs && n > 0; ++i)
+            b[off + test_random() % n] ^= 1 + test_random() % 15;
+        int from = (n > 0) ? (int)(test_random() % (n + 1)) : 0;
+        int got = kernel_mismatch(a + off, b + off, n, from);
+        int want = kernel_mismatch_scalar(a + off, b + off, n, from);
+        check(got == want, "kernel_mismatch", run, n);
+    }
+}
+
+static void test_blit(void)
+{
+    static unsigned char src[MAX_LEN + OFFSETS], dst[MAX_LEN + OFFSETS];
+    static unsigned char a[MAX_LEN + OFFSETS], b[MAX_LEN + OFFSETS];
+    for (int run = 0; run < RUNS; ++run)
+    {
+        int n = random_len();
+        int off = test_random() % OFFSETS;
+        // Cells and the bytes past them, like SELECT_NONE
+        for (int i = 0; i < n; ++i)
+            src[off + i] = (test_random() % 4) ? test_random() % 16 : 16 + test_random() % 240;
+        fill_cells(dst, sizeof(dst), 16);
+        memcpy(a, dst, sizeof(a));
+        memcpy(b, dst, sizeof(b));
+        int transparent = (int)(test_random() % 18) - 1;
+        kernel_blit(a + off, src + off, n, transparent);
+        kernel_blit_scalar(b + off, src + off, n, transparent);
+        check(memcmp(a, b, sizeof(a)) == 0, "kernel_blit", run, n);
+    }
+}
+
+static void test_expand_rgba(void)
+{
+    static unsigned char cells[MAX_LEN + OFFSETS], palette[64];
+    static unsigned char a[4 * (MAX_LEN + OFFSETS)], b[4 * (MAX_LEN + OFFSETS)];
+    for (int run = 0; run < RUNS; ++run)
+    {
+        int n = random_len();
+        int off = test_random() % OFFSETS;
+        fill_cells(palette, sizeof(palette), 256);
+        fill_cells(cells + off, n, 16);
+        memset(a, 0xAA, sizeof(a));
+        memset(b, 0xAA, sizeof(b));
+        kernel_expand_rgba(cells + off, n, palette, a + off);
+        kernel_expand_rgba_scalar(cells + off, n, palette, b + off);
+        check(memcmp(a, b, sizeof(a)) == 0, "kernel_expand_rgba", run, n);
+    }
+}
+
+static void test_nearest(void)
+{
+    static int planes[3][MAX_LEN + OFFSETS];
+    static int palette[3][16];
+    static unsigned char a[MAX_LEN + OFFSETS], b[MAX_LEN + OFFSETS];
+    for (int run = 0; run < RUNS; ++run)
+    {
+        int n = random_len();
+        int off = test_random() % OFFSETS;
+        // Narrow ranges now and then, for ties and repeated colors
+        int range = (test_random() % 4) ? 1 << 15 : 4;
+        for (int k = 0; k < 3; ++k)
+        {
+            for (int c = 0; c < 16; ++c)
+                palette[k][c] = test_random() % range;
+            for (int i = 0; i < n; ++i)
+                planes[k][off + i] = test_random() % range;
+        }
+        const int *const at[3] = {planes[0] + off, planes[1] + off, planes[2] + off};
+        memset(a, 0xAA, sizeof(a));
+        memset(b, 0xAA, sizeof(b));
+        kernel_nearest(at, n, (const int (*)[16])palette, a + off);
+        kernel_nearest_scalar(at, n, (const int (*)[16])palette, b + off);
+        check(memcmp(a, b, sizeof(a)) == 0, "kernel_nearest", run, n);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1)
+        seed = strtoul(argv[1], NULL, 10);
+    test_unpack_pack();
+    test_mismatch();
+    test_blit();
+    test_expand_rgba();
+    test_nearest();
+    printf("kernels %s: %s\n", kernel_isa(), failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,391 @@
+#include "kernels.h"
+
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#endif
+
+const char *kernel_isa(void)
+{
+#if defined(__AVX2__)
+    return "avx2";
+#elif defined(__SSSE3__)
+    return "ssse3";
+#elif defined(__SSE2__)
+    return "sse2";
+#elif defined(__wasm_simd128__)
+    return "simd128";
+#else
+    return "scalar";
+#endif
+}
+
+void kernel_unpack_scalar(const unsigned char *packed, int bytes, unsigned char *cells)
+{
+    for (int i = 0; i < bytes; ++i)
+    {
+        cells[2 * i] = packed[i] >> 4;
+        cells[2 * i + 1] = packed[i] & 0xF;
+    }
+}
+
+void kernel_unpack(const unsigned char *packed, int bytes, unsigned char *cells)
+{
+    int i = 0;
+#if defined(__AVX2__)
+    const __m256i mask = _mm256_set1_epi8(0x0F);
+    for (; i + 32 <= bytes; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)&packed[i]);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), mask);
+        __m256i lo = _mm256_and_si256(v, mask);
+        // Interleaving works within 128-bit lanes, put the halves back in order
+        __m256i a = _mm256_unpacklo_epi8(hi, lo);
+        __m256i b = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256((__m256i *)&cells[2 * i], _mm256_permute2x128_si256(a, b, 0x20));
+        _mm256_storeu_si256((__m256i *)&cells[2 * i + 32], _mm256_permute2x128_si256(a, b, 0x31));
+    }
+#elif defined(__SSE2__)
+    const __m128i mask = _mm_set1_epi8(0x0F);
+    for (; i + 16 <= bytes; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)&packed[i]);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+        __m128i lo = _mm_and_si128(v, mask);
+        _mm_storeu_si128((__m128i *)&cells[2 * i], _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *)&cells[2 * i + 16], _mm_unpackhi_epi8(hi, lo));
+    }
+#elif defined(__wasm_simd128__)
+    const v128_t mask = wasm_i8x16_splat(0x0F);
+    for (; i + 16 <= bytes; i += 16)
+    {
+        v128_t v = wasm_v128_load(&packed[i]);
+        v128_t hi = wasm_v128_and(wasm_u8x16_shr(v, 4), mask);
+        v128_t lo = wasm_v128_and(v, mask);
+        wasm_v128_store(&cells[2 * i], wasm_i8x16_shuffle(hi, lo,
+                0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23));
+        wasm_v128_store(&cells[2 * i + 16], wasm_i8x16_shuffle(hi, lo,
+                8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31));
+    }
+#endif
+    kernel_unpack_scalar(packed + i, bytes - i, cells + 2 * i);
+}
+
+void kernel_pack_scalar(const unsigned char *cells, int bytes, unsigned char *packed)
+{
+    for (int i = 0; i < bytes; ++i)
+        packed[i] = (cells[2 * i] << 4) | cells[2 * i + 1];
+}
+
+// The vector versions read each pair of cells as a 16-bit lane holding
+// first | second << 8 and turn it into first << 4 | second.
+void kernel_pack(const unsigned char *cells, int bytes, unsigned char *packed)
+{
+    int i = 0;
+#if defined(__AVX2__)
+    const __m256i mask = _mm256_set1_epi16(0x000F);
+    for (; i + 32 <= bytes; i += 32)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)&cells[2 * i]);
+        __m256i b = _mm256_loadu_si256((const __m256i *)&cells[2 * i + 32]);
+        a = _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(a, mask), 4), _mm256_srli_epi16(a, 8));
+        b = _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(b, mask), 4), _mm256_srli_epi16(b, 8));
+        // Narrowing works within 128-bit lanes, put the quarters back in order
+        __m256i v = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+        _mm256_storeu_si256((__m256i *)&packed[i], v);
+    }
+#elif defined(__SSE2__)
+    const __m128i mask = _mm_set1_epi16(0x000F);
+    for (; i + 16 <= bytes; i += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)&cells[2 * i]);
+        __m128i b = _mm_loadu_si128((const __m128i *)&cells[2 * i + 16]);
+        a = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(a, mask), 4), _mm_srli_epi16(a, 8));
+        b = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(b, mask), 4), _mm_srli_epi16(b, 8));
+        _mm_storeu_si128((__m128i *)&packed[i], _mm_packus_epi16(a, b));
+    }
+#elif defined(__wasm_simd128__)
+    const v128_t mask = wasm_i16x8_splat(0x000F);
+    for (; i + 16 <= bytes; i += 16)
+    {
+        v128_t a = wasm_v128_load(&cells[2 * i]);
+        v128_t b = wasm_v128_load(&cells[2 * i + 16]);
+        a = wasm_v128_or(wasm_i16x8_shl(wasm_v128_and(a, mask), 4), wasm_u16x8_shr(a, 8));
+        b = wasm_v128_or(wasm_i16x8_shl(wasm_v128_and(b, mask), 4), wasm_u16x8_shr(b, 8));
+        wasm_v128_store(&packed[i], wasm_u8x16_narrow_i16x8(a, b));
+    }
+#endif
+    kernel_pack_scalar(cells + 2 * i, bytes - i, packed + i);
+}
+
+int kernel_mismatch_scalar(const unsigned char *a, const unsigned char *b, int n, int from)
+{
+    int i = from;
+    while (i < n && a[i] == b[i])
+        i += 1;
+    return i;
+}
+
+int kernel_mismatch(const unsigned char *a, const unsigned char *b, int n, int from)
+{
+    int i = from;
+#if defined(__AVX2__)
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i va = _mm256_loadu_si256((const __m256i *)&a[i]);
+        __m256i vb = _mm256_loadu_si256((const __m256i *)&b[i]);
+        unsigned int equal = _mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb));
+        if (equal != 0xFFFFFFFFu)
+            return i + __builtin_ctz(~equal);
+    }
+#elif defined(__SSE2__)
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i va = _mm_loadu_si128((const __m128i *)&a[i]);
+        __m128i vb = _mm_loadu_si128((const __m128i *)&b[i]);
+        unsigned int equal = _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb));
+        if (equal != 0xFFFF)
+            return i + __builtin_ctz(~equal);
+    }
+#elif defined(__wasm_simd128__)
+    for (; i + 16 <= n; i += 16)
+    {
+        v128_t eq = wasm_i8x16_eq(wasm_v128_load(&a[i]), wasm_v128_load(&b[i]));
+        unsigned int equal = wasm_i8x16_bitmask(eq);
+        if (equal != 0xFFFF)
+            return i + __builtin_ctz(~equal);
+    }
+#endif
+    return kernel_mismatch_scalar(a, b, n, i);
+}
+
+void kernel_blit_scalar(unsigned char *dst, const unsigned char *src, int n, int transparent)
+{
+    for (int i = 0; i < n; ++i)
+    {
+        if (src[i] < 16 && src[i] != transparent)
+            dst[i] = src[i];
+    }
+}
+
+// A source cell is kept when min(cell, 15) is the cell itself and it isn't
+// the transparent one, kept cells are blended into the destination.
+void kernel_blit(unsigned char *dst, const unsigned char *src, int n, int transparent)
+{
+    int i = 0;
+    unsigned char skip = (transparent >= 0 && transparent < 16) ? transparent : 0xFF;
+#if defined(__AVX2__)
+    const __m256i top = _mm256_set1_epi8(15);
+    const __m256i clear = _mm256_set1_epi8(skip);
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i s = _mm256_loadu_si256((const __m256i *)&src[i]);
+        __m256i d = _mm256_loadu_si256((const __m256i *)&dst[i]);
+        __m256i cell = _mm256_cmpeq_epi8(_mm256_min_epu8(s, top), s);
+        __m256i keep = _mm256_andnot_si256(_mm256_cmpeq_epi8(s, clear), cell);
+        _mm256_storeu_si256((__m256i *)&dst[i], _mm256_blendv_epi8(d, s, keep));
+    }
+#elif defined(__SSE2__)
+    const __m128i top = _mm_set1_epi8(15);
+    const __m128i clear = _mm_set1_epi8(skip);
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i s = _mm_loadu_si128((const __m128i *)&src[i]);
+        __m128i d = _mm_loadu_si128((const __m128i *)&dst[i]);
+        __m128i cell = _mm_cmpeq_epi8(_mm_min_epu8(s, top), s);
+        __m128i keep = _mm_andnot_si128(_mm_cmpeq_epi8(s, clear), cell);
+        _mm_storeu_si128((__m128i *)&dst[i], _mm_or_si128(_mm_and_si128(keep, s), _mm_andnot_si128(keep, d)));
+    }
+#elif defined(__wasm_simd128__)
+    const v128_t top = wasm_i8x16_splat(15);
+    const v128_t clear = wasm_i8x16_splat(skip);
+    for (; i + 16 <= n; i += 16)
+    {
+        v128_t s = wasm_v128_load(&src[i]);
+        v128_t d = wasm_v128_load(&dst[i]);
+        v128_t cell = wasm_i8x16_eq(wasm_u8x16_min(s, top), s);
+        v128_t keep = wasm_v128_andnot(cell, wasm_i8x16_eq(s, clear));
+        wasm_v128_store(&dst[i], wasm_v128_bitselect(s, d, keep));
+    }
+#endif
+    kernel_blit_scalar(dst + i, src + i, n - i, skip);
+}
+
+void kernel_expand_rgba_scalar(const unsigned char *cells, int n, const unsigned char *palette, unsigned char *rgba)
+{
+    for (int i = 0; i < n; ++i)
+        memcpy(&rgba[4 * i], &palette[4 * cells[i]], 4);
+}
+
+// Byte shuffles look up 16 cells at once in one table per channel, the
+// channels are then interleaved back into pixels. Plain SSE2 has no such
+// shuffle and stays scalar.
+void kernel_expand_rgba(const unsigned char *cells, int n, const unsigned char *palette, unsigned char *rgba)
+{
+    int i = 0;
+#if defined(__SSSE3__) || defined(__wasm_simd128__)
+    unsigned char channels[4][16];
+    for (int c = 0; c < 16; ++c)
+    {
+        for (int k = 0; k < 4; ++k)
+            channels[k][c] = palette[4 * c + k];
+    }
+#endif
+#if defined(__SSSE3__)
+    const __m128i lut_r = _mm_loadu_si128((const __m128i *)channels[0]);
+    const __m128i lut_g = _mm_loadu_si128((const __m128i *)channels[1]);
+    const __m128i lut_b = _mm_loadu_si128((const __m128i *)channels[2]);
+    const __m128i lut_a = _mm_loadu_si128((const __m128i *)channels[3]);
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i idx = _mm_loadu_si128((const __m128i *)&cells[i]);
+        __m128i r = _mm_shuffle_epi8(lut_r, idx);
+        __m128i g = _mm_shuffle_epi8(lut_g, idx);
+        __m128i b = _mm_shuffle_epi8(lut_b, idx);
+        __m128i a = _mm_shuffle_epi8(lut_a, idx);
+        __m128i rg_lo = _mm_unpacklo_epi8(r, g);
+        __m128i rg_hi = _mm_unpackhi_epi8(r, g);
+        __m128i ba_lo = _mm_unpacklo_epi8(b, a);
+        __m128i ba_hi = _mm_unpackhi_epi8(b, a);
+        _mm_storeu_si128((__m128i *)&rgba[4 * i], _mm_unpacklo_epi16(rg_lo, ba_lo));
+        _mm_storeu_si128((__m128i *)&rgba[4 * i + 16], _mm_unpackhi_epi16(rg_lo, ba_lo));
+        _mm_storeu_si128((__m128i *)&rgba[4 * i + 32], _mm_unpacklo_epi16(rg_hi, ba_hi));
+        _mm_storeu_si128((__m128i *)&rgba[4 * i + 48], _mm_unpackhi_epi16(rg_hi, ba_hi));
+    }
+#elif defined(__wasm_simd128__)
+    const v128_t lut_r = wasm_v128_load(channels[0]);
+    const v128_t lut_g = wasm_v128_load(channels[1]);
+    const v128_t lut_b = wasm_v128_load(channels[2]);
+    const v128_t lut_a = wasm_v128_load(channels[3]);
+    for (; i + 16 <= n; i += 16)
+    {
+        v128_t idx = wasm_v128_load(&cells[i]);
+        v128_t r = wasm_i8x16_swizzle(lut_r, idx);
+        v128_t g = wasm_i8x16_swizzle(lut_g, idx);
+        v128_t b = wasm_i8x16_swizzle(lut_b, idx);
+        v128_t a = wasm_i8x16_swizzle(lut_a, idx);
+        v128_t rg_lo = wasm_i8x16_shuffle(r, g, 0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23);
+        v128_t rg_hi = wasm_i8x16_shuffle(r, g, 8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31);
+        v128_t ba_lo = wasm_i8x16_shuffle(b, a, 0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23);
+        v128_t ba_hi = wasm_i8x16_shuffle(b, a, 8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31);
+        wasm_v128_store(&rgba[4 * i], wasm_i16x8_shuffle(rg_lo, ba_lo, 0, 8, 1, 9, 2, 10, 3, 11));
+        wasm_v128_store(&rgba[4 * i + 16], wasm_i16x8_shuffle(rg_lo, ba_lo, 4, 12, 5, 13, 6, 14, 7, 15));
+        wasm_v128_store(&rgba[4 * i + 32], wasm_i16x8_shuffle(rg_hi, ba_hi, 0, 8, 1, 9, 2, 10, 3, 11));
+        wasm_v128_store(&rgba[4 * i + 48], wasm_i16x8_shuffle(rg_hi, ba_hi, 4, 12, 5, 13, 6, 14, 7, 15));
+    }
+#endif
+    kernel_expand_rgba_scalar(cells + i, n - i, palette, rgba + 4 * i);
+}
+
+void kernel_nearest_scalar(const int *const planes[3], int n, const int palette[3][16], unsigned char *cells)
+{
+    for (int i = 0; i < n; ++i)
+    {
+        int best = 0;
+        int best_d = 0x7FFFFFFF;
+        for (int c = 0; c < 16; ++c)
+        {
+            int d = 0;
+            for (int k = 0; k < 3; ++k)
+            {
+                int e = planes[k][i] - palette[k][c];
+                d += e * e;
+            }
+            if (d < best_d)
+            {
+                best_d = d;
+                best = c;
+            }
+        }
+        cells[i] = best;
+    }
+}
+
+// Each lane follows one point through the 16 colors, keeping the best
+// distance and index so far. Plain SSE2 has no 32-bit multiply: with the
+// differences masked to their low 16 bits, a 16-bit multiply-add gives the
+// square alone.
+void kernel_nearest(const int *const planes[3], int n, const int palette[3][16], unsigned char *cells)
+{
+    int i = 0;
+#if defined(__AVX2__)
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i l = _mm256_loadu_si256((const __m256i *)&planes[0][i]);
+        __m256i a = _mm256_loadu_si256((const __m256i *)&planes[1][i]);
+        __m256i b = _mm256_loadu_si256((const __m256i *)&planes[2][i]);
+        __m256i best = _mm256_setzero_si256();
+        __m256i best_d = _mm256_set1_epi32(0x7FFFFFFF);
+        for (int c = 0; c < 16; ++c)
+        {
+            __m256i el = _mm256_sub_epi32(l, _mm256_set1_epi32(palette[0][c]));
+            __m256i ea = _mm256_sub_epi32(a, _mm256_set1_epi32(palette[1][c]));
+            __m256i eb = _mm256_sub_epi32(b, _mm256_set1_epi32(palette[2][c]));
+            __m256i d = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(el, el),
+                    _mm256_mullo_epi32(ea, ea)), _mm256_mullo_epi32(eb, eb));
+            __m256i closer = _mm256_cmpgt_epi32(best_d, d);
+            best_d = _mm256_blendv_epi8(best_d, d, closer);
+            best = _mm256_blendv_epi8(best, _mm256_set1_epi32(c), closer);
+        }
+        __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(best), _mm256_extracti128_si256(best, 1));
+        _mm_storel_epi64((__m128i *)&cells[i], _mm_packus_epi16(words, words));
+    }
+    // Callers go on to SSE code in libm, clean upper halves keep it fast
+    _mm256_zeroupper();
+#elif defined(__SSE2__)
+    const __m128i low = _mm_set1_epi32(0xFFFF);
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i l = _mm_loadu_si128((const __m128i *)&planes[0][i]);
+        __m128i a = _mm_loadu_si128((const __m128i *)&planes[1][i]);
+        __m128i b = _mm_loadu_si128((const __m128i *)&planes[2][i]);
+        __m128i best = _mm_setzero_si128();
+        __m128i best_d = _mm_set1_epi32(0x7FFFFFFF);
+        for (int c = 0; c < 16; ++c)
+        {
+            __m128i el = _mm_and_si128(_mm_sub_epi32(l, _mm_set1_epi32(palette[0][c])), low);
+            __m128i ea = _mm_and_si128(_mm_sub_epi32(a, _mm_set1_epi32(palette[1][c])), low);
+            __m128i eb = _mm_and_si128(_mm_sub_epi32(b, _mm_set1_epi32(palette[2][c])), low);
+            __m128i d = _mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(el, el),
+                    _mm_madd_epi16(ea, ea)), _mm_madd_epi16(eb, eb));
+            __m128i closer = _mm_cmplt_epi32(d, best_d);
+            best_d = _mm_or_si128(_mm_and_si128(closer, d), _mm_andnot_si128(closer, best_d));
+            best = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(c)), _mm_andnot_si128(closer, best));
+        }
+        __m128i words = _mm_packs_epi32(best, best);
+        int bytes = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+        memcpy(&cells[i], &bytes, 4);
+    }
+#elif defined(__wasm_simd128__)
+    for (; i + 4 <= n; i += 4)
+    {
+        v128_t l = wasm_v128_load(&planes[0][i]);
+        v128_t a = wasm_v128_load(&planes[1][i]);
+        v128_t b = wasm_v128_load(&planes[2][i]);
+        v128_t best = wasm_i32x4_splat(0);
+        v128_t best_d = wasm_i32x4_splat(0x7FFFFFFF);
+        for (int c = 0; c < 16; ++c)
+        {
+            v128_t el = wasm_i32x4_sub(l, wasm_i32x4_splat(palette[0][c]));
+            v128_t ea = wasm_i32x4_sub(a, wasm_i32x4_splat(palette[1][c]));
+            v128_t eb = wasm_i32x4_sub(b, wasm_i32x4_splat(palette[2][c]));
+            v128_t d = wasm_i32x4_add(wasm_i32x4_add(wasm_i32x4_mul(el, el),
+                    wasm_i32x4_mul(ea, ea)), wasm_i32x4_mul(eb, eb));
+            v128_t closer = wasm_i32x4_lt(d, best_d);
+            best_d = wasm_v128_bitselect(d, best_d, closer);
+            best = wasm_v128_bitselect(wasm_i32x4_splat(c), best, closer);
+        }
+        v128_t words = wasm_i16x8_narrow_i32x4(best, best);
+        wasm_v128_store32_lane(&cells[i], wasm_u8x16_narrow_i16x8(words, words), 0);
+    }
+#endif
+    const int *const tail[3] = {planes[0] + i, planes[1] + i, planes[2] + i};
+    kernel_nearest_scalar(tail, n - i, palette, cells + i);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+// Bulk operations on cells, vectorized with whatever the compiler targets:
+// AVX2 or SSE2/SSSE3 natively, SIMD128 on the web (-msimd128). Each one
+// has a plain C version, which the vectorized one matches exactly and uses
+// for the leftover tail.
+//
+// Packed cells go two per byte, the first one in the high nibble. Cells
+// given one per byte must be below 16.
+
+// Name of the instruction set the kernels were built for.
+const char *kernel_isa(void);
+
+// Expands bytes packed bytes into 2 * bytes cells.
+void kernel_unpack(const unsigned char *packed, int bytes, unsigned char *cells);
+void kernel_unpack_scalar(const unsigned char *packed, int bytes, unsigned char *cells);
+
+// Packs 2 * bytes cells into bytes packed bytes.
+void kernel_pack(const unsigned char *cells, int bytes, unsigned char *packed);
+void kernel_pack_scalar(const unsigned char *cells, int bytes, unsigned char *packed);
+
+// Index of the first byte at or after from where a and b differ, n if none.
+int kernel_mismatch(const unsigned char *a, const unsigned char *b, int n, int from);
+int kernel_mismatch_scalar(const unsigned char *a, const unsigned char *b, int n, int from);
+
+// Copies the n cells of src over dst, but for the transparent one (-1 for
+// none) and those that are not cells, 16 and above, which leave dst as is.
+void kernel_blit(unsigned char *dst, const unsigned char *src, int n, int transparent);
+void kernel_blit_scalar(unsigned char *dst, const unsigned char *src, int n, int transparent);
+
+// Writes the RGBA color of each of the n cells, palette holds 16 of them.
+void kernel_expand_rgba(const unsigned char *cells, int n, const unsigned char *palette, unsigned char *rgba);
+void kernel_expand_rgba_scalar(const unsigned char *cells, int n, const unsigned char *palette, unsigned char *rgba);
+
+// Index of the nearest of 16 palette colors to each of the n points, by
+// squared distance, the first one on ties. Points come as one plane per
+// component and the palette as 16 values per component, in fixed point,
+// each point within 2^15 of every palette color in every component.
+void kernel_nearest(const int *const planes[3], int n, const int palette[3][16], unsigned char *cells);
+void kernel_nearest_scalar(const int *const planes[3], int n, const int palette[3][16], unsigned char *cells);
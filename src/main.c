@@ -1,16 +1,40 @@
 #include <raylib.h>
-#include <emscripten.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-#include "palettes.h"
 #include "utils.h"
+#include "document.h"
+#include "fill.h"
+#include "frames.h"
+#include "gif.h"
 #include "icons.h"
+#include "import.h"
+#include "input.h"
+#include "journal.h"
+#include "kernels.h"
+#include "palette.h"
+#include "platform.h"
+#include "png.h"
+#include "profile.h"
+#include "render.h"
+#include "select.h"
+#include "state.h"
+#include "stroke.h"
+#include "transform.h"
+#include "undo.h"
+#include "workspace.h"
 
-#define MAX_CANVAS_SIZE 32
 #define BGCOLOR RAYWHITE
-#define MAX_UNDOS 32
+#define AUTOSAVE_INTERVAL 1.0 // Seconds
+#define SHIFT_STEP 8 // Cells moved by Shift + arrows
+#define ZOOM_MAX 64.0f // Screen pixels per cell
+#define ZOOM_STEP 1.25f
+#define EXPORT_MAX_SIZE 4096 // Pixels along each side of exported images
+#define DURATION_STEP 10 // Milliseconds, Shift for ten times as much
+#define GALLERY_COLUMNS 8 // Thumbnails per row of the gallery, over the board
 
 #define BUTTON_OPTIONS   0
 #define BUTTON_GRID      1
@@ -27,47 +51,79 @@
 
 #define ARRAY_SIZE(X) (sizeof((X))/sizeof((X)[0]))
 
-static const int SIZE_OPTIONS[] = {16, 21, 24, 32};
+static const int SIZE_OPTIONS[] = {16, 21, 24, 32, 64, 256, 1024, 4096};
+
+// Widget IDs in the hit map, ranges are indexed by color, button, etc.
+#define HIT_NONE     0
+#define HIT_CURRENT  1
+#define HIT_COLOR    2
+#define HIT_BUTTON   (HIT_COLOR + 16)
+#define HIT_SIZE     (HIT_BUTTON + BUTTON_COUNT)
+#define HIT_PALETTE  (HIT_SIZE + (int)ARRAY_SIZE(SIZE_OPTIONS))
+#define HIT_OK       (HIT_PALETTE + PALETTES_MAX)
+
+// Layout units along the longest side of either orientation.
+#define LAYOUT_UNITS (1 + 64 + 1 + 4 + 1 + 4 + 1)
+
+// Palette buttons per column in the options, a second column holds the rest.
+#define PALETTE_ROWS 10
 
 struct layout
 {
     bool vertical;
     int scale;
-    int pixel_size;
-    Rectangle canvas;
-    Rectangle board;
+    Rectangle board; // Area for the canvas
     Rectangle palette;
     Rectangle current;
     Rectangle buttons[BUTTON_COUNT];
 
     Rectangle size_buttons[ARRAY_SIZE(SIZE_OPTIONS)];
-    Rectangle palette_buttons[ARRAY_SIZE(PALETTES)];
+    Rectangle palette_buttons[PALETTES_MAX];
     Rectangle ok_button;
+
+    // Widget under each layout unit, the options ones lie over the board.
+    int offset_x, offset_y;
+    unsigned char hits[LAYOUT_UNITS][LAYOUT_UNITS];
 };
 
-static struct layout compute_layout_oriented(int size, bool vertical)
+static int layout_scale(bool vertical, int *required_w, int *required_h)
 {
-    struct layout lay = {0};
-    lay.vertical = vertical;
+    *required_w = 1 + 64 + 1 + (vertical ? 0 : 4 + 1 + 4 + 1);
+    *required_h = 1 + 64 + 1 + (vertical ? 4 + 1 + 4 + 1 : 0);
 
-    int size_w = GetScreenWidth();
-    int size_h = GetScreenHeight();
+    int scale_w = input_screen_width() / *required_w;
+    int scale_h = input_screen_height() / *required_h;
+    return (scale_w < scale_h) ? scale_w : scale_h;
+}
 
-    int required_w = 1 + 64 + 1 + (vertical ? 0 : 4 + 1 + 4 + 1);
-    int required_h = 1 + 64 + 1 + (vertical ? 4 + 1 + 4 + 1 : 0);
+// Marks the units covered by rect, given in units, as belonging to hit.
+static void layout_hits_fill(struct layout *lay, Rectangle rect, int hit)
+{
+    for (int y = rect.y; y < rect.y + rect.height; ++y)
+    {
+        for (int x = rect.x; x < rect.x + rect.width; ++x)
+            lay->hits[y][x] = hit;
+    }
+}
+
+static struct layout compute_layout_oriented(bool vertical)
+{
+    struct layout lay = {0};
+    lay.vertical = vertical;
 
-    int scale_w = size_w / required_w;
-    int scale_h = size_h / required_h;
-    int scale = (scale_w < scale_h) ? scale_w : scale_h;
+    int required_w, required_h;
+    int scale = layout_scale(vertical, &required_w, &required_h);
     lay.scale = scale;
 
-    int offset_x = (size_w - scale * required_w)/2;
-    int offset_y = (size_h - scale * required_h)/2;
+    int offset_x = (input_screen_width() - scale * required_w)/2;
+    int offset_y = (input_screen_height() - scale * required_h)/2;
+    lay.offset_x = offset_x;
+    lay.offset_y = offset_y;
 
-    lay.canvas.x = 1;
-    lay.canvas.y = 1;
-    lay.canvas.width = 64;
-    lay.canvas.height = 64;
+    lay.board.x = 1;
+    lay.board.y = 1;
+    lay.board.width = 64;
+    lay.board.height = 64;
 
     if (vertical)
     {
@@ -122,242 +178,414 @@ static struct layout compute_layout_oriented(int size, bool vertical)
 
     for (int i = 0; i < ARRAY_SIZE(SIZE_OPTIONS); ++i)
     {
-        lay.size_buttons[i].x = 3 + (14 + 1)*i;
-        lay.size_buttons[i].y = 4;
+        lay.size_buttons[i].x = 3 + (14 + 1)*(i % 4);
+        lay.size_buttons[i].y = 2 + (3 + 1)*(i / 4);
         lay.size_buttons[i].width = 14;
-        lay.size_buttons[i].height = 4;
+        lay.size_buttons[i].height = 3;
     }
-    for (int i = 0; i < ARRAY_SIZE(PALETTES); ++i)
+    int palettes = palette_count();
+    int palette_width = (palettes > PALETTE_ROWS) ? 29 : 60;
+    for (int i = 0; i < palettes; ++i)
     {
-        lay.palette_buttons[i].x = 2;
-        lay.palette_buttons[i].y = 11 + (4 + 1)*i;
-        lay.palette_buttons[i].width = 60;
+        lay.palette_buttons[i].x = 2 + (palette_width + 2)*(i / PALETTE_ROWS);
+        lay.palette_buttons[i].y = 11 + (4 + 1)*(i % PALETTE_ROWS);
+        lay.palette_buttons[i].width = palette_width;
         lay.palette_buttons[i].height = 4;
     }
     lay.ok_button.x = 16;
-    lay.ok_button.y = 11 + (4 + 1)*(int)ARRAY_SIZE(PALETTES);
+    lay.ok_button.y = 11 + (4 + 1)*((palettes < PALETTE_ROWS) ? palettes : PALETTE_ROWS);
     lay.ok_button.width = 32;
     lay.ok_button.height = 4;
 
-    rectangle_scale(&lay.canvas, offset_x, offset_y, scale);
+    layout_hits_fill(&lay, lay.current, HIT_CURRENT);
+    for (int c = 0; c < 16; ++c)
+    {
+        Rectangle r = lay.palette;
+        if (vertical)
+        {
+            r.width /= 16;
+            r.x += r.width * c;
+        }
+        else
+        {
+            r.height /= 16;
+            r.y += r.height * c;
+        }
+        layout_hits_fill(&lay, r, HIT_COLOR + c);
+    }
+    for (int t = 0; t < BUTTON_COUNT; ++t)
+        layout_hits_fill(&lay, lay.buttons[t], HIT_BUTTON + t);
+    for (int i = 0; i < ARRAY_SIZE(SIZE_OPTIONS); ++i)
+        layout_hits_fill(&lay, lay.size_buttons[i], HIT_SIZE + i);
+    for (int i = 0; i < palettes; ++i)
+        layout_hits_fill(&lay, lay.palette_buttons[i], HIT_PALETTE + i);
+    layout_hits_fill(&lay, lay.ok_button, HIT_OK);
+
+    rectangle_scale(&lay.board, offset_x, offset_y, scale);
     rectangle_scale(&lay.current, offset_x, offset_y, scale);
     rectangle_scale(&lay.palette, offset_x, offset_y, scale);
     for (int t = 0; t < BUTTON_COUNT; ++t)
         rectangle_scale(&lay.buttons[t], offset_x, offset_y, scale);
     for (int t = 0; t < ARRAY_SIZE(SIZE_OPTIONS); ++t)
         rectangle_scale(&lay.size_buttons[t], offset_x, offset_y, scale);
-    for (int t = 0; t < ARRAY_SIZE(PALETTES); ++t)
+    for (int t = 0; t < palettes; ++t)
         rectangle_scale(&lay.palette_buttons[t], offset_x, offset_y, scale);
     rectangle_scale(&lay.ok_button, offset_x, offset_y, scale);
 
-    lay.board = lay.canvas;
-
-    lay.pixel_size = (int)(lay.canvas.width/size);
-    lay.canvas.x += (int)(.5*(lay.canvas.width - lay.pixel_size * size));
-    lay.canvas.y += (int)(.5*(lay.canvas.height - lay.pixel_size * size));
-    lay.canvas.height = lay.pixel_size * size;
-    lay.canvas.width = lay.pixel_size * size;
-
     return lay;
 }
 
-static struct layout compute_layout(int size)
+static struct layout compute_layout(void)
+{
+    int w, h;
+    bool vertical = layout_scale(true, &w, &h) >= layout_scale(false, &w, &h);
+    return compute_layout_oriented(vertical);
+}
+
+// Widget under a screen position, HIT_NONE outside of every widget.
+static int layout_hit(const struct layout *lay, Vector2 pos)
 {
-    struct layout layout_v = compute_layout_oriented(size, true);
-    struct layout layout_h = compute_layout_oriented(size, false);
-    return (layout_v.scale >= layout_h.scale) ? layout_v : layout_h;
+    if (lay->scale <= 0)
+        return HIT_NONE;
+    int x = floorf((pos.x - lay->offset_x) / lay->scale);
+    int y = floorf((pos.y - lay->offset_y) / lay->scale);
+    if (x < 0 || y < 0 || x >= LAYOUT_UNITS || y >= LAYOUT_UNITS)
+        return HIT_NONE;
+    return lay->hits[y][x];
 }
 
-struct matrix
+// Last computed layout, reused while the screen size and the number of
+// palettes stay.
+struct layout_cache
 {
-    unsigned char cells[MAX_CANVAS_SIZE][MAX_CANVAS_SIZE];
+    bool valid;
+    int width, height, palettes;
+    struct layout layout;
 };
 
-struct state
+static const struct layout *layout_get(struct layout_cache *cache)
 {
-    struct matrix mat;
-    int size;
-    int pal; // Current palette
-    int col1, col2;
-    bool grid;
+    int width = input_screen_width();
+    int height = input_screen_height();
+    int palettes = palette_count();
+    if (!cache->valid || cache->width != width || cache->height != height || cache->palettes != palettes)
+    {
+        cache->layout = compute_layout();
+        cache->valid = true;
+        cache->width = width;
+        cache->height = height;
+        cache->palettes = palettes;
+    }
+    return &cache->layout;
+}
+
+// Part of the canvas shown on the board. A zoom of 0 fits the whole canvas,
+// otherwise cells are zoom pixels wide and the canvas position (x, y), in
+// cells, is at the center of the board.
+struct view
+{
+    float zoom;
+    float x, y;
 };
 
-static Color get_color(const struct state *st, int idx)
+// Pixels per cell that fit the whole canvas, whole ones when they are big
+// enough so every cell gets the same width.
+static float view_fit_zoom(const struct layout *layout, int size)
 {
-    return GetColor(PALETTES[st->pal].colors[idx]);
+    float zoom = layout->board.width / size;
+    return (zoom >= 1) ? floorf(zoom) : zoom;
 }
 
-static bool state_load(struct state *st)
+// Screen rectangle of the whole canvas, it can extend past the board.
+static Rectangle view_canvas(const struct view *view, const struct layout *layout, int size)
 {
-    int size = 0;
-    unsigned char *data = LoadFileData("/offline/state.data", &size);
-    if (!data)
-        return false;
-    if (size < sizeof(struct state))
+    float zoom = view->zoom;
+    float x = view->x;
+    float y = view->y;
+    if (zoom == 0)
     {
-        UnloadFileData(data);
-        return false;
+        zoom = view_fit_zoom(layout, size);
+        x = y = size/2.0f;
     }
-    memcpy(st, data, sizeof(struct state));
-    UnloadFileData(data);
-    return true;
+    Rectangle board = layout->board;
+    return (Rectangle){
+        floorf(board.x + board.width/2 - x*zoom),
+        floorf(board.y + board.height/2 - y*zoom),
+        size*zoom,
+        size*zoom,
+    };
 }
 
-static void state_save(struct state *st)
+// Visible part of the canvas, on the screen (dest) and in cells (source).
+static void view_visible(const struct view *view, const struct layout *layout, int size,
+        Rectangle *source, Rectangle *dest)
 {
-    bool lock = true;
-    SaveFileData("/offline/state.data", st, sizeof(struct state));
-
-    EM_ASM({
-        FS.syncfs(function (err) {
-            Module.setValue($0, false, "i8"); // lock -> false
-        });
-    }, &lock);
+    Rectangle canvas = view_canvas(view, layout, size);
+    float zoom = canvas.width / size;
+    *dest = GetCollisionRec(canvas, layout->board);
+    *source = (Rectangle){
+        (dest->x - canvas.x) / zoom,
+        (dest->y - canvas.y) / zoom,
+        dest->width / zoom,
+        dest->height / zoom,
+    };
+}
 
-    while (lock)
-        emscripten_sleep(1);
+// Keeps the center of the board over the canvas.
+static void view_clamp(struct view *view, int size)
+{
+    view->x = (view->x < 0) ? 0 : (view->x > size) ? size : view->x;
+    view->y = (view->y < 0) ? 0 : (view->y > size) ? size : view->y;
 }
 
-static void state_shift_left(struct state *st)
+// Zooms by factor keeping the canvas position under pos in place, back to
+// fitting the canvas when zooming out that far.
+static void view_zoom_at(struct view *view, const struct layout *layout, int size, float factor, Vector2 pos)
 {
-    for (int y = 0; y < st->size; ++y)
+    Rectangle canvas = view_canvas(view, layout, size);
+    float zoom = canvas.width / size;
+    float x = (pos.x - canvas.x) / zoom;
+    float y = (pos.y - canvas.y) / zoom;
+
+    float fit = view_fit_zoom(layout, size);
+    float max = (fit > ZOOM_MAX) ? fit : ZOOM_MAX;
+    zoom *= factor;
+    if (zoom > max)
+        zoom = max;
+    if (zoom <= fit)
     {
-        unsigned char aux = st->mat.cells[y][0];
-        for (int x = 0; x < st->size - 1; ++x)
-            st->mat.cells[y][x] = st->mat.cells[y][x + 1];
-        st->mat.cells[y][st->size - 1] = aux;
+        view->zoom = 0;
+        return;
     }
+    Rectangle board = layout->board;
+    view->zoom = zoom;
+    view->x = x - (pos.x - (board.x + board.width/2)) / zoom;
+    view->y = y - (pos.y - (board.y + board.height/2)) / zoom;
+    view_clamp(view, size);
 }
 
-static void state_shift_right(struct state *st)
+static void view_pan(struct view *view, int size, Vector2 delta)
 {
-    for (int y = 0; y < st->size; ++y)
-    {
-        unsigned char aux = st->mat.cells[y][st->size - 1];
-        for (int x = st->size - 1; x >= 1; --x)
-            st->mat.cells[y][x] = st->mat.cells[y][x - 1];
-        st->mat.cells[y][0] = aux;
-    }
+    if (view->zoom == 0)
+        return;
+    view->x -= delta.x / view->zoom;
+    view->y -= delta.y / view->zoom;
+    view_clamp(view, size);
+}
+
+static Color get_color(const struct state *st, int idx)
+{
+    return palette_get(st->pal)->colors[idx];
 }
 
-static void state_shift_up(struct state *st)
+// File of the document in the storage directory: the active one of the
+// workspace. Replays save to their own, so they don't overwrite it.
+static char state_file[256] = "state.data";
+// Edits of the document since it was last written whole.
+static struct journal journal;
+
+static bool state_load(struct state *st)
 {
-    for (int x = 0; x < st->size; ++x)
+    if (!journal_load(&journal, TextFormat("%s/%s", platform_storage_dir(), state_file), st))
     {
-        unsigned char aux = st->mat.cells[0][x];
-        for (int y = 0; y < st->size - 1; ++y)
-            st->mat.cells[y][x] = st->mat.cells[y + 1][x];
-        st->mat.cells[st->size - 1][x] = aux;
+        journal_reset(&journal, st);
+        return false;
     }
+    if (st->pal >= palette_count())
+        st->pal = 0;
+    return true;
 }
 
-static void state_shift_down(struct state *st)
+// Adds a palette file dropped on the window and selects it. A copy goes
+// next to the state file, so it is loaded again on the next start.
+static void palette_import(struct state *st, const char *path)
 {
-    for (int x = 0; x < st->size; ++x)
+    int pal = palettes_load_file(path);
+    if (pal < 0)
     {
-        unsigned char aux = st->mat.cells[st->size - 1][x];
-        for (int y = st->size - 1; y >= 1; --y)
-            st->mat.cells[y][x] = st->mat.cells[y - 1][x];
-        st->mat.cells[0][x] = aux;
+        TraceLog(LOG_WARNING, "Not a palette file: %s", path);
+        return;
     }
+    int len = 0;
+    unsigned char *data = LoadFileData(path, &len);
+    if (data)
+    {
+        const char *dir = TextFormat("%s/palettes", platform_storage_dir());
+        MakeDirectory(dir);
+        if (!SaveFileData(TextFormat("%s/%s", dir, GetFileName(path)), data, len))
+            TraceLog(LOG_WARNING, "Could not keep a copy of %s", path);
+        UnloadFileData(data);
+    }
+    st->pal = pal;
+    state_touch(st); // The autosave syncs the copy too
 }
 
-static void image_save(const struct state *st, bool big)
+// Replaces the current frame with a dropped image, in the current palette.
+static void image_import(struct state *st, const char *path, enum dither dither)
 {
-    int scale = big ? 16 : 1;
-    
-    Image img = GenImageColor(st->size*scale, st->size*scale, WHITE);
-    for (int y = 0; y < st->size; ++y)
+    Image image = LoadImage(path);
+    if (!image.data)
     {
-        for (int x = 0; x < st->size; ++x)
-            ImageDrawRectangle(&img, scale*x, scale*y, scale, scale, get_color(st, st->mat.cells[y][x]));
+        TraceLog(LOG_WARNING, "Could not load %s", path);
+        return;
     }
-
-    ExportImage(img, "img.png");
-    UnloadImage(img);
-    if (big)
-        emscripten_run_script("saveFileFromMemoryFSToDisk('img.png','jolly_paint_img_big.png')");
+    ImageFormat(&image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+    double start = platform_time();
+    if (import_image(st, image.data, image.width, image.height, palette_get(st->pal), dither))
+        TraceLog(LOG_INFO, "Imported %dx%d image, dithering %s, in %.1f ms",
+                image.width, image.height, dither_name(dither), (platform_time() - start)*1000);
     else
-        emscripten_run_script("saveFileFromMemoryFSToDisk('img.png','jolly_paint_img.png')");
+        TraceLog(LOG_WARNING, "Not enough memory to import %s", path);
+    UnloadImage(image);
 }
 
-struct undostack
+// Writes the changes to the state file's journal, or the whole document
+// when compacting, persisting it is up to the autosave.
+static void state_save(struct state *st, bool compact)
 {
-    struct matrix mats[MAX_UNDOS];
-    // States saved to undo (the top one is the current one).
-    int len;
-    // Last valid length for redos.
-    int redo_len;
+    profile_begin(PHASE_SAVE);
+    if (!journal_save(&journal, TextFormat("%s/%s", platform_storage_dir(), state_file), st, compact))
+        TraceLog(LOG_WARNING, "Could not save the document");
+    profile_end(PHASE_SAVE);
+}
+
+// Saves the state in the background, at most once per AUTOSAVE_INTERVAL and
+// only when its revision moved. Changes made while a save is being synced
+// wait for it and then go out together in the next one.
+struct autosave
+{
+    unsigned int saved_revision; // State revision in the last save
+    bool scheduled;  // The state changed and a save is due at some point
+    double due;      // When the scheduled save runs
+    double last;     // When the last save started
+    bool syncing;    // The last save is still being flushed
+    // Stats
+    unsigned int saves;
+    unsigned int skipped; // Requests with nothing to save, or merged into another save
+    double latency_last, latency_max, latency_total; // Seconds from write to flushed
 };
 
-void undostack_save(const struct state *st, struct undostack *stack)
+static void autosave_init(struct autosave *as, const struct state *st)
 {
-    // Check that currrent state is different to last saved state
-    if (stack->len > 0)
+    memset(as, 0, sizeof(*as));
+    as->saved_revision = st->revision;
+}
+
+static void autosave_finish(struct autosave *as, double now)
+{
+    double latency = now - as->last;
+    as->syncing = false;
+    as->saves += 1;
+    as->latency_last = latency;
+    as->latency_total += latency;
+    if (latency > as->latency_max)
+        as->latency_max = latency;
+}
+
+// Asks for a save as soon as possible, like when exporting an image.
+static void autosave_request(struct autosave *as, const struct state *st, double now)
+{
+    if (st->revision == as->saved_revision || as->scheduled)
+        as->skipped += 1;
+    if (st->revision != as->saved_revision)
     {
-        bool same = true;
-        for (int y = 0; y < MAX_CANVAS_SIZE; ++y)
-        {
-            for (int x = 0; x < MAX_CANVAS_SIZE; ++x)
-            {
-                if (stack->mats[stack->len - 1].cells[y][x] != st->mat.cells[y][x])
-                    same = false;
-            }
-        }
-        if (same)
+        as->scheduled = true;
+        as->due = now;
+    }
+}
+
+// Call every frame, never waits for the storage.
+static void autosave_update(struct autosave *as, struct state *st, double now)
+{
+    if (as->syncing)
+    {
+        if (platform_storage_sync_pending())
             return;
+        autosave_finish(as, now);
     }
-    // Push stack down
-    if (stack->len == MAX_UNDOS)
+    if (st->revision == as->saved_revision)
     {
-        for (int i = 0; i < stack->len - 1; ++i)
-            stack->mats[i] = stack->mats[i + 1];
-        
-        stack->len -= 1;
+        as->scheduled = false;
+        return;
     }
-    // Store state in the stack
-    stack->mats[stack->len] = st->mat;
-    stack->len += 1;
-    stack->redo_len = stack->len;
+    if (!as->scheduled)
+    {
+        as->scheduled = true;
+        as->due = (as->last + AUTOSAVE_INTERVAL > now) ? as->last + AUTOSAVE_INTERVAL : now;
+    }
+    if (now < as->due)
+        return;
+
+    state_save(st, false);
+    platform_storage_sync_begin();
+    as->saved_revision = st->revision;
+    as->scheduled = false;
+    as->syncing = true;
+    as->last = now;
 }
 
-bool undostack_can_undo(const struct undostack *stack)
+// Seconds the caller may idle before autosave_update has work, or -1.
+static double autosave_wait(const struct autosave *as, double now)
 {
-    return stack->len >= 2;
+    if (as->syncing)
+        return 0.01;
+    if (as->scheduled)
+        return (as->due > now) ? as->due - now : 0;
+    return -1;
 }
 
-void undostack_undo(struct state *st, struct undostack *stack)
+// Blocks until everything is saved, for exiting. The journal is folded
+// into the document, so other programs read it whole.
+static void autosave_flush(struct autosave *as, struct state *st)
 {
-    if (!undostack_can_undo(stack))
-        return;
-    stack->len -= 1;
-    st->mat = stack->mats[stack->len - 1];
+    if (as->syncing)
+    {
+        platform_storage_sync();
+        autosave_finish(as, platform_time());
+    }
+    if (st->revision != as->saved_revision || !journal_compacted(&journal))
+    {
+        as->last = platform_time();
+        state_save(st, true);
+        platform_storage_sync();
+        as->saved_revision = st->revision;
+        autosave_finish(as, platform_time());
+    }
 }
 
-bool undostack_can_redo(const struct undostack *stack)
+// Pixels per cell of exported images, big ones as long as they fit.
+static int export_scale(const struct state *st, bool big)
 {
-    return stack->len < stack->redo_len;
+    int scale = big ? 16 : 1;
+    while (scale > 1 && st->size*scale > EXPORT_MAX_SIZE)
+        scale /= 2;
+    return scale;
 }
 
-void undostack_redo(struct state *st, struct undostack *stack)
+static void image_save(struct png_cache *cache, const struct state *st, bool big)
 {
-    if (!undostack_can_redo(stack))
+    int len;
+    const unsigned char *png = png_cache_get(cache, st, palette_get(st->pal)->colors, export_scale(st, big), &len);
+    if (!png || !SaveFileData("img.png", (void *)png, len))
+    {
+        TraceLog(LOG_WARNING, "Could not export the image");
         return;
-    st->mat = stack->mats[stack->len];
-    stack->len += 1;
+    }
+    platform_download("img.png", big ? "jolly_paint_img_big.png" : "jolly_paint_img.png");
 }
 
-void flood_fill(struct state *st, int x, int y, int a, int b)
+static void animation_save(const struct state *st, bool big)
 {
-    if (x < 0 || y < 0 || x >= st->size || y >= st->size)
-        return;
-    if (st->mat.cells[y][x] == b || st->mat.cells[y][x] != a)
+    int len;
+    unsigned char *gif = gif_encode(st, palette_get(st->pal)->colors, export_scale(st, big), &len);
+    bool ok = gif && SaveFileData("anim.gif", gif, len);
+    free(gif);
+    if (!ok)
+    {
+        TraceLog(LOG_WARNING, "Could not export the animation");
         return;
-    st->mat.cells[y][x] = b;
-    flood_fill(st, x + 1, y, a, b);
-    flood_fill(st, x - 1, y, a, b);
-    flood_fill(st, x, y + 1, a, b);
-    flood_fill(st, x, y - 1, a, b);
+    }
+    platform_download("anim.gif", big ? "jolly_paint_anim_big.gif" : "jolly_paint_anim.gif");
 }
 
 void draw_text_centered(const struct layout *layout, Rectangle rect, const char *text, int size)
@@ -367,379 +595,1235 @@ void draw_text_centered(const struct layout *layout, Rectangle rect, const char
     DrawText(text, rect.x + (rect.width - w)/2, rect.y + (rect.height - font_size)/2, font_size, DARKGRAY);
 }
 
-int main(void)
+// Everything the chrome layer depends on besides the layout.
+struct chrome_key
 {
-    bool lock = true;
-    EM_ASM({
-        // Make a directory mounted as IndexedDB
-        if (!FS.analyzePath('/offline').exists){
-            FS.mkdir('/offline');
-        }
-        FS.mount(IDBFS, {}, '/offline');
-        FS.syncfs(true, function (err) {
-            Module.setValue($0, false, "i8"); // lock -> false
-        });
-    }, &lock);
+    int width, height;
+    int size, pal, col1, col2;
+    unsigned int palettes; // Revision of the loaded palettes
+    bool options, grid, bucket, fill_diagonal, can_undo, can_redo;
+};
 
-    while (lock)
-        emscripten_sleep(1);
+// Left drags on the canvas with the selection tools.
+enum select_tool { SELECT_OFF, SELECT_RECT, SELECT_WAND };
+enum drag { DRAG_NONE, DRAG_SELECT, DRAG_MOVE };
 
-    // Initialization
-    InitWindow(400, 400, "Jolly paint");
-    SetWindowState(FLAG_WINDOW_RESIZABLE | FLAG_WINDOW_MAXIMIZED);
-    SetTargetFPS(60);
+// Everything the floating cells' texture depends on besides its cells.
+struct floating_key
+{
+    unsigned int changes;
+    int transparent, pal;
+    unsigned int palettes;
+};
 
-    bool options = false;
-    bool bucket = false;
+struct app
+{
+    struct state st;
+    struct undostack stack;
+    struct layout_cache layouts;
+    struct view view;
+    struct renderer ren;
+    struct layer chrome;  // Everything around the canvas
+    struct layer overlay; // Options screen contents
+    struct chrome_key chrome_key;
+    bool options;
+    bool bucket;
+    bool fill_diagonal; // Bucket fills through corners too
+    struct stroke strokes[2]; // Left and right buttons
+    enum select_tool select_tool;
+    struct selection sel;   // Picked cells of the canvas, empty when none
+    struct image floating;  // Cells lifted or pasted, on the canvas once dropped
+    int float_x, float_y;   // Where its top left goes, it can be past the edges
+    bool float_wrap;        // Past the edges it wraps around instead of clipping
+    bool float_transparent; // Its cells of the second color leave the canvas as is
+    struct image clipboard;
+    int clip_x, clip_y;     // Where the clipboard was copied from, pastes go there
+    enum drag drag;
+    int drag_x, drag_y;     // Cell the drag started on, or its offset in the floating cells
+    unsigned int select_changes; // Grows when sel or floating change, for their textures
+    unsigned int sel_uploaded;   // select_changes the selection texture shows
+    struct floating_key floating_key;
+    struct sprite sel_sprite, floating_sprite;
+    struct autosave autosave;
+    struct png_cache exports[2]; // Last image saved, normal and big
+    struct matrix onion_cells; // Neighbor frame on its way to the renderer
+    enum dither dither; // For imported images
+    bool profiler; // Frame profiler HUD shown
+    struct workspace ws; // Empty when replaying
+    bool gallery; // Thumbnails of the workspace shown over the board
+    int gallery_row; // First row of thumbnails shown
+    struct atlas thumbs;
+    unsigned int thumb_revision; // Saved revision the active thumbnail shows
+    bool redraw; // Present the next frame even without input
+    unsigned int drawn_revision; // State revision as last presented
+    unsigned int frames_presented;
+    unsigned int frames_skipped;
+};
 
-    struct state st = {.col1 = 8, .col2 = 3, .size = 24};
-    bool loaded = state_load(&st);
-    if (!loaded)
-        options = true;
-    struct undostack stack = {0};
-    undostack_save(&st, &stack);
+// Transparent color of the floating cells, -1 for none.
+static int floating_transparent(const struct app *app)
+{
+    return app->float_transparent ? app->st.col2 : -1;
+}
 
+// Puts the floating cells down on the canvas, an undo step.
+static void floating_drop(struct app *app)
+{
+    if (app->floating.w == 0)
+        return;
+    image_blit(&app->st, &app->floating, app->float_x, app->float_y, floating_transparent(app), app->float_wrap);
+    image_free(&app->floating);
+    app->select_changes += 1;
+    undostack_save(&app->st, &app->stack);
+}
 
-    bool left_on_canvas = false;
-    bool right_on_canvas = false;
+// Drops the floating cells and forgets the selection.
+static void selection_deselect(struct app *app)
+{
+    floating_drop(app);
+    if (app->sel.w > 0)
+        app->select_changes += 1;
+    selection_clear(&app->sel);
+    app->drag = DRAG_NONE;
+}
 
-    // Main game loop
-    unsigned int frame = 0;
-    while (!WindowShouldClose()) // Detect window close button or ESC key
+// Lifts the selected cells off the canvas to move them, the second color
+// is left behind.
+static bool selection_lift(struct app *app)
+{
+    if (app->sel.w == 0 || !selection_copy(&app->sel, &app->st, &app->floating))
+        return false;
+    selection_erase(&app->sel, &app->st, app->st.col2);
+    app->float_x = app->sel.x;
+    app->float_y = app->sel.y;
+    app->float_wrap = false;
+    selection_clear(&app->sel);
+    app->select_changes += 1;
+    return true;
+}
+
+// Cell (x, y) relative to the floating cells' top left, true if it is on
+// them. When they wrap, the nearest copy to the right and down counts.
+static bool floating_hit(const struct app *app, int x, int y, int *fx, int *fy)
+{
+    int size = app->st.size;
+    *fx = x - app->float_x;
+    *fy = y - app->float_y;
+    if (app->float_wrap)
     {
-        struct layout layout = compute_layout(st.size);
-        Vector2 mpos = GetMousePosition();
+        *fx = (*fx % size + size) % size;
+        *fy = (*fy % size + size) % size;
+    }
+    return app->floating.w > 0 && *fx >= 0 && *fy >= 0 && *fx < app->floating.w && *fy < app->floating.h;
+}
 
-        // Update selected colors
-        for (int c = 0; c < 16; ++c)
+// Left drags with a selection tool. Starting on the floating or selected
+// cells moves them, lifting them first, elsewhere it drops the floating
+// ones and selects a rectangle, or the wand picks the region clicked.
+static void select_update(struct app *app, Rectangle canvas, Rectangle visible, Vector2 mpos)
+{
+    int size = app->st.size;
+    float zoom = canvas.width / size;
+    int x = floorf((mpos.x - canvas.x)/zoom);
+    int y = floorf((mpos.y - canvas.y)/zoom);
+    int cx = (x < 0) ? 0 : (x >= size) ? size - 1 : x;
+    int cy = (y < 0) ? 0 : (y >= size) ? size - 1 : y;
+
+    if (input_button_pressed(MOUSE_BUTTON_LEFT) && CheckCollisionPointRec(mpos, visible))
+    {
+        int fx, fy;
+        if (!floating_hit(app, x, y, &fx, &fy) && app->floating.w == 0 && selection_has(&app->sel, x, y))
         {
-            Rectangle r = layout.palette;
-            if (layout.vertical)
-            {
-                r.width /= 16;
-                r.x += r.width * c;
-            }
-            else
-            {
-                r.height /= 16;
-                r.y += r.height * c;
-            }
-
-            if (CheckCollisionPointRec(mpos, r))
+            selection_lift(app);
+            floating_hit(app, x, y, &fx, &fy);
+        }
+        if (floating_hit(app, x, y, &fx, &fy))
+        {
+            app->drag = DRAG_MOVE;
+            app->drag_x = fx;
+            app->drag_y = fy;
+        }
+        else
+        {
+            selection_deselect(app);
+            app->drag = DRAG_SELECT;
+            app->drag_x = cx;
+            app->drag_y = cy;
+            if (app->select_tool == SELECT_WAND)
             {
-                if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT))
-                    st.col1 = c;
-                if (IsMouseButtonPressed(MOUSE_BUTTON_RIGHT))
-                    st.col2 = c;
+                selection_wand(&app->sel, &app->st, cx, cy, app->fill_diagonal);
+                app->drag = DRAG_NONE;
             }
         }
+    }
+    if (!input_button_down(MOUSE_BUTTON_LEFT))
+        app->drag = DRAG_NONE;
 
-        if (options)
+    if (app->drag == DRAG_MOVE)
+    {
+        // Only the position changes, the canvas is left alone until the drop
+        app->float_x = x - app->drag_x;
+        app->float_y = y - app->drag_y;
+    }
+    else if (app->drag == DRAG_SELECT && (cx != app->drag_x || cy != app->drag_y || app->sel.w > 0))
+    {
+        int x0 = (cx < app->drag_x) ? cx : app->drag_x;
+        int y0 = (cy < app->drag_y) ? cy : app->drag_y;
+        int x1 = ((cx > app->drag_x) ? cx : app->drag_x) + 1;
+        int y1 = ((cy > app->drag_y) ? cy : app->drag_y) + 1;
+        const struct selection *sel = &app->sel;
+        if (sel->x != x0 || sel->y != y0 || sel->w != x1 - x0 || sel->h != y1 - y0)
         {
-            for (int i = 0; i < ARRAY_SIZE(SIZE_OPTIONS); ++i)
-            {
-                if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT)
-                        && CheckCollisionPointRec(mpos, layout.size_buttons[i]))
-                {
-                    st.size = SIZE_OPTIONS[i];
-                    layout = compute_layout(st.size);
-                }
-            }
-            for (int i = 0; i < ARRAY_SIZE(PALETTES); ++i)
-            {
-                if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT)
-                        && CheckCollisionPointRec(mpos, layout.palette_buttons[i]))
-                    st.pal = i;
-            }
-            // Ok button
-            if (CheckCollisionPointRec(mpos, layout.ok_button) && IsMouseButtonPressed(MOUSE_BUTTON_LEFT))
-                options = false;
+            selection_rect(&app->sel, x0, y0, x1, y1);
+            app->select_changes += 1;
         }
-        else if (!CheckCollisionPointRec(mpos, layout.canvas))
+    }
+}
+
+// Makes document i of the workspace the one edited, after saving this one.
+// Its revisions continue from this one's, so the caches keyed on them
+// (textures, exports) can't take one document for the other.
+static void document_open(struct app *app, int i)
+{
+    if (i == app->ws.active)
+        return;
+    selection_deselect(app);
+    autosave_flush(&app->autosave, &app->st);
+    workspace_thumb_update(&app->ws, app->ws.active, &app->st);
+
+    struct state last = app->st;
+    if (!workspace_switch(&app->ws, i, &app->st))
+    {
+        // New documents are blank, in the size and colors of the last one
+        app->st.size = last.size;
+        app->st.pal = last.pal;
+        app->st.col1 = last.col1;
+        app->st.col2 = last.col2;
+        app->st.grid = last.grid;
+    }
+    if (app->st.pal >= palette_count())
+        app->st.pal = 0;
+    if (app->st.revision < last.revision)
+        app->st.revision = last.revision;
+    state_touch_rect(&app->st, 0, 0, MAX_CANVAS_SIZE, MAX_CANVAS_SIZE);
+    app->st.frames.revision = app->st.revision;
+    snprintf(state_file, sizeof(state_file), "%s", workspace_file(&app->ws, i));
+    journal_reset(&journal, &app->st);
+
+    autosave_init(&app->autosave, &app->st);
+    undostack_reset(&app->st, &app->stack);
+    app->view = (struct view){0};
+    app->strokes[0].active = false;
+    app->strokes[1].active = false;
+    app->thumb_revision = app->autosave.saved_revision;
+    if (!workspace_save_index(&app->ws))
+        TraceLog(LOG_WARNING, "Could not save the workspace index");
+    platform_storage_sync_begin();
+}
+
+// Adds a document to the workspace and opens it, saved right away so it
+// is kept even if left blank.
+static void document_new(struct app *app)
+{
+    int i = workspace_add(&app->ws);
+    if (i < 0)
+    {
+        TraceLog(LOG_WARNING, "Not enough memory for another document");
+        return;
+    }
+    document_open(app, i);
+    state_save(&app->st, true);
+    workspace_thumb_update(&app->ws, i, &app->st);
+}
+
+// Gallery cell under pos, counting from the first one of the workspace,
+// -1 outside of the board.
+static int gallery_hit(const struct app *app, const struct layout *layout, Vector2 pos)
+{
+    if (!CheckCollisionPointRec(pos, layout->board))
+        return -1;
+    float cell = layout->board.width / GALLERY_COLUMNS;
+    int x = (pos.x - layout->board.x) / cell;
+    int y = (pos.y - layout->board.y) / cell;
+    if (x >= GALLERY_COLUMNS) x = GALLERY_COLUMNS - 1;
+    if (y >= GALLERY_COLUMNS) y = GALLERY_COLUMNS - 1;
+    return (app->gallery_row + y)*GALLERY_COLUMNS + x;
+}
+
+static void app_update(struct app *app, const struct layout *layout)
+{
+    Vector2 mpos = input_mouse_position();
+    int hit = layout_hit(layout, mpos);
+    bool click = input_button_pressed(MOUSE_BUTTON_LEFT);
+    bool shift_down = input_key_down(KEY_LEFT_SHIFT) || input_key_down(KEY_RIGHT_SHIFT);
+    bool ctrl_down = input_key_down(KEY_LEFT_CONTROL) || input_key_down(KEY_RIGHT_CONTROL);
+
+    if (input_dropped_count() > 0)
+        floating_drop(app);
+    for (int i = 0; i < input_dropped_count(); ++i)
+    {
+        const char *path = input_dropped_path(i);
+        if (IsFileExtension(path, ".png"))
         {
-            left_on_canvas = false;
-            right_on_canvas = false;
+            image_import(&app->st, path, app->dither);
+            undostack_save(&app->st, &app->stack);
         }
         else
         {
-            Vector2 mdelta = GetMouseDelta();
-            if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT))
-                mdelta = (Vector2){0, 0}; // Preempt large deltas on the phone.
-
-            for (int t = 0; t <= 20; t++)
-            {
-                float alpha = t/20.0f;
-                Vector2 midpos;
-                midpos.x = mpos.x - mdelta.x*(1-alpha);
-                midpos.y = mpos.y - mdelta.y*(1-alpha);
-                if (CheckCollisionPointRec(midpos, layout.canvas))
-                {
-                    int pos_x = (midpos.x - layout.canvas.x)/layout.pixel_size;
-                    int pos_y = (midpos.y - layout.canvas.y)/layout.pixel_size;
-
-                    if (pos_x < 0) pos_x = 0;
-                    if (pos_x >= st.size) pos_x = st.size - 1;
-                    if (pos_y < 0) pos_y = 0;
-                    if (pos_y >= st.size) pos_y = st.size - 1;
-
-                    if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT))
-                        left_on_canvas = true;
-                    if (IsMouseButtonPressed(MOUSE_BUTTON_RIGHT))
-                        right_on_canvas = true;
-
-                    if (bucket)
-                    {
-                        int current = st.mat.cells[pos_y][pos_x];
-                        if (left_on_canvas && IsMouseButtonDown(MOUSE_BUTTON_LEFT))
-                            flood_fill(&st, pos_x, pos_y, current, st.col1);
-                        if (right_on_canvas && IsMouseButtonDown(MOUSE_BUTTON_RIGHT))
-                            flood_fill(&st, pos_x, pos_y, current, st.col2);
-                    }
-                    else
-                    {
-                        if (left_on_canvas && IsMouseButtonDown(MOUSE_BUTTON_LEFT))
-                            st.mat.cells[pos_y][pos_x] = st.col1;
-                        if (right_on_canvas && IsMouseButtonDown(MOUSE_BUTTON_RIGHT))
-                            st.mat.cells[pos_y][pos_x] = st.col2;
-                    }
-                }
-            }
+            palette_import(&app->st, path);
         }
-        // Save undo checkpoint
-        if (IsMouseButtonReleased(MOUSE_BUTTON_LEFT))
+    }
+
+    // Update selected colors, a change only when they are different ones
+    if (hit >= HIT_COLOR && hit < HIT_COLOR + 16)
+    {
+        int color = hit - HIT_COLOR;
+        if (input_button_pressed(MOUSE_BUTTON_LEFT) && app->st.col1 != color)
         {
-            left_on_canvas = false;
-            undostack_save(&st, &stack);
+            app->st.col1 = color;
+            state_touch(&app->st);
         }
-        if (IsMouseButtonReleased(MOUSE_BUTTON_RIGHT))
+        if (input_button_pressed(MOUSE_BUTTON_RIGHT) && app->st.col2 != color)
         {
-            right_on_canvas = false;
-            undostack_save(&st, &stack);
+            app->st.col2 = color;
+            state_touch(&app->st);
         }
+    }
 
-        // Swap colors
-        if (IsKeyPressed(KEY_X) ||
-                (CheckCollisionPointRec(mpos, layout.current) && IsMouseButtonPressed(MOUSE_BUTTON_LEFT)))
+    // Zoom with the wheel, pan dragging with the middle button
+    if (!app->options && !app->gallery)
+    {
+        float wheel = input_mouse_wheel();
+        if (wheel != 0 && CheckCollisionPointRec(mpos, layout->board))
+            view_zoom_at(&app->view, layout, app->st.size, powf(ZOOM_STEP, wheel), mpos);
+        if (input_button_down(MOUSE_BUTTON_MIDDLE))
+            view_pan(&app->view, app->st.size, input_mouse_delta());
+    }
+    Rectangle canvas = view_canvas(&app->view, layout, app->st.size);
+    Rectangle source, visible;
+    view_visible(&app->view, layout, app->st.size, &source, &visible);
+
+    if (app->gallery)
+    {
+        // The first cell makes a new document, the others open theirs
+        int item = click ? gallery_hit(app, layout, mpos) : -1;
+        if (item == 0)
         {
-            int aux = st.col1;
-            st.col1 = st.col2;
-            st.col2 = aux;
+            document_new(app);
+            app->gallery = false;
         }
-
-        // Options toggle
-        if (IsKeyPressed(KEY_O) ||
-                (CheckCollisionPointRec(mpos, layout.buttons[BUTTON_OPTIONS]) && IsMouseButtonPressed(MOUSE_BUTTON_LEFT)))
-            options = !options;
-        // Grid toggle
-        if (IsKeyPressed(KEY_G) ||
-                (CheckCollisionPointRec(mpos, layout.buttons[BUTTON_GRID]) && IsMouseButtonPressed(MOUSE_BUTTON_LEFT)))
-            st.grid = !st.grid;
-        // Undo
-        if (IsKeyPressed(KEY_Z) ||
-                (CheckCollisionPointRec(mpos, layout.buttons[BUTTON_UNDO]) && IsMouseButtonPressed(MOUSE_BUTTON_LEFT)))
-            undostack_undo(&st, &stack);
-        if (IsKeyPressed(KEY_Y) ||
-                (CheckCollisionPointRec(mpos, layout.buttons[BUTTON_REDO]) && IsMouseButtonPressed(MOUSE_BUTTON_LEFT)))
-            undostack_redo(&st, &stack);
-        // Paint bucket toggle
-        if (IsKeyPressed(KEY_P) ||
-                (CheckCollisionPointRec(mpos, layout.buttons[BUTTON_BUCKET]) && IsMouseButtonPressed(MOUSE_BUTTON_LEFT)))
-            bucket = !bucket;
-        // Shift buttons
-        if (IsKeyPressed(KEY_LEFT) ||
-                (CheckCollisionPointRec(mpos, layout.buttons[BUTTON_LEFT]) && IsMouseButtonPressed(MOUSE_BUTTON_LEFT)))
+        else if (item > 0 && item <= app->ws.count)
         {
-            state_shift_left(&st);
-            undostack_save(&st, &stack);
+            document_open(app, item - 1);
+            app->gallery = false;
         }
-        if (IsKeyPressed(KEY_RIGHT) ||
-                (CheckCollisionPointRec(mpos, layout.buttons[BUTTON_RIGHT]) && IsMouseButtonPressed(MOUSE_BUTTON_LEFT)))
+        // The wheel scrolls by rows
+        float wheel = input_mouse_wheel();
+        int rows = (app->ws.count + 1 + GALLERY_COLUMNS - 1) / GALLERY_COLUMNS;
+        app->gallery_row -= (wheel > 0) - (wheel < 0);
+        if (app->gallery_row > rows - GALLERY_COLUMNS)
+            app->gallery_row = rows - GALLERY_COLUMNS;
+        if (app->gallery_row < 0)
+            app->gallery_row = 0;
+        app->strokes[0].active = false;
+        app->strokes[1].active = false;
+    }
+    else if (app->options)
+    {
+        if (click && hit >= HIT_SIZE && hit < HIT_SIZE + ARRAY_SIZE(SIZE_OPTIONS))
         {
-            state_shift_right(&st);
-            undostack_save(&st, &stack);
+            app->st.size = SIZE_OPTIONS[hit - HIT_SIZE];
+            app->view = (struct view){0};
+            state_touch(&app->st);
         }
-        if (IsKeyPressed(KEY_UP) ||
-                (CheckCollisionPointRec(mpos, layout.buttons[BUTTON_UP]) && IsMouseButtonPressed(MOUSE_BUTTON_LEFT)))
+        if (click && hit >= HIT_PALETTE && hit < HIT_PALETTE + palette_count())
         {
-            state_shift_up(&st);
-            undostack_save(&st, &stack);
+            app->st.pal = hit - HIT_PALETTE;
+            state_touch(&app->st);
         }
-        if (IsKeyPressed(KEY_DOWN) ||
-                (CheckCollisionPointRec(mpos, layout.buttons[BUTTON_DOWN]) && IsMouseButtonPressed(MOUSE_BUTTON_LEFT)))
+        // Ok button
+        if (click && hit == HIT_OK)
+            app->options = false;
+    }
+    else if (app->select_tool != SELECT_OFF)
+    {
+        select_update(app, canvas, visible, mpos);
+        app->strokes[0].active = false;
+        app->strokes[1].active = false;
+    }
+    else if (!CheckCollisionPointRec(mpos, visible))
+    {
+        app->strokes[0].active = false;
+        app->strokes[1].active = false;
+    }
+    else
+    {
+        float zoom = canvas.width / app->st.size;
+        int pos_x = floorf((mpos.x - canvas.x)/zoom);
+        int pos_y = floorf((mpos.y - canvas.y)/zoom);
+
+        if (pos_x < 0) pos_x = 0;
+        if (pos_x >= app->st.size) pos_x = app->st.size - 1;
+        if (pos_y < 0) pos_y = 0;
+        if (pos_y >= app->st.size) pos_y = app->st.size - 1;
+
+        // Left paints the first color, right the second one
+        for (int b = 0; b < 2; ++b)
         {
-            state_shift_down(&st);
-            undostack_save(&st, &stack);
+            int button = b == 0 ? MOUSE_BUTTON_LEFT : MOUSE_BUTTON_RIGHT;
+            int color = b == 0 ? app->st.col1 : app->st.col2;
+            struct stroke *stroke = &app->strokes[b];
+
+            if (input_button_pressed(button))
+                stroke_begin(stroke);
+            if (!stroke->active || !input_button_down(button))
+                continue;
+
+            static struct point cells[STROKE_MAX_CELLS];
+            int len = stroke_to(stroke, pos_x, pos_y, cells);
+            if (!app->bucket)
+            {
+                journal_paint(&journal, &app->st, cells, len, color);
+                continue;
+            }
+            for (int i = 0; i < len; ++i)
+            {
+                profile_begin(PHASE_FILL);
+                journal_fill(&journal, &app->st, cells[i].x, cells[i].y, color, app->fill_diagonal);
+                profile_end(PHASE_FILL);
+            }
         }
+    }
+    // Save undo checkpoint
+    if (input_button_released(MOUSE_BUTTON_LEFT))
+    {
+        app->strokes[0].active = false;
+        undostack_save(&app->st, &app->stack);
+    }
+    if (input_button_released(MOUSE_BUTTON_RIGHT))
+    {
+        app->strokes[1].active = false;
+        undostack_save(&app->st, &app->stack);
+    }
+
+    // Swap colors
+    if ((!ctrl_down && input_key_pressed(KEY_X)) ||
+            (click && hit == HIT_CURRENT))
+    {
+        int aux = app->st.col1;
+        app->st.col1 = app->st.col2;
+        app->st.col2 = aux;
+        state_touch(&app->st);
+    }
 
-        // Save image
-        bool shift_down = IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT);
-        if ((!shift_down && IsKeyPressed(KEY_S)) ||
-                (CheckCollisionPointRec(mpos, layout.buttons[BUTTON_SAVE]) && IsMouseButtonPressed(MOUSE_BUTTON_LEFT)))
+    // Options toggle
+    if (input_key_pressed(KEY_O) ||
+            (click && hit == HIT_BUTTON + BUTTON_OPTIONS))
+    {
+        app->options = !app->options;
+        app->gallery = false;
+        selection_deselect(app);
+    }
+    // Workspace gallery toggle, scrolled to the active document
+    if (input_key_pressed(KEY_W) && app->ws.count > 0)
+    {
+        app->gallery = !app->gallery;
+        app->options = false;
+        app->gallery_row = (app->ws.active + 1) / GALLERY_COLUMNS;
+        selection_deselect(app);
+    }
+    // Grid toggle
+    if (input_key_pressed(KEY_G) ||
+            (click && hit == HIT_BUTTON + BUTTON_GRID))
+    {
+        app->st.grid = !app->st.grid;
+        state_touch(&app->st);
+    }
+    // Undo, the floating cells are dropped first
+    if (input_key_pressed(KEY_Z) ||
+            (click && hit == HIT_BUTTON + BUTTON_UNDO))
+    {
+        floating_drop(app);
+        undostack_undo(&app->st, &app->stack);
+    }
+    if (input_key_pressed(KEY_Y) ||
+            (click && hit == HIT_BUTTON + BUTTON_REDO))
+    {
+        floating_drop(app);
+        undostack_redo(&app->st, &app->stack);
+    }
+    // Paint bucket toggle, it leaves the selection tools
+    if (input_key_pressed(KEY_P) ||
+            (click && hit == HIT_BUTTON + BUTTON_BUCKET))
+    {
+        app->bucket = app->select_tool != SELECT_OFF || !app->bucket;
+        app->select_tool = SELECT_OFF;
+        selection_deselect(app);
+    }
+    // Bucket connectivity toggle
+    if (input_key_pressed(KEY_EIGHT))
+        app->fill_diagonal = !app->fill_diagonal;
+    // Selections: M selects rectangles and Shift + M regions, Ctrl + C, X
+    // and V copy, cut and paste, Enter drops the floating cells and B
+    // toggles whether their cells of the second color are transparent
+    if (input_key_pressed(KEY_M))
+    {
+        enum select_tool tool = shift_down ? SELECT_WAND : SELECT_RECT;
+        app->select_tool = (app->select_tool == tool) ? SELECT_OFF : tool;
+        if (app->select_tool == SELECT_OFF)
+            selection_deselect(app);
+    }
+    if (ctrl_down && (input_key_pressed(KEY_C) || input_key_pressed(KEY_X)))
+    {
+        bool copied = false;
+        if (app->floating.w > 0)
         {
-            image_save(&st, false);
-            state_save(&st);
+            copied = image_copy(&app->floating, &app->clipboard);
+            app->clip_x = app->float_x;
+            app->clip_y = app->float_y;
         }
-        // Save image (big)
-        if ((shift_down && IsKeyPressed(KEY_S)) ||
-                (CheckCollisionPointRec(mpos, layout.buttons[BUTTON_SAVE_BIG]) && IsMouseButtonPressed(MOUSE_BUTTON_LEFT)))
+        else if (app->sel.w > 0)
         {
-            image_save(&st, true);
-            state_save(&st);
+            copied = selection_copy(&app->sel, &app->st, &app->clipboard);
+            app->clip_x = app->sel.x;
+            app->clip_y = app->sel.y;
         }
+        if (copied && input_key_pressed(KEY_X))
+        {
+            // Floating cells were lifted off the canvas already
+            if (app->floating.w == 0)
+                selection_erase(&app->sel, &app->st, app->st.col2);
+            image_free(&app->floating);
+            selection_clear(&app->sel);
+            app->select_changes += 1;
+            undostack_save(&app->st, &app->stack);
+        }
+    }
+    if (ctrl_down && input_key_pressed(KEY_V) && app->clipboard.w > 0)
+    {
+        selection_deselect(app);
+        if (image_copy(&app->clipboard, &app->floating))
+        {
+            // Where it was copied from, on the canvas even if that shrank
+            app->float_x = (app->clip_x < app->st.size) ? app->clip_x : 0;
+            app->float_y = (app->clip_y < app->st.size) ? app->clip_y : 0;
+            app->float_wrap = false;
+            if (app->select_tool == SELECT_OFF)
+                app->select_tool = SELECT_RECT;
+        }
+        app->select_changes += 1;
+    }
+    if (input_key_pressed(KEY_ENTER))
+        selection_deselect(app);
+    if (input_key_pressed(KEY_B))
+        app->float_transparent = !app->float_transparent;
+    // Shift buttons, Shift moves by SHIFT_STEP cells and Ctrl by half the
+    // canvas. With a selection they move its cells instead, wrapping around
+    // the edges like the canvas does.
+    int step = ctrl_down ? app->st.size/2 : shift_down ? SHIFT_STEP : 1;
+    int dx = 0, dy = 0;
+    if (input_key_pressed(KEY_LEFT) ||
+            (click && hit == HIT_BUTTON + BUTTON_LEFT))
+        dx -= step;
+    if (input_key_pressed(KEY_RIGHT) ||
+            (click && hit == HIT_BUTTON + BUTTON_RIGHT))
+        dx += step;
+    if (input_key_pressed(KEY_UP) ||
+            (click && hit == HIT_BUTTON + BUTTON_UP))
+        dy -= step;
+    if (input_key_pressed(KEY_DOWN) ||
+            (click && hit == HIT_BUTTON + BUTTON_DOWN))
+        dy += step;
+    if ((dx != 0 || dy != 0) && (app->floating.w > 0 || selection_lift(app)))
+    {
+        int size = app->st.size;
+        app->float_x = ((app->float_x + dx) % size + size) % size;
+        app->float_y = ((app->float_y + dy) % size + size) % size;
+        app->float_wrap = true;
+    }
+    else if (dx != 0 || dy != 0)
+    {
+        journal_shift(&journal, &app->st, dx, dy);
+        undostack_save(&app->st, &app->stack);
+    }
+    // Flips, rotations (Shift for counterclockwise) and transpose, of the
+    // whole canvas
+    bool flip = input_key_pressed(KEY_H) || (!ctrl_down && input_key_pressed(KEY_V));
+    if (flip || input_key_pressed(KEY_R) || input_key_pressed(KEY_T))
+        floating_drop(app);
+    if (flip)
+    {
+        journal_flip(&journal, &app->st, input_key_pressed(KEY_V));
+        undostack_save(&app->st, &app->stack);
+    }
+    if (input_key_pressed(KEY_R))
+    {
+        journal_rotate(&journal, &app->st, !shift_down);
+        undostack_save(&app->st, &app->stack);
+    }
+    if (input_key_pressed(KEY_T))
+    {
+        journal_transpose(&journal, &app->st);
+        undostack_save(&app->st, &app->stack);
+    }
+    // Animation frames: comma and period go to the previous and next ones,
+    // with Shift they move the current one instead. Other frames have
+    // their own cells, so the undo history starts over in each.
+    int frame = app->st.frames.current;
+    int frame_count = frames_count(&app->st.frames);
+    // A snapshot being saved reads the other frames, they wait for it
+    if (input_key_pressed(KEY_COMMA) || input_key_pressed(KEY_PERIOD) || input_key_pressed(KEY_N) ||
+            input_key_pressed(KEY_D) || input_key_pressed(KEY_DELETE))
+    {
+        floating_drop(app);
+        journal_wait(&journal);
+    }
+    if (input_key_pressed(KEY_COMMA) || input_key_pressed(KEY_PERIOD))
+    {
+        int delta = input_key_pressed(KEY_COMMA) ? -1 : 1;
+        if (shift_down)
+            frames_move(&app->st, delta);
+        else
+            frames_select(&app->st, (frame + delta + frame_count) % frame_count);
+    }
+    if (input_key_pressed(KEY_N) || input_key_pressed(KEY_D))
+        frames_insert(&app->st, input_key_pressed(KEY_D));
+    if (input_key_pressed(KEY_DELETE))
+        frames_delete(&app->st);
+    if (input_key_pressed(KEY_LEFT_BRACKET) || input_key_pressed(KEY_RIGHT_BRACKET))
+    {
+        int delta = (shift_down ? 10 : 1) * DURATION_STEP;
+        int duration = frames_duration(&app->st.frames, frame);
+        frames_set_duration(&app->st, duration + (input_key_pressed(KEY_LEFT_BRACKET) ? -delta : delta));
+    }
+    if (app->st.frames.current != frame || frames_count(&app->st.frames) != frame_count)
+        undostack_reset(&app->st, &app->stack);
+    // Dithering of imported images
+    if (input_key_pressed(KEY_I))
+    {
+        app->dither = (app->dither + 1) % DITHER_COUNT;
+        TraceLog(LOG_INFO, "Import dithering: %s", dither_name(app->dither));
+    }
+    // Profiler HUD toggle, and export of its trace
+    if (input_key_pressed(KEY_F3))
+        app->profiler = !app->profiler;
+    if (input_key_pressed(KEY_F4))
+    {
+        if (profile_export("trace.json"))
+            platform_download("trace.json", "jolly_paint_trace.json");
+        else
+            TraceLog(LOG_WARNING, "Could not export the trace");
+    }
+    // Onion skin toggle
+    if (input_key_pressed(KEY_K))
+    {
+        app->st.frames.onion = !app->st.frames.onion;
+        state_touch(&app->st);
+    }
+
+    // Zoom keys, around the center of the board
+    Vector2 center = {layout->board.x + layout->board.width/2, layout->board.y + layout->board.height/2};
+    if (input_key_pressed(KEY_EQUAL) || input_key_pressed(KEY_KP_ADD))
+        view_zoom_at(&app->view, layout, app->st.size, 2, center);
+    if (input_key_pressed(KEY_MINUS) || input_key_pressed(KEY_KP_SUBTRACT))
+        view_zoom_at(&app->view, layout, app->st.size, 0.5f, center);
+    if (input_key_pressed(KEY_ZERO))
+        app->view = (struct view){0};
+
+    // Save image
+    if ((!shift_down && input_key_pressed(KEY_S)) ||
+            (click && hit == HIT_BUTTON + BUTTON_SAVE))
+    {
+        image_save(&app->exports[0], &app->st, false);
+        autosave_request(&app->autosave, &app->st, platform_time());
+    }
+    // Save image (big)
+    if ((shift_down && input_key_pressed(KEY_S)) ||
+            (click && hit == HIT_BUTTON + BUTTON_SAVE_BIG))
+    {
+        image_save(&app->exports[1], &app->st, true);
+        autosave_request(&app->autosave, &app->st, platform_time());
+    }
+    // Save animation, Shift for big
+    if (input_key_pressed(KEY_A))
+    {
+        animation_save(&app->st, shift_down);
+        autosave_request(&app->autosave, &app->st, platform_time());
+    }
+}
+
+static struct chrome_key chrome_key_get(const struct app *app)
+{
+    struct chrome_key key;
+    memset(&key, 0, sizeof(key)); // Padding is compared too
+    key.width = platform_screen_width();
+    key.height = platform_screen_height();
+    key.size = app->st.size;
+    key.pal = app->st.pal;
+    key.col1 = app->st.col1;
+    key.col2 = app->st.col2;
+    key.palettes = palettes_revision();
+    key.options = app->options;
+    key.grid = app->st.grid;
+    key.bucket = app->bucket;
+    key.fill_diagonal = app->fill_diagonal;
+    key.can_undo = undostack_can_undo(&app->stack);
+    key.can_redo = undostack_can_redo(&app->stack);
+    return key;
+}
+
+// Frames, current colors and buttons, none of them overlap the board.
+static void draw_chrome(const struct app *app, const struct layout *layout)
+{
+    DrawRectangleLinesEx(rect_grow(layout->palette, 1), 1, DARKGRAY);
+
+    { // Draw current colors
+        Rectangle rec1 = {
+                layout->current.x,
+                layout->current.y,
+                layout->current.width * 0.75,
+                layout->current.height * 0.75,
+        };
+        Rectangle rec2 = {
+                layout->current.x + layout->current.width * 0.25,
+                layout->current.y + layout->current.height * 0.25,
+                layout->current.width * 0.75,
+                layout->current.height * 0.75,
+        };
+        DrawRectangleLinesEx(rect_grow(rec2, 1), 1, DARKGRAY);
+        DrawRectangleRec(rect_grow(rec2, -1), get_color(&app->st, app->st.col2));
+        DrawRectangleRec(rec1, BGCOLOR);
+        DrawRectangleLinesEx(rect_grow(rec1, 1), 1, DARKGRAY);
+        DrawRectangleRec(rect_grow(rec1, -1), get_color(&app->st, app->st.col1));
+    }
+
+    // Draw buttons
+    for (int t = 0; t < BUTTON_COUNT; ++t)
+        DrawRectangleLinesEx(rect_grow(layout->buttons[t], 1), 1, DARKGRAY);
+
+    draw_gear(layout->buttons[BUTTON_OPTIONS], BGCOLOR, app->options);
+    draw_grid(layout->buttons[BUTTON_GRID], app->st.grid);
+    draw_backwards_arrow(layout->buttons[BUTTON_UNDO], BGCOLOR,
+            undostack_can_undo(&app->stack), false);
+    draw_backwards_arrow(layout->buttons[BUTTON_REDO], BGCOLOR,
+            undostack_can_redo(&app->stack), true);
+    draw_paint_bucket(layout->buttons[BUTTON_BUCKET], app->bucket);
+    if (app->fill_diagonal)
+    {
+        Rectangle rec = layout->buttons[BUTTON_BUCKET];
+        rec.x += rec.width/2;
+        rec.y += rec.height/2;
+        rec.width /= 2;
+        rec.height /= 2;
+        draw_text_centered(layout, rec, "8", 2);
+    }
+
+    draw_arrow(layout->buttons[BUTTON_RIGHT], 0);
+    draw_arrow(layout->buttons[BUTTON_LEFT], 1);
+    draw_arrow(layout->buttons[BUTTON_UP], 2);
+    draw_arrow(layout->buttons[BUTTON_DOWN], 3);
 
-        // Draw
-        BeginDrawing();
+    draw_save_icon(layout->buttons[BUTTON_SAVE]);
+
+    draw_save_icon(layout->buttons[BUTTON_SAVE_BIG]);
+    Rectangle rec = layout->buttons[BUTTON_SAVE_BIG];
+    rec.height /= 2;
+    rec.y += rec.height;
+    draw_text_centered(layout, rec, "x16", 2);
+}
+
+// Contents of the options overlay, drawn on a transparent layer.
+static void draw_options(const struct app *app, const struct layout *layout)
+{
+    for (int i = 0; i < ARRAY_SIZE(SIZE_OPTIONS); ++i)
+    {
+        Rectangle rec = layout->size_buttons[i];
+        DrawRectangleRec(rec, app->st.size == SIZE_OPTIONS[i] ? YELLOW : BGCOLOR);
+        DrawRectangleLinesEx(rect_grow(rec, 1), 1, DARKGRAY);
+
+        char buffer[20];
+        sprintf(buffer, "%ux%u", SIZE_OPTIONS[i], SIZE_OPTIONS[i]);
+        int font = 3;
+        if (MeasureText(buffer, font*layout->scale) > rec.width - layout->scale)
+            font = 2;
+        draw_text_centered(layout, rec, buffer, font);
+    }
+
+    for (int i = 0; i < palette_count(); ++i)
+    {
+        const struct palette *pal = palette_get(i);
+        Rectangle rec = layout->palette_buttons[i];
+        DrawRectangleRec(rec, app->st.pal == i ? YELLOW : BGCOLOR);
+        DrawText(pal->name, rec.x + 1, rec.y + 1, 2*layout->scale, DARKGRAY);
+        DrawRectangleLinesEx(rect_grow(rec, 1), 1, DARKGRAY);
+
+        // Colors on the right, or under the name on narrow buttons
+        Rectangle swatches = {rec.x + 28*layout->scale, rec.y, 32*layout->scale, rec.height};
+        if (rec.width < 60*layout->scale)
+            swatches = (Rectangle){rec.x, rec.y + rec.height - layout->scale, rec.width, layout->scale};
+        for (int c = 0; c < 16; ++c)
         {
+            float x0 = swatches.x + c*swatches.width/16;
+            float x1 = swatches.x + (c + 1)*swatches.width/16;
+            DrawRectangleRec((Rectangle){x0, swatches.y, x1 - x0, swatches.height}, pal->colors[c]);
+        }
+    }
 
-            ClearBackground(BGCOLOR);
-            
-            DrawRectangleLinesEx(rect_grow(layout.canvas, 1), 1, DARKGRAY);
+    {
+        Rectangle rec = layout->ok_button;
+        DrawRectangleRec(rec, BGCOLOR);
+        draw_text_centered(layout, rec, "OK", 4);
+        DrawRectangleLinesEx(rect_grow(rec, 1), 1, DARKGRAY);
+    }
+}
 
-            DrawRectangleLinesEx(rect_grow(layout.palette, 1), 1, DARKGRAY);
+// Uploads the tiles under source that changed since they were uploaded,
+// the ones out of sight wait until they are shown.
+static void canvas_upload(struct app *app, Rectangle source)
+{
+    int tiles = (app->st.size + TILE_SIZE - 1) / TILE_SIZE;
+    int tx0 = source.x / TILE_SIZE;
+    int ty0 = source.y / TILE_SIZE;
+    int tx1 = ceilf((source.x + source.width) / TILE_SIZE);
+    int ty1 = ceilf((source.y + source.height) / TILE_SIZE);
+    if (tx1 > tiles) tx1 = tiles;
+    if (ty1 > tiles) ty1 = tiles;
+    for (int ty = ty0; ty < ty1; ++ty)
+    {
+        for (int tx = tx0; tx < tx1; ++tx)
+        {
+            if (app->st.tile_revision[ty][tx] <= app->ren.tile_revision[ty][tx])
+                continue;
+            renderer_upload_tile(&app->ren, tx, ty, matrix_tile(&app->st.mat, tx, ty));
+            app->ren.tile_revision[ty][tx] = app->st.tile_revision[ty][tx];
+        }
+    }
+}
 
-            { // Draw current colors
-                Rectangle rec1 = {
-                        layout.current.x,
-                        layout.current.y,
-                        layout.current.width * 0.75,
-                        layout.current.height * 0.75,
-                };
-                Rectangle rec2 = {
-                        layout.current.x + layout.current.width * 0.25,
-                        layout.current.y + layout.current.height * 0.25,
-                        layout.current.width * 0.75,
-                        layout.current.height * 0.75,
-                };
-                DrawRectangleLinesEx(rect_grow(rec2, 1), 1, DARKGRAY);
-                DrawRectangleRec(rect_grow(rec2, -1), get_color(&st, st.col2));
-                DrawRectangleRec(rec1, BGCOLOR);
-                DrawRectangleLinesEx(rect_grow(rec1, 1), 1, DARKGRAY);
-                DrawRectangleRec(rect_grow(rec1, -1), get_color(&st, st.col1));
-            }
+// Uploads the frames before and after the current one, looping around,
+// whenever the timeline changed since they were uploaded.
+static void onion_upload(struct app *app)
+{
+    const struct frames *fr = &app->st.frames;
+    if (app->ren.onion_revision == fr->revision)
+        return;
+    int count = frames_count(fr);
+    int tiles = (app->st.size + TILE_SIZE - 1) / TILE_SIZE;
+    for (int which = 0; which < 2; ++which)
+    {
+        frames_read(&app->st, (fr->current + (which ? 1 : count - 1)) % count, &app->onion_cells);
+        for (int ty = 0; ty < tiles; ++ty)
+        {
+            for (int tx = 0; tx < tiles; ++tx)
+                renderer_upload_onion_tile(&app->ren, which, tx, ty, matrix_tile(&app->onion_cells, tx, ty));
+        }
+    }
+    app->ren.onion_revision = fr->revision;
+}
 
-            // Draw canvas
-            for (int y = 0; y < st.size; ++y)
-            {
-                for (int x = 0; x < st.size; ++x)
-                {
-                    Rectangle r;
-                    r.x = layout.canvas.x + layout.pixel_size * x;
-                    r.y = layout.canvas.y + layout.pixel_size * y;
-                    r.width = layout.pixel_size;
-                    r.height = layout.pixel_size;
+// Uploads the thumbnails that changed since they were uploaded.
+static void gallery_upload(struct app *app)
+{
+    static Color pixels[THUMB_SIZE * THUMB_SIZE];
+    bool all = atlas_reserve(&app->thumbs, app->ws.count, THUMB_SIZE);
+    for (int i = 0; i < app->ws.count; ++i)
+    {
+        struct workspace_doc *doc = &app->ws.docs[i];
+        if (!doc->changed && !all)
+            continue;
+        workspace_thumb_pixels(&app->ws, i, pixels);
+        atlas_upload(&app->thumbs, i, pixels);
+        doc->changed = false;
+    }
+}
 
-                    int col = st.mat.cells[y][x];
+// Thumbnails of the workspace over the board, after a cell for a new
+// document. The active one has a thicker frame.
+static void draw_gallery(const struct app *app, const struct layout *layout)
+{
+    float cell = layout->board.width / GALLERY_COLUMNS;
+    for (int y = 0; y < GALLERY_COLUMNS; ++y)
+    {
+        for (int x = 0; x < GALLERY_COLUMNS; ++x)
+        {
+            int item = (app->gallery_row + y)*GALLERY_COLUMNS + x;
+            if (item > app->ws.count)
+                return;
+            Rectangle rec = {
+                layout->board.x + x*cell + layout->scale,
+                layout->board.y + y*cell + layout->scale,
+                cell - 2*layout->scale,
+                cell - 2*layout->scale,
+            };
+            DrawRectangleRec(rec, BGCOLOR);
+            if (item == 0)
+                draw_text_centered(layout, rec, "+", 6);
+            else
+                atlas_draw(&app->thumbs, item - 1, rec);
+            int line = (item - 1 == app->ws.active) ? 2 : 1;
+            DrawRectangleLinesEx(rect_grow(rec, line), line, DARKGRAY);
+        }
+    }
+}
 
-                    DrawRectangleRec(r, get_color(&st, col));
-                }
-            }
+// Position in the timeline and duration, over the corner of the board.
+static void draw_frame_label(const struct app *app, const struct layout *layout)
+{
+    const struct frames *fr = &app->st.frames;
+    const char *text = TextFormat("%d/%d %dms%s", fr->current + 1, frames_count(fr),
+            frames_duration(fr, fr->current), fr->onion ? " onion" : "");
+    int font_size = 2*layout->scale;
+    Rectangle rec = {
+        layout->board.x,
+        layout->board.y + layout->board.height - font_size - layout->scale,
+        MeasureText(text, font_size) + layout->scale,
+        font_size + layout->scale,
+    };
+    DrawRectangleRec(rec, Fade(BGCOLOR, 0.8));
+    DrawText(text, rec.x + layout->scale/2, rec.y + layout->scale/2, font_size, DARKGRAY);
+}
 
-            // Draw palette
-            for (int c = 0; c < 16; ++c)
+// Remakes the selection's and the floating cells' textures when they
+// changed. Moving the floating cells only moves where theirs is drawn.
+static void selection_upload(struct app *app)
+{
+    const struct selection *sel = &app->sel;
+    if (sel->w > 0 && !sel->rect && app->sel_uploaded != app->select_changes)
+    {
+        // Gray and alpha, opaque white where selected for the tint to color
+        unsigned char *pixels = calloc((size_t)sel->w * sel->h, 2);
+        if (pixels)
+        {
+            for (int y = 0; y < sel->h; ++y)
             {
-                Rectangle r = layout.palette;
-                if (layout.vertical)
-                {
-                    r.width /= 16;
-                    r.x += r.width * c;
-                }
-                else
+                for (int x = 0; x < sel->w; ++x)
                 {
-                    r.height /= 16;
-                    r.y += r.height * c;
+                    if (selection_has(sel, sel->x + x, sel->y + y))
+                        memset(&pixels[2*((size_t)y*sel->w + x)], 0xFF, 2);
                 }
-                DrawRectangleRec(r, get_color(&st, c));
             }
+            sprite_upload(&app->sel_sprite, sel->w, sel->h, PIXELFORMAT_UNCOMPRESSED_GRAY_ALPHA, pixels);
+            free(pixels);
+        }
+    }
+    app->sel_uploaded = app->select_changes;
+
+    const struct image *img = &app->floating;
+    struct floating_key key = {
+        app->select_changes, floating_transparent(app), app->st.pal, palettes_revision()
+    };
+    if (img->w == 0 || memcmp(&key, &app->floating_key, sizeof(key)) == 0)
+        return;
+    app->floating_key = key;
+    size_t n = (size_t)img->w * img->h;
+    unsigned char *cells = malloc(n);
+    unsigned char *rgba = malloc(4 * n);
+    if (cells && rgba)
+    {
+        // Clear where there is no cell or the transparent one
+        for (size_t i = 0; i < n; ++i)
+            cells[i] = (img->cells[i] < 16) ? img->cells[i] : 0;
+        kernel_expand_rgba(cells, n, (const unsigned char *)palette_get(app->st.pal)->colors, rgba);
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (img->cells[i] >= 16 || img->cells[i] == key.transparent)
+                rgba[4*i + 3] = 0;
+        }
+        sprite_upload(&app->floating_sprite, img->w, img->h, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8, rgba);
+    }
+    free(cells);
+    free(rgba);
+}
 
-            // Draw grid
-            if (st.grid)
+// The selection tinted over the canvas and the floating cells on top, with
+// their copies around the edges when they wrap. Canvas is the whole
+// canvas on the screen and dest the part of it shown.
+static void draw_selection(struct app *app, Rectangle canvas, Rectangle dest)
+{
+    if (app->sel.w == 0 && app->floating.w == 0)
+        return;
+    selection_upload(app);
+    float zoom = canvas.width / app->st.size;
+    BeginScissorMode(dest.x, dest.y, dest.width, dest.height);
+    const struct selection *sel = &app->sel;
+    if (sel->w > 0)
+    {
+        Rectangle rec = {canvas.x + sel->x*zoom, canvas.y + sel->y*zoom, sel->w*zoom, sel->h*zoom};
+        if (sel->rect)
+            DrawRectangleRec(rec, Fade(SKYBLUE, 0.3));
+        else
+            sprite_draw(&app->sel_sprite, rec, Fade(SKYBLUE, 0.3));
+        DrawRectangleLinesEx(rec, 1, BLUE);
+    }
+    const struct image *img = &app->floating;
+    if (img->w > 0)
+    {
+        int copies = app->float_wrap ? 2 : 1;
+        for (int j = 0; j < copies; ++j)
+        {
+            for (int i = 0; i < copies; ++i)
             {
-                for (int x = 0; x < st.size; ++x)
-                {
-                    int px = layout.canvas.x + x*layout.pixel_size + 0.4;
-                    DrawLine(px, layout.canvas.y, px, layout.canvas.y + layout.canvas.height, GRAY);
-                }
-                for (int y = 0; y < st.size; ++y)
-                {
-                    int py = layout.canvas.y + y*layout.pixel_size + 0.4;
-                    DrawLine(layout.canvas.x, py, layout.canvas.x + layout.canvas.width, py, GRAY);
-                }
+                Rectangle rec = {
+                    canvas.x + (app->float_x - i*app->st.size)*zoom,
+                    canvas.y + (app->float_y - j*app->st.size)*zoom,
+                    img->w*zoom, img->h*zoom,
+                };
+                sprite_draw(&app->floating_sprite, rec, WHITE);
+                DrawRectangleLinesEx(rec, 1, BLUE);
             }
+        }
+    }
+    EndScissorMode();
+}
 
-            // Draw options
-            if (options)
-            {
-                DrawRectangleRec(rect_grow(layout.board, 1), Fade(RAYWHITE, 0.95));
+static void app_draw(struct app *app, const struct layout *layout)
+{
+    profile_begin(PHASE_DRAW);
+    int width = platform_screen_width();
+    int height = platform_screen_height();
 
-                for (int i = 0; i < ARRAY_SIZE(SIZE_OPTIONS); ++i)
-                {
-                    Rectangle rec = layout.size_buttons[i];
-                    DrawRectangleRec(rec, st.size == SIZE_OPTIONS[i] ? YELLOW : BGCOLOR);
-                    DrawRectangleLinesEx(rect_grow(rec, 1), 1, DARKGRAY);
+    // Rebuild the retained layers only when what they show changed
+    struct chrome_key key = chrome_key_get(app);
+    if (memcmp(&key, &app->chrome_key, sizeof(key)) != 0)
+    {
+        layer_invalidate(&app->chrome);
+        if (key.width != app->chrome_key.width || key.height != app->chrome_key.height
+                || key.size != app->chrome_key.size || key.pal != app->chrome_key.pal
+                || key.palettes != app->chrome_key.palettes)
+            layer_invalidate(&app->overlay);
+        app->chrome_key = key;
+    }
+    if (layer_begin(&app->chrome, width, height, BGCOLOR))
+    {
+        draw_chrome(app, layout);
+        layer_end(&app->chrome);
+    }
+    if (app->options && layer_begin(&app->overlay, width, height, BLANK))
+    {
+        draw_options(app, layout);
+        layer_end(&app->overlay);
+    }
 
-                    char buffer[20];
-                    sprintf(buffer, "%ux%u", SIZE_OPTIONS[i], SIZE_OPTIONS[i]);
-                    draw_text_centered(&layout, rec, buffer, 4);
-                }
+    BeginDrawing();
+    {
+        ClearBackground(BGCOLOR);
+
+        layer_draw(&app->chrome);
+
+        // Draw the visible part of the canvas, with the grid on top
+        Rectangle source, dest;
+        view_visible(&app->view, layout, app->st.size, &source, &dest);
+        renderer_set_palette(&app->ren, palette_get(app->st.pal)->colors);
+        renderer_resize(&app->ren, app->st.size);
+        canvas_upload(app, source);
+        DrawRectangleLinesEx(rect_grow(dest, 1), 1, DARKGRAY);
+        renderer_draw_canvas(&app->ren, source, dest, app->st.grid);
+        int frame_count = frames_count(&app->st.frames);
+        if (app->st.frames.onion && frame_count > 1)
+        {
+            // Two frames are each other's previous and next
+            onion_upload(app);
+            renderer_draw_onion(&app->ren, 0, source, dest);
+            if (frame_count > 2)
+                renderer_draw_onion(&app->ren, 1, source, dest);
+        }
+        draw_selection(app, view_canvas(&app->view, layout, app->st.size), dest);
+        if (frame_count > 1)
+            draw_frame_label(app, layout);
 
-                for (int i = 0; i < ARRAY_SIZE(PALETTES); ++i)
-                {
-                    Rectangle rec = layout.palette_buttons[i];
-                    DrawRectangleRec(rec, st.pal == i ? YELLOW : BGCOLOR);
-                    DrawText(PALETTES[i].name, rec.x + 1, rec.y + 1, 2*layout.scale, DARKGRAY);
-                    DrawRectangleLinesEx(rect_grow(rec, 1), 1, DARKGRAY);
-
-                    for (int c = 0; c < 16; ++c)
-                    {
-                        DrawRectangle(
-                            rec.x + 28*layout.scale + c*2*layout.scale, rec.y,
-                            2*layout.scale, rec.height, GetColor(PALETTES[i].colors[c]));
-                    }
-                }
+        // Draw palette
+        renderer_draw_palette(&app->ren, layout->palette, layout->vertical);
 
-                {
-                    Rectangle rec = layout.ok_button;
-                    DrawRectangleRec(rec, BGCOLOR);
-                    draw_text_centered(&layout, rec, "OK", 4);
-                    DrawRectangleLinesEx(rect_grow(rec, 1), 1, DARKGRAY);
-                }
-            }
+        // Draw options
+        if (app->options)
+        {
+            DrawRectangleRec(rect_grow(layout->board, 1), Fade(RAYWHITE, 0.95));
+            layer_draw(&app->overlay);
+        }
+        if (app->gallery)
+        {
+            DrawRectangleRec(rect_grow(layout->board, 1), Fade(RAYWHITE, 0.95));
+            gallery_upload(app);
+            draw_gallery(app, layout);
+        }
 
-            // Draw buttons
-            for (int t = 0; t < BUTTON_COUNT; ++t)
-                DrawRectangleLinesEx(rect_grow(layout.buttons[t], 1), 1, DARKGRAY);
+        if (app->profiler)
+            profile_draw(0, 0, 2*layout->scale);
+    }
+    profile_end(PHASE_DRAW);
+    profile_begin(PHASE_PRESENT);
+    EndDrawing();
+    profile_end(PHASE_PRESENT);
+    app->drawn_revision = app->st.revision;
+}
 
-            draw_gear(layout.buttons[BUTTON_OPTIONS], BGCOLOR, options);
-            draw_grid(layout.buttons[BUTTON_GRID], st.grid);
-            draw_backwards_arrow(layout.buttons[BUTTON_UNDO], BGCOLOR,
-                    undostack_can_undo(&stack), false);
-            draw_backwards_arrow(layout.buttons[BUTTON_REDO], BGCOLOR,
-                    undostack_can_redo(&stack), true);
-            draw_paint_bucket(layout.buttons[BUTTON_BUCKET], bucket);
+static bool app_frame(void *data)
+{
+    struct app *app = data;
+
+    if (!input_poll())
+        return false; // End of a replay
+    profile_begin(PHASE_FRAME);
+    bool active = input_active();
+    profile_begin(PHASE_LAYOUT);
+    const struct layout *layout = layout_get(&app->layouts);
+    profile_end(PHASE_LAYOUT);
+    profile_begin(PHASE_UPDATE);
+    app_update(app, layout);
+    profile_end(PHASE_UPDATE);
+
+    double now = platform_time();
+    autosave_update(&app->autosave, &app->st, now);
+    // The active document's thumbnail follows its saves, the gallery
+    // remakes the stale ones of the others a frame at a time
+    if (app->ws.count > 0 && app->autosave.saved_revision != app->thumb_revision)
+    {
+        workspace_thumb_update(&app->ws, app->ws.active, &app->st);
+        app->thumb_revision = app->autosave.saved_revision;
+    }
+    if (app->gallery && workspace_thumb_refresh(&app->ws))
+        app->redraw = true;
 
-            draw_arrow(layout.buttons[BUTTON_RIGHT], 0);
-            draw_arrow(layout.buttons[BUTTON_LEFT], 1);
-            draw_arrow(layout.buttons[BUTTON_UP], 2);
-            draw_arrow(layout.buttons[BUTTON_DOWN], 3);
+    if (platform_headless())
+    {
+        profile_end(PHASE_FRAME);
+        return true;
+    }
 
-            draw_save_icon(layout.buttons[BUTTON_SAVE]);
+    // Render on demand, otherwise idle until an event or the autosave is
+    // due. The profiler HUD changes every frame.
+    if (active || app->redraw || app->profiler || IsWindowResized() || app->st.revision != app->drawn_revision)
+    {
+        app_draw(app, layout_get(&app->layouts));
+        app->redraw = false;
+        app->frames_presented += 1;
+        profile_end(PHASE_FRAME);
+    }
+    else
+    {
+        profile_end(PHASE_FRAME);
+        app->frames_skipped += 1;
+        double wait = autosave_wait(&app->autosave, now);
+        platform_wait_events(wait < 0 ? -1 : (int)(1000*wait) + 1);
+    }
+    return true;
+}
 
-            draw_save_icon(layout.buttons[BUTTON_SAVE_BIG]);
-            Rectangle rec = layout.buttons[BUTTON_SAVE_BIG];
-            rec.height /= 2;
-            rec.y += rec.height;
-            draw_text_centered(&layout, rec, "x16", 2);
+// The benchmark includes this file for the code above and has its own main
+#ifndef JOLLY_BENCH
+// FNV-1a of the saved document, equal for states that save the same.
+static unsigned long long state_hash(const struct state *st)
+{
+    int len;
+    unsigned char *document = document_encode(st, &len);
+    if (!document)
+        return 0;
+    unsigned long long hash = 14695981039346656037ULL;
+    for (int i = 0; i < len; ++i)
+        hash = (hash ^ document[i]) * 1099511628211ULL;
+    free(document);
+    return hash;
+}
+
+int main(int argc, char **argv)
+{
+    platform_init(argc, argv);
+    platform_storage_init();
+
+    TraceLog(LOG_INFO, "Cell kernels: %s", kernel_isa());
+
+    // Built-in palettes, then the shipped files and the ones users added
+    palettes_init();
+    palettes_load_dir("palettes");
+    palettes_load_dir(TextFormat("%s/palettes", platform_storage_dir()));
+    TraceLog(LOG_INFO, "Palettes: %d", palette_count());
 
+    // Initialization
+    if (!platform_headless())
+    {
+        InitWindow(400, 400, "Jolly paint");
+        SetWindowState(FLAG_WINDOW_RESIZABLE | FLAG_WINDOW_MAXIMIZED);
+        SetTargetFPS(60); // Only while presenting, idle frames wait for events
+    }
+
+    static struct app app = {.st = {.col1 = 8, .col2 = 3, .size = 24}};
+    if (!platform_headless())
+        renderer_init(&app.ren);
+
+    // A replay starts from the document in its log instead of the user's
+    const char *replay = platform_replay_path();
+    if (replay)
+    {
+        unsigned int flags;
+        snprintf(state_file, sizeof(state_file), "replay.data");
+        if (!input_replay(replay, &app.st, &flags))
+        {
+            TraceLog(LOG_ERROR, "Could not read the input log %s", replay);
+            return 1;
+        }
+        if (app.st.pal >= palette_count())
+            app.st.pal = 0;
+        app.options = flags & INPUT_FLAG_OPTIONS;
+        state_touch_rect(&app.st, 0, 0, MAX_CANVAS_SIZE, MAX_CANVAS_SIZE);
+        journal_reset(&journal, &app.st);
+    }
+    else
+    {
+        workspace_open(&app.ws, platform_storage_dir());
+        snprintf(state_file, sizeof(state_file), "%s", workspace_file(&app.ws, app.ws.active));
+        TraceLog(LOG_INFO, "Documents: %d", app.ws.count);
+        if (!state_load(&app.st))
+        {
+            app.options = true;
+            state_touch_rect(&app.st, 0, 0, MAX_CANVAS_SIZE, MAX_CANVAS_SIZE);
+            journal_reset(&journal, &app.st);
         }
-        EndDrawing();
+        else if (app.ws.docs[app.ws.active].stale)
+            workspace_thumb_update(&app.ws, app.ws.active, &app.st);
+    }
+    autosave_init(&app.autosave, &app.st);
+    app.thumb_revision = app.autosave.saved_revision;
+    undostack_save(&app.st, &app.stack);
+
+    const char *record = platform_record_path();
+    if (record && !input_record(record, &app.st, app.options ? INPUT_FLAG_OPTIONS : 0))
+        TraceLog(LOG_WARNING, "Could not write the input log %s", record);
 
-        frame += 1;
-        if (frame % 60 == 0)
-            state_save(&st);
+    // Main game loop
+    app.redraw = true;
+    platform_main_loop(app_frame, &app);
+    selection_deselect(&app);
+    autosave_flush(&app.autosave, &app.st);
+    if (app.ws.count > 0)
+    {
+        workspace_thumb_update(&app.ws, app.ws.active, &app.st);
+        workspace_close(&app.ws);
+        platform_storage_sync();
     }
+    input_close(state_hash(&app.st));
+    TraceLog(LOG_INFO, "Frames presented: %u, skipped: %u", app.frames_presented, app.frames_skipped);
+    TraceLog(LOG_INFO, "Saves: %u, skipped: %u, latency last %.1f ms, max %.1f ms, mean %.1f ms",
+            app.autosave.saves, app.autosave.skipped, 1000*app.autosave.latency_last,
+            1000*app.autosave.latency_max,
+            app.autosave.saves ? 1000*app.autosave.latency_total/app.autosave.saves : 0.0);
 
     // De-Initialization
-    CloseWindow();        // Close window and OpenGL context
+    journal_free(&journal);
+    png_cache_free(&app.exports[0]);
+    png_cache_free(&app.exports[1]);
+    matrix_free(&app.onion_cells);
+    image_free(&app.clipboard);
+    if (!platform_headless())
+    {
+        renderer_unload(&app.ren);
+        atlas_unload(&app.thumbs);
+        sprite_unload(&app.sel_sprite);
+        sprite_unload(&app.floating_sprite);
+        layer_unload(&app.chrome);
+        layer_unload(&app.overlay);
+        CloseWindow();        // Close window and OpenGL context
+    }
 
     return 0;
 }
+#endif
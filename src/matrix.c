@@ -0,0 +1,146 @@
+#include "matrix.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernels.h"
+
+void matrix_free(struct matrix *mat)
+{
+    if (!mat->tiles)
+        return;
+    for (int i = 0; i < TILES_MAX * TILES_MAX; ++i)
+        free(mat->tiles[i]);
+    free(mat->tiles);
+    mat->tiles = NULL;
+}
+
+struct tile *matrix_tile_alloc(struct matrix *mat, int tx, int ty)
+{
+    if (!mat->tiles)
+    {
+        mat->tiles = calloc(TILES_MAX * TILES_MAX, sizeof(*mat->tiles));
+        if (!mat->tiles)
+            return NULL;
+    }
+    struct tile **t = &mat->tiles[ty * TILES_MAX + tx];
+    if (!*t)
+        *t = calloc(1, sizeof(**t));
+    return *t;
+}
+
+void matrix_copy_tile(struct matrix *dst, const struct matrix *src, int tx, int ty)
+{
+    const struct tile *from = matrix_tile(src, tx, ty);
+    struct tile *to = matrix_tile(dst, tx, ty);
+    if (!from)
+    {
+        if (to)
+            memset(to, 0, sizeof(*to));
+        return;
+    }
+    if (!to)
+        to = matrix_tile_alloc(dst, tx, ty);
+    if (to)
+        *to = *from;
+}
+
+// Cells from x to the end of its tile, at most n.
+static int segment_length(int x, int n)
+{
+    int left = TILE_SIZE - x % TILE_SIZE;
+    return (left < n) ? left : n;
+}
+
+// Unpacks len cells of a tile row from tile_x, which can start or end
+// halfway through a byte.
+static void unpack_segment(const unsigned char *row, int tile_x, int len, unsigned char *cells)
+{
+    int k = 0;
+    if (tile_x & 1)
+        cells[k++] = row[tile_x / 2] & 0xF;
+    int bytes = (len - k) / 2;
+    kernel_unpack(&row[(tile_x + k) / 2], bytes, &cells[k]);
+    k += 2 * bytes;
+    if (k < len)
+        cells[k] = row[(tile_x + k) / 2] >> 4;
+}
+
+static void pack_segment(unsigned char *row, int tile_x, int len, const unsigned char *cells)
+{
+    int k = 0;
+    if (tile_x & 1)
+    {
+        row[tile_x / 2] = (row[tile_x / 2] & 0xF0) | cells[k];
+        k += 1;
+    }
+    int bytes = (len - k) / 2;
+    kernel_pack(&cells[k], bytes, &row[(tile_x + k) / 2]);
+    k += 2 * bytes;
+    if (k < len)
+        row[(tile_x + k) / 2] = (row[(tile_x + k) / 2] & 0x0F) | (cells[k] << 4);
+}
+
+void matrix_read_row(const struct matrix *mat, int x, int y, int n, unsigned char *cells)
+{
+    for (int i = 0; i < n;)
+    {
+        int len = segment_length(x + i, n - i);
+        const struct tile *t = matrix_tile(mat, (x + i) / TILE_SIZE, y / TILE_SIZE);
+        if (t)
+            unpack_segment(t->packed[y % TILE_SIZE], (x + i) % TILE_SIZE, len, &cells[i]);
+        else
+            memset(&cells[i], 0, len);
+        i += len;
+    }
+}
+
+void matrix_write_row(struct matrix *mat, int x, int y, int n, const unsigned char *cells)
+{
+    static const unsigned char zeros[TILE_SIZE];
+    for (int i = 0; i < n;)
+    {
+        int len = segment_length(x + i, n - i);
+        struct tile *t = matrix_tile(mat, (x + i) / TILE_SIZE, y / TILE_SIZE);
+        // Empty tiles stay unallocated while only 0 is written to them
+        if (!t && kernel_mismatch(&cells[i], zeros, len, 0) < len)
+            t = matrix_tile_alloc(mat, (x + i) / TILE_SIZE, y / TILE_SIZE);
+        if (t)
+            pack_segment(t->packed[y % TILE_SIZE], (x + i) % TILE_SIZE, len, &cells[i]);
+        i += len;
+    }
+}
+
+void matrix_fill_row(struct matrix *mat, int x, int y, int n, int c)
+{
+    for (int i = 0; i < n;)
+    {
+        int len = segment_length(x + i, n - i);
+        int tile_x = (x + i) % TILE_SIZE;
+        struct tile *t = matrix_tile(mat, (x + i) / TILE_SIZE, y / TILE_SIZE);
+        if (!t && c != 0)
+            t = matrix_tile_alloc(mat, (x + i) / TILE_SIZE, y / TILE_SIZE);
+        i += len;
+        if (!t)
+            continue;
+
+        unsigned char *row = t->packed[y % TILE_SIZE];
+        if (tile_x & 1)
+        {
+            row[tile_x / 2] = (row[tile_x / 2] & 0xF0) | c;
+            tile_x += 1;
+            len -= 1;
+        }
+        memset(&row[tile_x / 2], c * 0x11, len / 2);
+        if (len & 1)
+            row[(tile_x + len) / 2] = (row[(tile_x + len) / 2] & 0x0F) | (c << 4);
+    }
+}
+
+void matrix_unpack_tile(const struct tile *tile, unsigned char cells[TILE_SIZE * TILE_SIZE])
+{
+    if (tile)
+        kernel_unpack(&tile->packed[0][0], TILE_SIZE * TILE_ROW_BYTES, cells);
+    else
+        memset(cells, 0, TILE_SIZE * TILE_SIZE);
+}
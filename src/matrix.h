@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define MAX_CANVAS_SIZE 4096
+#define TILE_SIZE 32
+#define TILES_MAX (MAX_CANVAS_SIZE / TILE_SIZE) // Tiles along each side
+#define TILE_ROW_BYTES (TILE_SIZE / 2)
+
+// Cells take 4 bits, two per byte with the left one in the high nibble.
+struct tile
+{
+    unsigned char packed[TILE_SIZE][TILE_ROW_BYTES];
+};
+
+// Cells of a MAX_CANVAS_SIZE square canvas, stored by tiles that are only
+// allocated once something is painted on them, missing tiles read as color
+// 0. A zeroed matrix is a valid empty one.
+struct matrix
+{
+    struct tile **tiles; // TILES_MAX x TILES_MAX, row-major
+};
+
+// Frees every tile, leaving an empty matrix.
+void matrix_free(struct matrix *mat);
+
+// Gets the tile, allocating it when missing, NULL if out of memory.
+struct tile *matrix_tile_alloc(struct matrix *mat, int tx, int ty);
+
+// Makes tile (tx, ty) of dst equal to the one of src.
+void matrix_copy_tile(struct matrix *dst, const struct matrix *src, int tx, int ty);
+
+// Row access to n cells from (x, y), one cell per byte, within the canvas.
+void matrix_read_row(const struct matrix *mat, int x, int y, int n, unsigned char *cells);
+void matrix_write_row(struct matrix *mat, int x, int y, int n, const unsigned char *cells);
+void matrix_fill_row(struct matrix *mat, int x, int y, int n, int c);
+
+// Unpacks a tile, NULL for an empty one, to one cell per byte.
+void matrix_unpack_tile(const struct tile *tile, unsigned char cells[TILE_SIZE * TILE_SIZE]);
+
+// Tile (tx, ty) or NULL when it is empty.
+static inline struct tile *matrix_tile(const struct matrix *mat, int tx, int ty)
+{
+    return mat->tiles ? mat->tiles[ty * TILES_MAX + tx] : NULL;
+}
+
+static inline int matrix_get(const struct matrix *mat, int x, int y)
+{
+    const struct tile *t = matrix_tile(mat, x / TILE_SIZE, y / TILE_SIZE);
+    if (!t)
+        return 0;
+    unsigned char b = t->packed[y % TILE_SIZE][(x % TILE_SIZE) / 2];
+    return (x & 1) ? b & 0xF : b >> 4;
+}
+
+static inline void matrix_set(struct matrix *mat, int x, int y, int c)
+{
+    struct tile *t = matrix_tile(mat, x / TILE_SIZE, y / TILE_SIZE);
+    if (!t)
+    {
+        // Empty tiles already hold color 0
+        if (c == 0)
+            return;
+        t = matrix_tile_alloc(mat, x / TILE_SIZE, y / TILE_SIZE);
+        if (!t)
+            return;
+    }
+    unsigned char *b = &t->packed[y % TILE_SIZE][(x % TILE_SIZE) / 2];
+    *b = (x & 1) ? (*b & 0xF0) | c : (*b & 0x0F) | (c << 4);
+}
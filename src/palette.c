@@ -0,0 +1,280 @@
+#include "palette.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "palettes.h"
+
+#define BUILTIN_COUNT ((int)(sizeof(BUILTIN_PALETTES)/sizeof(BUILTIN_PALETTES[0])))
+
+static struct palette palettes[PALETTES_MAX];
+static int count;
+static unsigned int revision;
+
+static bool parse_hex(const char *s, int n, unsigned int *v)
+{
+    *v = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        if (!isxdigit((unsigned char)s[i]))
+            return false;
+        int c = tolower((unsigned char)s[i]);
+        *v = (*v << 4) | (unsigned int)(isdigit(c) ? c - '0' : c - 'a' + 10);
+    }
+    return true;
+}
+
+// Takes the rest of line as the name when it starts with key.
+static bool parse_name(const char *line, int n, const char *key, struct palette *pal)
+{
+    int k = strlen(key);
+    if (n < k || strncasecmp(line, key, k) != 0)
+        return false;
+    line += k;
+    n -= k;
+    while (n > 0 && isspace((unsigned char)*line))
+    {
+        line += 1;
+        n -= 1;
+    }
+    if (n > 0)
+        snprintf(pal->name, sizeof(pal->name), "%.*s", n, line);
+    return true;
+}
+
+// "R G B [name]", in decimal.
+static bool parse_gpl_color(const char *line, Color *color)
+{
+    int r, g, b;
+    if (sscanf(line, "%d %d %d", &r, &g, &b) != 3)
+        return false;
+    if (r < 0 || r > 255 || g < 0 || g > 255 || b < 0 || b > 255)
+        return false;
+    *color = (Color){r, g, b, 255};
+    return true;
+}
+
+// AARRGGBB or RRGGBB, "#" optional, up to the first space.
+static bool parse_hex_color(const char *line, int n, Color *color)
+{
+    if (n > 0 && line[0] == '#')
+    {
+        line += 1;
+        n -= 1;
+    }
+    int len = 0;
+    while (len < n && !isspace((unsigned char)line[len]))
+        len += 1;
+    unsigned int v;
+    if ((len != 8 && len != 6) || !parse_hex(line, len, &v))
+        return false;
+    unsigned int a = (len == 8) ? v >> 24 : 255;
+    *color = (Color){(v >> 16) & 0xFF, (v >> 8) & 0xFF, v & 0xFF, a};
+    return true;
+}
+
+bool palette_parse(const char *text, int len, const char *fallback_name, struct palette *pal)
+{
+    memset(pal, 0, sizeof(*pal));
+    snprintf(pal->name, sizeof(pal->name), "%s", fallback_name);
+
+    const char *p = text;
+    const char *end = text + len;
+    bool gpl = false;
+    int colors = 0;
+    for (int line_no = 0; p < end; ++line_no)
+    {
+        const char *line = p;
+        while (p < end && *p != '\n')
+            p += 1;
+        int n = p - line;
+        if (p < end)
+            p += 1;
+        while (n > 0 && isspace((unsigned char)line[0]))
+        {
+            line += 1;
+            n -= 1;
+        }
+        while (n > 0 && isspace((unsigned char)line[n - 1]))
+            n -= 1;
+        if (n == 0)
+            continue;
+
+        if (line_no == 0 && n >= 12 && memcmp(line, "GIMP Palette", 12) == 0)
+        {
+            gpl = true;
+            continue;
+        }
+        if (parse_name(line, n, ";Palette Name:", pal) || parse_name(line, n, "Name:", pal))
+            continue;
+        if (line[0] == ';' || (gpl && line[0] == '#'))
+            continue;
+        if (colors == 16)
+            continue;
+
+        // Buffer the line, the GPL parser wants it terminated
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "%.*s", n, line);
+        Color color;
+        if (gpl ? parse_gpl_color(buffer, &color) : parse_hex_color(buffer, strlen(buffer), &color))
+            pal->colors[colors++] = color;
+        else if (!gpl)
+            return false; // Other lines, like "Columns: 16", are fine in GPL files only
+    }
+    if (colors == 0)
+        return false;
+    for (int c = colors; c < 16; ++c)
+        pal->colors[c] = (Color){0, 0, 0, 255};
+    return true;
+}
+
+float palette_srgb_to_linear(unsigned char v)
+{
+    float c = v / 255.0f;
+    return (c <= 0.04045f) ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+// Cube root for the OKLab conversion, run for every imported pixel: a
+// first guess from the exponent bits and two Newton steps, within 2e-6.
+static float cube_root(float v)
+{
+    if (v <= 0)
+        return 0;
+    union { float f; unsigned int u; } bits = {v};
+    bits.u = bits.u / 3 + 709921077;
+    float x = bits.f;
+    x = x - (x*x*x - v) / (3*x*x);
+    x = x - (x*x*x - v) / (3*x*x);
+    return x;
+}
+
+Vector3 palette_linear_to_oklab(Vector3 rgb)
+{
+    float l = cube_root(0.4122214708f*rgb.x + 0.5363325363f*rgb.y + 0.0514459929f*rgb.z);
+    float m = cube_root(0.2119034982f*rgb.x + 0.6806995451f*rgb.y + 0.1073969566f*rgb.z);
+    float s = cube_root(0.0883024619f*rgb.x + 0.2817188376f*rgb.y + 0.6299787005f*rgb.z);
+    return (Vector3){
+        0.2104542553f*l + 0.7936177850f*m - 0.0040720468f*s,
+        1.9779984951f*l - 2.4285922050f*m + 0.4505937099f*s,
+        0.0259040371f*l + 0.7827717662f*m - 0.8086757660f*s,
+    };
+}
+
+static float lab_f(float t)
+{
+    const float epsilon = 216.0f / 24389.0f;
+    const float kappa = 24389.0f / 27.0f;
+    return (t > epsilon) ? cbrtf(t) : (kappa * t + 16) / 116;
+}
+
+void palette_compute_tables(struct palette *pal)
+{
+    for (int c = 0; c < 16; ++c)
+    {
+        float r = palette_srgb_to_linear(pal->colors[c].r);
+        float g = palette_srgb_to_linear(pal->colors[c].g);
+        float b = palette_srgb_to_linear(pal->colors[c].b);
+        pal->linear[c] = (Vector3){r, g, b};
+        pal->oklab[c] = palette_linear_to_oklab(pal->linear[c]);
+
+        // To XYZ relative to the D65 white point
+        float x = (0.4124564f*r + 0.3575761f*g + 0.1804375f*b) / 0.95047f;
+        float y = (0.2126729f*r + 0.7151522f*g + 0.0721750f*b);
+        float z = (0.0193339f*r + 0.1191920f*g + 0.9503041f*b) / 1.08883f;
+        float fx = lab_f(x);
+        float fy = lab_f(y);
+        float fz = lab_f(z);
+        pal->lab[c] = (Vector3){116*fy - 16, 500*(fx - fy), 200*(fy - fz)};
+    }
+}
+
+void palettes_init(void)
+{
+    count = 0;
+    for (int i = 0; i < BUILTIN_COUNT && count < PALETTES_MAX; ++i)
+    {
+        struct palette *pal = &palettes[count++];
+        memset(pal, 0, sizeof(*pal));
+        snprintf(pal->name, sizeof(pal->name), "%s", BUILTIN_PALETTES[i].name);
+        for (int c = 0; c < 16; ++c)
+            pal->colors[c] = GetColor(BUILTIN_PALETTES[i].colors[c]);
+        palette_compute_tables(pal);
+    }
+    revision += 1;
+}
+
+int palette_count(void)
+{
+    return count;
+}
+
+const struct palette *palette_get(int i)
+{
+    return &palettes[(i >= 0 && i < count) ? i : 0];
+}
+
+unsigned int palettes_revision(void)
+{
+    return revision;
+}
+
+static int palettes_add(const struct palette *pal)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        if (strcasecmp(palettes[i].name, pal->name) != 0)
+            continue;
+        // Colors and every table made from them, the name stays as it was
+        struct palette replaced = *pal;
+        memcpy(replaced.name, palettes[i].name, sizeof(replaced.name));
+        palettes[i] = replaced;
+        revision += 1;
+        return i;
+    }
+    if (count == PALETTES_MAX)
+        return -1;
+    palettes[count] = *pal;
+    revision += 1;
+    return count++;
+}
+
+int palettes_load_file(const char *path)
+{
+    int len = 0;
+    unsigned char *data = LoadFileData(path, &len);
+    if (!data)
+        return -1;
+    struct palette pal;
+    bool ok = palette_parse((const char *)data, len, GetFileNameWithoutExt(path), &pal);
+    UnloadFileData(data);
+    if (!ok)
+        return -1;
+    palette_compute_tables(&pal);
+    return palettes_add(&pal);
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+int palettes_load_dir(const char *dir)
+{
+    if (!DirectoryExists(dir))
+        return 0;
+    FilePathList files = LoadDirectoryFilesEx(dir, ".txt;.hex;.gpl", false);
+    // In name order, so palettes get the same indices every time
+    qsort(files.paths, files.count, sizeof(files.paths[0]), compare_paths);
+    int loaded = 0;
+    for (unsigned int i = 0; i < files.count; ++i)
+    {
+        if (palettes_load_file(files.paths[i]) >= 0)
+            loaded += 1;
+    }
+    UnloadDirectoryFiles(files);
+    return loaded;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include <raylib.h>
+
+#define PALETTES_MAX 20 // As many as the options screen has room for
+#define PALETTE_NAME_MAX 48
+
+// A palette decoded once, when it is loaded. Everything that needs its
+// colors (rendering, export, color matching) reads these tables.
+struct palette
+{
+    char name[PALETTE_NAME_MAX];
+    Color colors[16];
+    Vector3 linear[16]; // Linear RGB, 0 to 1
+    Vector3 lab[16];    // CIELAB, D65 white
+    Vector3 oklab[16];
+};
+
+// Reads a palette file, telling the format by its contents:
+//
+//   paint.net  ";" comments, then one AARRGGBB hex color per line
+//   hex        one RRGGBB hex color per line, "#" optional
+//   GPL        "GIMP Palette" header, "Name: ..." and "R G B [name]" lines
+//
+// The name comes from a ";Palette Name:" or "Name:" line, or is
+// fallback_name. Palettes with fewer than 16 colors are padded with black,
+// extra colors are ignored.
+bool palette_parse(const char *text, int len, const char *fallback_name, struct palette *pal);
+// Fills the color tables from pal->colors.
+void palette_compute_tables(struct palette *pal);
+
+// Color space conversions the tables are made with.
+float palette_srgb_to_linear(unsigned char v);
+Vector3 palette_linear_to_oklab(Vector3 rgb);
+
+// The loaded palettes: the built-in ones, then the ones added from files.
+// A file with the name of a loaded palette replaces its colors in place,
+// so palette indices in saved documents keep pointing to the same one.
+void palettes_init(void);
+int palette_count(void);
+const struct palette *palette_get(int i);
+// Grows every time a palette is added or changed.
+unsigned int palettes_revision(void);
+
+// Index of the palette added or replaced, -1 if the file isn't one.
+int palettes_load_file(const char *path);
+// Loads every .txt, .hex and .gpl file in dir, returns how many.
+int palettes_load_dir(const char *dir);
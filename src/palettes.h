@@ -1,8 +1,10 @@
-static struct palette
+// Palettes compiled in, always available even without the palettes
+// directory. Colors are 0xRRGGBBAA.
+static const struct builtin_palette
 {
     const char *name;
     unsigned int colors[16];
-} PALETTES[] =
+} BUILTIN_PALETTES[] =
 {
     {
         "Lump 16",
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Parses the command line and prepares the backend, call before anything else.
+void platform_init(int argc, char **argv);
+
+// Input log to write the session to, or to replay instead of reading the
+// user's input, NULL for none (native only).
+const char *platform_record_path(void);
+const char *platform_replay_path(void);
+
+// True when running without a window (native only), drawing must be skipped.
+bool platform_headless(void);
+
+// Size of the drawable area, fixed when headless.
+int platform_screen_width(void);
+int platform_screen_height(void);
+
+// Seconds since an arbitrary point, with sub-millisecond resolution.
+double platform_time(void);
+
+void platform_sleep(int ms);
+
+// Polls input without presenting a frame, waiting up to timeout_ms for
+// something to happen, or until the next event when timeout_ms is negative.
+void platform_wait_events(int timeout_ms);
+
+// Directory for persistent files, mounted by platform_storage_init.
+const char *platform_storage_dir(void);
+void platform_storage_init(void);
+// Blocks until the persistent files are flushed.
+void platform_storage_sync(void);
+// Starts flushing the persistent files without waiting for it.
+void platform_storage_sync_begin(void);
+// True while the flush started by platform_storage_sync_begin runs.
+bool platform_storage_sync_pending(void);
+
+// Maps a whole file read only (mmap on native builds), NULL if it can't be
+// read. Release it with platform_unmap_file.
+const unsigned char *platform_map_file(const char *path, int *len);
+void platform_unmap_file(const unsigned char *data, int len);
+
+// Hands a file written by the program over to the user as filename.
+void platform_download(const char *path, const char *filename);
+
+// Calls frame until the window is closed, or until it returns false.
+void platform_main_loop(bool (*frame)(void *data), void *data);
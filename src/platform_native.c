@@ -0,0 +1,251 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "platform.h"
+
+#include <raylib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static struct
+{
+    bool headless;
+    int frames; // Frame budget when headless
+    int width, height;
+    char storage_dir[1024];
+    const char *record, *replay; // Input logs
+} platform = {
+    .frames = 600,
+    .width = 800,
+    .height = 600,
+};
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [--headless] [--frames N] [--size WxH] [--data DIR]\n"
+            "          [--record FILE | --replay FILE]\n"
+            "  --headless       run the editor without a window\n"
+            "  --frames N       frames to run when headless (default 600, or the\n"
+            "                   whole log when replaying)\n"
+            "  --size WxH       screen size when headless (default 800x600)\n"
+            "  --data DIR       directory for persistent files\n"
+            "  --record FILE    write the input of every frame to FILE\n"
+            "  --replay FILE    replay the input in FILE instead of the user's, from\n"
+            "                   the document it was recorded on\n", name);
+    exit(1);
+}
+
+void platform_init(int argc, char **argv)
+{
+    const char *data = NULL;
+    bool frames = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--headless") == 0)
+            platform.headless = true;
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+        {
+            platform.frames = atoi(argv[++i]);
+            frames = true;
+        }
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+        {
+            if (sscanf(argv[++i], "%dx%d", &platform.width, &platform.height) != 2)
+                usage(argv[0]);
+        }
+        else if (strcmp(argv[i], "--data") == 0 && i + 1 < argc)
+            data = argv[++i];
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+            platform.record = argv[++i];
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+            platform.replay = argv[++i];
+        else
+            usage(argv[0]);
+    }
+    if (platform.record && platform.replay)
+        usage(argv[0]);
+    // A replay runs until its log ends
+    if (platform.replay && !frames)
+        platform.frames = INT_MAX;
+
+    if (data)
+        snprintf(platform.storage_dir, sizeof(platform.storage_dir), "%s", data);
+    else if (getenv("XDG_DATA_HOME"))
+        snprintf(platform.storage_dir, sizeof(platform.storage_dir), "%s/jolly-paint", getenv("XDG_DATA_HOME"));
+    else if (getenv("HOME"))
+        snprintf(platform.storage_dir, sizeof(platform.storage_dir), "%s/.local/share/jolly-paint", getenv("HOME"));
+    else
+        snprintf(platform.storage_dir, sizeof(platform.storage_dir), ".");
+
+    if (platform.headless)
+        SetTraceLogLevel(LOG_WARNING);
+}
+
+const char *platform_record_path(void)
+{
+    return platform.record;
+}
+
+const char *platform_replay_path(void)
+{
+    return platform.replay;
+}
+
+bool platform_headless(void)
+{
+    return platform.headless;
+}
+
+int platform_screen_width(void)
+{
+    return platform.headless ? platform.width : GetScreenWidth();
+}
+
+int platform_screen_height(void)
+{
+    return platform.headless ? platform.height : GetScreenHeight();
+}
+
+double platform_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void platform_sleep(int ms)
+{
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+    nanosleep(&ts, NULL);
+}
+
+// Slices of a timed wait, raylib has no wait on the window events with a
+// timeout, so they are polled this often instead.
+#define IDLE_POLL_MS 4
+
+// Whether the last PollInputEvents saw anything happen. The next one
+// forgets which keys and buttons went down or up, so polling must stop
+// right after.
+static bool input_changed(void)
+{
+    if (IsWindowResized() || IsFileDropped() || WindowShouldClose())
+        return true;
+    Vector2 delta = GetMouseDelta();
+    if (delta.x != 0 || delta.y != 0 || GetMouseWheelMove() != 0)
+        return true;
+    for (int b = MOUSE_BUTTON_LEFT; b <= MOUSE_BUTTON_BACK; ++b)
+    {
+        if (IsMouseButtonPressed(b) || IsMouseButtonReleased(b))
+            return true;
+    }
+    for (int key = KEY_SPACE; key <= KEY_KB_MENU; ++key)
+    {
+        if (IsKeyPressed(key) || IsKeyReleased(key))
+            return true;
+    }
+    return false;
+}
+
+void platform_wait_events(int timeout_ms)
+{
+    if (timeout_ms < 0)
+    {
+        // PollInputEvents blocks on the window events instead of polling
+        EnableEventWaiting();
+        PollInputEvents();
+        DisableEventWaiting();
+        return;
+    }
+    double end = platform_time() + timeout_ms / 1000.0;
+    for (;;)
+    {
+        PollInputEvents();
+        double left = end - platform_time();
+        if (input_changed() || left <= 0)
+            return;
+        platform_sleep((left * 1000 < IDLE_POLL_MS) ? (int)(left * 1000) + 1 : IDLE_POLL_MS);
+    }
+}
+
+const char *platform_storage_dir(void)
+{
+    return platform.storage_dir;
+}
+
+void platform_storage_init(void)
+{
+    if (!DirectoryExists(platform.storage_dir))
+        MakeDirectory(platform.storage_dir);
+}
+
+void platform_storage_sync(void)
+{
+    // Files are written straight to disk.
+}
+
+void platform_storage_sync_begin(void)
+{
+}
+
+bool platform_storage_sync_pending(void)
+{
+    return false;
+}
+
+const unsigned char *platform_map_file(const char *path, int *len)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    void *data = MAP_FAILED;
+    // Empty files can't be mapped, they have nothing to read anyway
+    if (fstat(fd, &st) == 0 && st.st_size > 0 && st.st_size <= 0x7FFFFFFF)
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return NULL;
+    *len = (int)st.st_size;
+    return data;
+}
+
+void platform_unmap_file(const unsigned char *data, int len)
+{
+    munmap((void *)data, len);
+}
+
+void platform_download(const char *path, const char *filename)
+{
+    if (rename(path, filename) != 0)
+        TraceLog(LOG_WARNING, "Could not move %s to %s", path, filename);
+    else
+        TraceLog(LOG_INFO, "Saved %s", filename);
+}
+
+void platform_main_loop(bool (*frame)(void *data), void *data)
+{
+    if (!platform.headless)
+    {
+        while (!WindowShouldClose())
+        {
+            if (!frame(data))
+                break;
+        }
+        return;
+    }
+
+    double start = platform_time();
+    int count = 0;
+    while (count < platform.frames && frame(data))
+        count += 1;
+    double elapsed = platform_time() - start;
+    printf("headless: %d frames in %.3f s (%.3f ms/frame)\n",
+            count, elapsed, count ? 1000.0*elapsed/count : 0.0);
+}
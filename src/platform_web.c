@@ -0,0 +1,133 @@
+#include "platform.h"
+
+#include <raylib.h>
+#include <emscripten.h>
+#include <stddef.h>
+
+void platform_init(int argc, char **argv)
+{
+}
+
+const char *platform_record_path(void)
+{
+    return NULL;
+}
+
+const char *platform_replay_path(void)
+{
+    return NULL;
+}
+
+bool platform_headless(void)
+{
+    return false;
+}
+
+int platform_screen_width(void)
+{
+    return GetScreenWidth();
+}
+
+int platform_screen_height(void)
+{
+    return GetScreenHeight();
+}
+
+double platform_time(void)
+{
+    return emscripten_get_now() / 1000.0;
+}
+
+void platform_sleep(int ms)
+{
+    emscripten_sleep(ms);
+}
+
+// The browser has no blocking wait, sleeping yields to it and its event
+// callbacks update the input state in the meantime.
+#define IDLE_POLL_MS 50
+
+void platform_wait_events(int timeout_ms)
+{
+    PollInputEvents();
+    emscripten_sleep((timeout_ms < 0 || timeout_ms > IDLE_POLL_MS) ? IDLE_POLL_MS : timeout_ms);
+}
+
+const char *platform_storage_dir(void)
+{
+    return "/offline";
+}
+
+void platform_storage_init(void)
+{
+    bool lock = true;
+    EM_ASM({
+        // Make a directory mounted as IndexedDB
+        if (!FS.analyzePath('/offline').exists){
+            FS.mkdir('/offline');
+        }
+        FS.mount(IDBFS, {}, '/offline');
+        FS.syncfs(true, function (err) {
+            Module.setValue($0, false, "i8"); // lock -> false
+        });
+    }, &lock);
+
+    while (lock)
+        emscripten_sleep(1);
+}
+
+// Cleared from the FS.syncfs callback.
+static bool syncing = false;
+
+void platform_storage_sync_begin(void)
+{
+    if (syncing)
+        return;
+    syncing = true;
+    EM_ASM({
+        FS.syncfs(function (err) {
+            Module.setValue($0, false, "i8"); // syncing -> false
+        });
+    }, &syncing);
+}
+
+bool platform_storage_sync_pending(void)
+{
+    return syncing;
+}
+
+void platform_storage_sync(void)
+{
+    // Let a running flush finish, it may have missed the latest writes
+    while (syncing)
+        emscripten_sleep(1);
+    platform_storage_sync_begin();
+    while (syncing)
+        emscripten_sleep(1);
+}
+
+// MEMFS files already live in memory, LoadFileData copies them.
+const unsigned char *platform_map_file(const char *path, int *len)
+{
+    return LoadFileData(path, len);
+}
+
+void platform_unmap_file(const unsigned char *data, int len)
+{
+    UnloadFileData((unsigned char *)data);
+}
+
+void platform_download(const char *path, const char *filename)
+{
+    emscripten_run_script(TextFormat("saveFileFromMemoryFSToDisk('%s','%s')", path, filename));
+}
+
+void platform_main_loop(bool (*frame)(void *data), void *data)
+{
+    // ASYNCIFY lets the loop yield to the browser on every EndDrawing.
+    while (!WindowShouldClose())
+    {
+        if (!frame(data))
+            break;
+    }
+}
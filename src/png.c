@@ -0,0 +1,224 @@
+#include "png.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <raylib.h>
+#include "kernels.h"
+
+#define FILTER_NONE 0
+#define FILTER_UP   2
+
+#define IHDR_SIZE 13
+#define CHUNK_OVERHEAD 12 // Length, tag and CRC
+#define ZLIB_OVERHEAD 6   // Header and Adler-32
+
+static const unsigned char SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+static _Thread_local unsigned int crc_table[256]; // Filled on first use in each thread
+
+static void put_be32(unsigned char *p, unsigned int v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static unsigned int crc32(const unsigned char *p, int n)
+{
+    if (!crc_table[1])
+    {
+        for (unsigned int i = 0; i < 256; ++i)
+        {
+            unsigned int c = i;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            crc_table[i] = c;
+        }
+    }
+    unsigned int c = 0xFFFFFFFF;
+    for (int i = 0; i < n; ++i)
+        c = crc_table[(c ^ p[i]) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFF;
+}
+
+static unsigned int adler32(const unsigned char *p, size_t n)
+{
+    unsigned int a = 1, b = 0;
+    while (n > 0)
+    {
+        // The most bytes before b can overflow
+        size_t k = (n < 5552) ? n : 5552;
+        n -= k;
+        while (k--)
+        {
+            a += *p++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+// Finishes a chunk whose len byte payload is already at p + 8, returns the
+// bytes it takes.
+static int put_chunk(unsigned char *p, const char *tag, int len)
+{
+    put_be32(p, len);
+    memcpy(p + 4, tag, 4);
+    put_be32(p + 8 + len, crc32(p + 4, len + 4));
+    return len + CHUNK_OVERHEAD;
+}
+
+// Filtered image data: a filter byte and the packed pixels for each row.
+// Every cell row is packed once, the rows repeating it are all zeros.
+static unsigned char *scanlines(const struct state *st, int scale, size_t *len)
+{
+    int side = st->size*scale;
+    size_t stride = 1 + (side + 1)/2;
+    if (stride*side > INT_MAX)
+        return NULL;
+    unsigned char *raw = malloc(stride*side);
+    unsigned char *wide = malloc(side + 1);
+    if (!raw || !wide)
+    {
+        free(raw);
+        free(wide);
+        return NULL;
+    }
+
+    wide[side] = 0; // Pads the last byte of odd widths
+    for (int y = 0; y < st->size; ++y)
+    {
+        unsigned char *line = &raw[(size_t)y*scale*stride];
+        matrix_read_row(&st->mat, 0, y, st->size, wide);
+        for (int x = st->size - 1; scale > 1 && x >= 0; --x)
+            memset(&wide[x*scale], wide[x], scale);
+        line[0] = FILTER_NONE;
+        kernel_pack(wide, stride - 1, &line[1]);
+        if (scale > 1)
+            memset(line + stride, 0, (scale - 1)*stride);
+        for (int k = 1; k < scale; ++k)
+            line[k*stride] = FILTER_UP;
+    }
+    free(wide);
+    *len = stride*side;
+    return raw;
+}
+
+unsigned char *png_encode(const struct state *st, const Color colors[16], int scale, int *len)
+{
+    size_t raw_len;
+    unsigned char *raw = scanlines(st, scale, &raw_len);
+    if (!raw)
+        return NULL;
+    int deflated_len = 0;
+    unsigned char *deflated = CompressData(raw, raw_len, &deflated_len);
+    unsigned int adler = adler32(raw, raw_len);
+    free(raw);
+    if (!deflated)
+        return NULL;
+
+    bool opaque = true;
+    for (int c = 0; c < 16; ++c)
+        opaque = opaque && colors[c].a == 255;
+    int idat_len = ZLIB_OVERHEAD + deflated_len;
+    size_t total = sizeof(SIGNATURE) + 4*CHUNK_OVERHEAD + IHDR_SIZE + 3*16 +
+        (opaque ? 0 : CHUNK_OVERHEAD + 16) + idat_len;
+    unsigned char *data = malloc(total);
+    if (!data)
+    {
+        MemFree(deflated);
+        return NULL;
+    }
+
+    unsigned char *p = data;
+    memcpy(p, SIGNATURE, sizeof(SIGNATURE));
+    p += sizeof(SIGNATURE);
+
+    int side = st->size*scale;
+    put_be32(p + 8, side);
+    put_be32(p + 12, side);
+    p[16] = 4; // Bit depth
+    p[17] = 3; // Palette indices
+    p[18] = 0; // Deflate
+    p[19] = 0; // Adaptive filtering
+    p[20] = 0; // Not interlaced
+    p += put_chunk(p, "IHDR", IHDR_SIZE);
+
+    for (int c = 0; c < 16; ++c)
+    {
+        p[8 + 3*c] = colors[c].r;
+        p[8 + 3*c + 1] = colors[c].g;
+        p[8 + 3*c + 2] = colors[c].b;
+    }
+    p += put_chunk(p, "PLTE", 3*16);
+
+    if (!opaque)
+    {
+        for (int c = 0; c < 16; ++c)
+            p[8 + c] = colors[c].a;
+        p += put_chunk(p, "tRNS", 16);
+    }
+
+    // CompressData gives a bare deflate stream, zlib wraps it
+    p[8] = 0x78;
+    p[9] = 0x01;
+    memcpy(p + 10, deflated, deflated_len);
+    put_be32(p + 10 + deflated_len, adler);
+    p += put_chunk(p, "IDAT", idat_len);
+    MemFree(deflated);
+
+    p += put_chunk(p, "IEND", 0);
+    *len = p - data;
+    return data;
+}
+
+// Newest revision of a tile in the canvas, a change to any cell raises it.
+static unsigned int canvas_revision(const struct state *st)
+{
+    int tiles = (st->size + TILE_SIZE - 1)/TILE_SIZE;
+    unsigned int newest = 0;
+    for (int ty = 0; ty < tiles; ++ty)
+    {
+        for (int tx = 0; tx < tiles; ++tx)
+        {
+            if (st->tile_revision[ty][tx] > newest)
+                newest = st->tile_revision[ty][tx];
+        }
+    }
+    return newest;
+}
+
+const unsigned char *png_cache_get(struct png_cache *cache, const struct state *st,
+        const Color colors[16], int scale, int *len)
+{
+    unsigned int revision = canvas_revision(st);
+    if (cache->data && cache->revision == revision && cache->size == st->size &&
+            cache->scale == scale && memcmp(cache->colors, colors, sizeof(cache->colors)) == 0)
+    {
+        *len = cache->len;
+        return cache->data;
+    }
+
+    png_cache_free(cache);
+    cache->data = png_encode(st, colors, scale, &cache->len);
+    if (!cache->data)
+        return NULL;
+    cache->revision = revision;
+    cache->size = st->size;
+    cache->scale = scale;
+    memcpy(cache->colors, colors, sizeof(cache->colors));
+    *len = cache->len;
+    return cache->data;
+}
+
+void png_cache_free(struct png_cache *cache)
+{
+    free(cache->data);
+    cache->data = NULL;
+    cache->len = 0;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include <raylib.h>
+
+#include "state.h"
+
+// Indexed color PNG export: 4 bits per pixel, the 16 palette colors in a
+// PLTE chunk, written straight from the packed cells. Each cell becomes a
+// scale x scale square; repeated rows use the Up filter, which makes them
+// all zeros and nearly free to compress.
+
+// Encodes the canvas with colors into a buffer to release with free, NULL
+// if it does not fit in memory.
+unsigned char *png_encode(const struct state *st, const Color colors[16], int scale, int *len);
+
+// The last encoded image, reused while the cells, colors and scale that
+// made it stay the same. A zeroed cache is empty.
+struct png_cache
+{
+    unsigned char *data;
+    int len;
+    unsigned int revision; // Newest tile revision of the canvas
+    Color colors[16];
+    int size, scale;
+};
+
+// Encoded image of st, from the cache if nothing changed since. Owned by
+// the cache, NULL on failure.
+const unsigned char *png_cache_get(struct png_cache *cache, const struct state *st,
+        const Color colors[16], int scale, int *len);
+void png_cache_free(struct png_cache *cache);
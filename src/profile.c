@@ -0,0 +1,124 @@
+#include "profile.h"
+
+#include <raylib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "platform.h"
+
+#define GRAPH_MS 33.3f // Graph height, two frames at 60 Hz
+
+static const char *const PHASE_NAMES[PHASE_COUNT] = {
+    "frame", "layout", "update", "fill", "draw", "present", "save",
+};
+
+struct event
+{
+    double start; // Seconds, platform_time
+    float duration;
+    unsigned char phase;
+};
+
+static struct
+{
+    double started[PHASE_COUNT];
+    struct event events[PROFILE_EVENTS];
+    int next_event;
+    int event_count;
+    float current[PHASE_COUNT]; // Milliseconds in the frame so far
+    float frames[PROFILE_FRAMES][PHASE_COUNT];
+    int next_frame;
+    int frame_count;
+} profile;
+
+void profile_begin(enum phase phase)
+{
+    profile.started[phase] = platform_time();
+}
+
+void profile_end(enum phase phase)
+{
+    double now = platform_time();
+    struct event *e = &profile.events[profile.next_event];
+    e->start = profile.started[phase];
+    e->duration = now - e->start;
+    e->phase = phase;
+    profile.next_event = (profile.next_event + 1) % PROFILE_EVENTS;
+    if (profile.event_count < PROFILE_EVENTS)
+        profile.event_count += 1;
+
+    profile.current[phase] += 1000 * e->duration;
+    if (phase == PHASE_FRAME)
+    {
+        memcpy(profile.frames[profile.next_frame], profile.current, sizeof(profile.current));
+        memset(profile.current, 0, sizeof(profile.current));
+        profile.next_frame = (profile.next_frame + 1) % PROFILE_FRAMES;
+        if (profile.frame_count < PROFILE_FRAMES)
+            profile.frame_count += 1;
+    }
+}
+
+static int compare_floats(const void *a, const void *b)
+{
+    float fa = *(const float *)a, fb = *(const float *)b;
+    return (fa > fb) - (fa < fb);
+}
+
+void profile_draw(int x, int y, int font_size)
+{
+    static const char *const header = "phase      p50    p95    p99 ms";
+    int n = profile.frame_count;
+    int text_w = MeasureText(header, font_size);
+    int graph_w = PROFILE_FRAMES;
+    int row_h = font_size + font_size/2;
+    int pad = font_size/2;
+    DrawRectangle(x, y, text_w + graph_w + 3*pad, (PHASE_COUNT + 1)*row_h + 2*pad, Fade(BLACK, 0.75f));
+    x += pad;
+    y += pad;
+    DrawText(header, x, y, font_size, WHITE);
+
+    float sorted[PROFILE_FRAMES];
+    for (int p = 0; p < PHASE_COUNT; ++p)
+    {
+        int row = y + (p + 1)*row_h;
+        for (int i = 0; i < n; ++i)
+            sorted[i] = profile.frames[i][p];
+        qsort(sorted, n, sizeof(sorted[0]), compare_floats);
+        float p50 = n ? sorted[n*50/100] : 0;
+        float p95 = n ? sorted[n*95/100] : 0;
+        float p99 = n ? sorted[n*99/100] : 0;
+        DrawText(TextFormat("%-8s %6.2f %6.2f %6.2f", PHASE_NAMES[p], p50, p95, p99), x, row, font_size, WHITE);
+
+        // Oldest frame on the left, red past one frame at 60 Hz
+        int gx = x + text_w + pad;
+        int gh = row_h - 2;
+        DrawRectangle(gx, row, graph_w, gh, Fade(WHITE, 0.1f));
+        for (int i = 0; i < n; ++i)
+        {
+            int f = (profile.next_frame - n + i + PROFILE_FRAMES) % PROFILE_FRAMES;
+            float ms = profile.frames[f][p];
+            int h = (ms >= GRAPH_MS) ? gh : (int)(gh*ms/GRAPH_MS + 0.5f);
+            if (h > 0)
+                DrawRectangle(gx + graph_w - n + i, row + gh - h, 1, h, (ms > 16.7f) ? RED : GREEN);
+        }
+    }
+}
+
+bool profile_export(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return false;
+    int first = (profile.next_event - profile.event_count + PROFILE_EVENTS) % PROFILE_EVENTS;
+    double origin = profile.events[first].start;
+    fprintf(f, "{\"traceEvents\": [");
+    for (int i = 0; i < profile.event_count; ++i)
+    {
+        const struct event *e = &profile.events[(first + i) % PROFILE_EVENTS];
+        fprintf(f, "%s\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, \"ts\": %.1f, \"dur\": %.1f}",
+                i ? "," : "", PHASE_NAMES[e->phase], 1e6*(e->start - origin), 1e6*e->duration);
+    }
+    fprintf(f, "\n], \"displayTimeUnit\": \"ms\"}\n");
+    return fclose(f) == 0;
+}
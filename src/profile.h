@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Frame profiler: scoped timers around the phases of a frame. Every timing
+// goes to a ring of the last PROFILE_EVENTS, for traces, and is added to
+// its phase's total for the frame. The totals of the last PROFILE_FRAMES
+// frames feed the HUD graphs and percentiles.
+
+#define PROFILE_EVENTS 8192
+#define PROFILE_FRAMES 240
+
+enum phase
+{
+    PHASE_FRAME,   // All of a frame but idle waits, around the others
+    PHASE_LAYOUT,
+    PHASE_UPDATE,  // Input, painting and editing
+    PHASE_FILL,    // Within PHASE_UPDATE
+    PHASE_DRAW,
+    PHASE_PRESENT, // Swapping buffers, including any wait for vsync
+    PHASE_SAVE,
+    PHASE_COUNT,
+};
+
+// Timers of a phase can't nest, ending PHASE_FRAME closes the frame.
+void profile_begin(enum phase phase);
+void profile_end(enum phase phase);
+
+// Draws the HUD with its top left corner at (x, y): per phase, its
+// p50/p95/p99 in milliseconds and a graph of the frames.
+void profile_draw(int x, int y, int font_size);
+
+// Writes the events in the ring as Chrome trace event JSON, which
+// chrome://tracing and Perfetto open.
+bool profile_export(const char *path);
@@ -0,0 +1,308 @@
+#include "render.h"
+
+#include <string.h>
+
+#if defined(PLATFORM_WEB)
+// Texture coordinates need high precision where there is any: at half
+// precision they step by about 1/2048 near 1, too coarse to tell the cells
+// of a 4096 canvas apart.
+static const char *CANVAS_FS =
+    "#version 100\n"
+    "#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+    "precision highp float;\n"
+    "#else\n"
+    "precision mediump float;\n"
+    "#endif\n"
+    "varying vec2 fragTexCoord;\n"
+    "varying vec4 fragColor;\n"
+    "uniform sampler2D texture0;\n"
+    "uniform sampler2D palette;\n"
+    "uniform vec2 texSize;\n"
+    "uniform float cellPixels;\n"
+    "uniform float grid;\n"
+    "void main()\n"
+    "{\n"
+    "    float idx = floor(texture2D(texture0, fragTexCoord).r*255.0 + 0.5);\n"
+    "    vec4 col = texture2D(palette, vec2((idx + 0.5)/16.0, 0.5));\n"
+    "    vec2 cell = fract(fragTexCoord*texSize);\n"
+    "    if (grid > 0.5 && min(cell.x, cell.y)*cellPixels < 1.0)\n"
+    "        col = vec4(130.0/255.0, 130.0/255.0, 130.0/255.0, 1.0);\n"
+    "    gl_FragColor = col*fragColor;\n"
+    "}\n";
+#else
+static const char *CANVAS_FS =
+    "#version 330\n"
+    "in vec2 fragTexCoord;\n"
+    "in vec4 fragColor;\n"
+    "out vec4 finalColor;\n"
+    "uniform sampler2D texture0;\n"
+    "uniform sampler2D palette;\n"
+    "uniform vec2 texSize;\n"
+    "uniform float cellPixels;\n"
+    "uniform float grid;\n"
+    "void main()\n"
+    "{\n"
+    "    float idx = floor(texture(texture0, fragTexCoord).r*255.0 + 0.5);\n"
+    "    vec4 col = texture(palette, vec2((idx + 0.5)/16.0, 0.5));\n"
+    "    vec2 cell = fract(fragTexCoord*texSize);\n"
+    "    if (grid > 0.5 && min(cell.x, cell.y)*cellPixels < 1.0)\n"
+    "        col = vec4(130.0/255.0, 130.0/255.0, 130.0/255.0, 1.0);\n"
+    "    finalColor = col*fragColor;\n"
+    "}\n";
+#endif
+
+// Grid lines are only drawn when cells are at least this many pixels wide.
+#define GRID_MIN_PIXELS 4
+
+// Opacity of the previous and next frames over the current one.
+static const float ONION_ALPHA[2] = {0.35f, 0.2f};
+
+void renderer_init(struct renderer *ren)
+{
+    memset(ren, 0, sizeof(*ren));
+
+    ren->shader = LoadShaderFromMemory(NULL, CANVAS_FS);
+    ren->loc_palette = GetShaderLocation(ren->shader, "palette");
+    ren->loc_tex_size = GetShaderLocation(ren->shader, "texSize");
+    ren->loc_cell_pixels = GetShaderLocation(ren->shader, "cellPixels");
+    ren->loc_grid = GetShaderLocation(ren->shader, "grid");
+
+    Image img = GenImageColor(16, 1, BLACK);
+    ren->palette = LoadTextureFromImage(img);
+    UnloadImage(img);
+
+    SetTextureFilter(ren->palette, TEXTURE_FILTER_POINT);
+}
+
+void renderer_unload(struct renderer *ren)
+{
+    if (ren->indices.id != 0)
+        UnloadTexture(ren->indices);
+    for (int i = 0; i < 2; ++i)
+    {
+        if (ren->onion[i].id != 0)
+            UnloadTexture(ren->onion[i]);
+    }
+    UnloadTexture(ren->palette);
+    UnloadShader(ren->shader);
+}
+
+// Index texture of size x size cells, all 0.
+static Texture2D index_texture(int size)
+{
+    Image img = GenImageColor(size, size, BLACK);
+    ImageFormat(&img, PIXELFORMAT_UNCOMPRESSED_GRAYSCALE);
+    Texture2D tex = LoadTextureFromImage(img);
+    UnloadImage(img);
+    SetTextureFilter(tex, TEXTURE_FILTER_POINT);
+    return tex;
+}
+
+void renderer_resize(struct renderer *ren, int size)
+{
+    int tex_size = (size + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE;
+    if (ren->indices.id != 0 && ren->indices.width == tex_size)
+        return;
+    if (ren->indices.id != 0)
+        UnloadTexture(ren->indices);
+    ren->indices = index_texture(tex_size);
+    memset(ren->tile_revision, 0, sizeof(ren->tile_revision));
+
+    for (int i = 0; i < 2; ++i)
+    {
+        if (ren->onion[i].id != 0)
+            UnloadTexture(ren->onion[i]);
+        ren->onion[i] = (Texture2D){0};
+    }
+    ren->onion_revision = 0;
+}
+
+static void upload_tile(Texture2D tex, int tx, int ty, const struct tile *tile)
+{
+    static unsigned char cells[TILE_SIZE * TILE_SIZE];
+    matrix_unpack_tile(tile, cells);
+    Rectangle rec = {tx * TILE_SIZE, ty * TILE_SIZE, TILE_SIZE, TILE_SIZE};
+    UpdateTextureRec(tex, rec, cells);
+}
+
+void renderer_upload_tile(struct renderer *ren, int tx, int ty, const struct tile *tile)
+{
+    upload_tile(ren->indices, tx, ty, tile);
+}
+
+void renderer_upload_onion_tile(struct renderer *ren, int which, int tx, int ty, const struct tile *tile)
+{
+    if (ren->onion[which].id == 0)
+        ren->onion[which] = index_texture(ren->indices.width);
+    upload_tile(ren->onion[which], tx, ty, tile);
+}
+
+void renderer_set_palette(struct renderer *ren, const Color colors[16])
+{
+    if (memcmp(ren->colors, colors, sizeof(ren->colors)) == 0)
+        return;
+    memcpy(ren->colors, colors, sizeof(ren->colors));
+    UpdateTexture(ren->palette, ren->colors);
+}
+
+static void draw_indices(const struct renderer *ren, Texture2D tex, Rectangle source, Rectangle dest,
+        bool grid, Color tint)
+{
+    float tex_size[2] = {tex.width, tex.height};
+    float cell_pixels = dest.width / source.width;
+    float grid_on = grid && cell_pixels >= GRID_MIN_PIXELS;
+
+    BeginShaderMode(ren->shader);
+    SetShaderValueTexture(ren->shader, ren->loc_palette, ren->palette);
+    SetShaderValue(ren->shader, ren->loc_tex_size, tex_size, SHADER_UNIFORM_VEC2);
+    SetShaderValue(ren->shader, ren->loc_cell_pixels, &cell_pixels, SHADER_UNIFORM_FLOAT);
+    SetShaderValue(ren->shader, ren->loc_grid, &grid_on, SHADER_UNIFORM_FLOAT);
+    DrawTexturePro(tex, source, dest, (Vector2){0, 0}, 0, tint);
+    EndShaderMode();
+}
+
+void renderer_draw_canvas(const struct renderer *ren, Rectangle source, Rectangle dest, bool grid)
+{
+    draw_indices(ren, ren->indices, source, dest, grid, WHITE);
+}
+
+void renderer_draw_onion(const struct renderer *ren, int which, Rectangle source, Rectangle dest)
+{
+    if (ren->onion[which].id != 0)
+        draw_indices(ren, ren->onion[which], source, dest, false, Fade(WHITE, ONION_ALPHA[which]));
+}
+
+void renderer_draw_palette(const struct renderer *ren, Rectangle dest, bool vertical)
+{
+    // The palette texture is a 16x1 strip, horizontal layouts stack it vertically.
+    if (vertical)
+        DrawTexturePro(ren->palette, (Rectangle){0, 0, 16, 1}, dest, (Vector2){0, 0}, 0, WHITE);
+    else
+        DrawTexturePro(ren->palette, (Rectangle){0, 0, 16, 1},
+                (Rectangle){dest.x + dest.width, dest.y, dest.height, dest.width},
+                (Vector2){0, 0}, 90, WHITE);
+}
+
+bool layer_begin(struct layer *lay, int width, int height, Color clear)
+{
+    if (lay->target.texture.width != width || lay->target.texture.height != height)
+    {
+        if (lay->target.id != 0)
+            UnloadRenderTexture(lay->target);
+        lay->target = LoadRenderTexture(width, height);
+        lay->valid = false;
+    }
+    if (lay->valid)
+        return false;
+
+    BeginTextureMode(lay->target);
+    ClearBackground(clear);
+    return true;
+}
+
+void layer_end(struct layer *lay)
+{
+    EndTextureMode();
+    lay->valid = true;
+}
+
+void layer_invalidate(struct layer *lay)
+{
+    lay->valid = false;
+}
+
+void layer_draw(const struct layer *lay)
+{
+    // Render textures are stored upside down.
+    Texture2D tex = lay->target.texture;
+    DrawTextureRec(tex, (Rectangle){0, 0, tex.width, -tex.height}, (Vector2){0, 0}, WHITE);
+}
+
+void layer_unload(struct layer *lay)
+{
+    if (lay->target.id != 0)
+        UnloadRenderTexture(lay->target);
+    lay->target = (RenderTexture2D){0};
+    lay->valid = false;
+}
+
+#define ATLAS_WIDTH 1024
+
+bool atlas_reserve(struct atlas *at, int slots, int slot_size)
+{
+    if (at->slots >= slots && at->slot_size == slot_size)
+        return false;
+    // Grows by doubling, so adding images one by one rarely recreates it
+    int columns = ATLAS_WIDTH / slot_size;
+    int rows = at->slots / columns;
+    if (rows < 1 || at->slot_size != slot_size)
+        rows = 1;
+    while (rows*columns < slots)
+        rows *= 2;
+
+    if (at->texture.id != 0)
+        UnloadTexture(at->texture);
+    Image image = GenImageColor(columns*slot_size, rows*slot_size, BLANK);
+    at->texture = LoadTextureFromImage(image);
+    UnloadImage(image);
+    at->slot_size = slot_size;
+    at->columns = columns;
+    at->slots = rows*columns;
+    return true;
+}
+
+void atlas_upload(struct atlas *at, int slot, const Color *pixels)
+{
+    Rectangle rec = {
+        (slot % at->columns) * at->slot_size,
+        (slot / at->columns) * at->slot_size,
+        at->slot_size,
+        at->slot_size,
+    };
+    UpdateTextureRec(at->texture, rec, pixels);
+}
+
+void atlas_draw(const struct atlas *at, int slot, Rectangle dest)
+{
+    Rectangle source = {
+        (slot % at->columns) * at->slot_size,
+        (slot / at->columns) * at->slot_size,
+        at->slot_size,
+        at->slot_size,
+    };
+    DrawTexturePro(at->texture, source, dest, (Vector2){0, 0}, 0, WHITE);
+}
+
+void atlas_unload(struct atlas *at)
+{
+    if (at->texture.id != 0)
+        UnloadTexture(at->texture);
+    *at = (struct atlas){0};
+}
+
+void sprite_upload(struct sprite *sp, int width, int height, int format, const void *pixels)
+{
+    Texture2D *tex = &sp->texture;
+    if (tex->id != 0 && tex->width == width && tex->height == height && tex->format == format)
+    {
+        UpdateTexture(*tex, pixels);
+        return;
+    }
+    if (tex->id != 0)
+        UnloadTexture(*tex);
+    Image image = {(void *)pixels, width, height, 1, format};
+    *tex = LoadTextureFromImage(image);
+}
+
+void sprite_draw(const struct sprite *sp, Rectangle dest, Color tint)
+{
+    Texture2D tex = sp->texture;
+    DrawTexturePro(tex, (Rectangle){0, 0, tex.width, tex.height}, dest, (Vector2){0, 0}, 0, tint);
+}
+
+void sprite_unload(struct sprite *sp)
+{
+    if (sp->texture.id != 0)
+        UnloadTexture(sp->texture);
+    *sp = (struct sprite){0};
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <raylib.h>
+
+#include "matrix.h"
+
+// Draws the canvas as a single quad: the cells live in an index texture that
+// a fragment shader expands through a 16 entry palette texture.
+struct renderer
+{
+    Shader shader;
+    Texture2D indices; // Canvas size rounded up to whole tiles
+    Texture2D palette;
+    int loc_palette;
+    int loc_tex_size;
+    int loc_cell_pixels;
+    int loc_grid;
+    Color colors[16]; // Colors currently in the palette texture
+    // State revision of each tile as last uploaded, kept by the caller
+    unsigned int tile_revision[TILES_MAX][TILES_MAX];
+    // Previous and next animation frames, made when first uploaded
+    Texture2D onion[2];
+    unsigned int onion_revision; // Frames revision they show, kept by the caller
+};
+
+void renderer_init(struct renderer *ren);
+void renderer_unload(struct renderer *ren);
+
+// Makes room for a size x size canvas, clearing the textures and the
+// revisions if they have to be recreated.
+void renderer_resize(struct renderer *ren, int size);
+// Uploads a tile of the canvas, NULL for an empty one.
+void renderer_upload_tile(struct renderer *ren, int tx, int ty, const struct tile *tile);
+// Same for onion skin frame which, 0 the previous one and 1 the next one.
+void renderer_upload_onion_tile(struct renderer *ren, int which, int tx, int ty, const struct tile *tile);
+// Only touches the GPU when the colors differ from the current ones.
+void renderer_set_palette(struct renderer *ren, const Color colors[16]);
+
+// Draws the cells in source, a rectangle in cells, over dest.
+void renderer_draw_canvas(const struct renderer *ren, Rectangle source, Rectangle dest, bool grid);
+// Draws onion skin frame which faded over the canvas.
+void renderer_draw_onion(const struct renderer *ren, int which, Rectangle source, Rectangle dest);
+void renderer_draw_palette(const struct renderer *ren, Rectangle dest, bool vertical);
+
+// Retained drawing kept in a screen sized render texture.
+struct layer
+{
+    RenderTexture2D target;
+    bool valid;
+};
+
+// Returns true, with the texture bound and cleared, when the layer has to be
+// redrawn; finish with layer_end. Returns false when the cached one is fine.
+bool layer_begin(struct layer *lay, int width, int height, Color clear);
+void layer_end(struct layer *lay);
+void layer_invalidate(struct layer *lay);
+void layer_draw(const struct layer *lay);
+void layer_unload(struct layer *lay);
+
+// Square images of the same size in one texture, like document thumbnails,
+// each drawn from its slot.
+struct atlas
+{
+    Texture2D texture;
+    int slot_size;
+    int columns, slots;
+};
+
+// Makes room for at least slots images of slot_size pixels. Returns true
+// when the texture was recreated, every slot has to be uploaded again.
+bool atlas_reserve(struct atlas *at, int slots, int slot_size);
+void atlas_upload(struct atlas *at, int slot, const Color *pixels);
+void atlas_draw(const struct atlas *at, int slot, Rectangle dest);
+void atlas_unload(struct atlas *at);
+
+// One image in its own texture, like a selection shown over the canvas.
+struct sprite
+{
+    Texture2D texture;
+};
+
+// Replaces the image, pixels in one of raylib's pixel formats. The texture
+// is only made again when the size or format changes.
+void sprite_upload(struct sprite *sp, int width, int height, int format, const void *pixels);
+void sprite_draw(const struct sprite *sp, Rectangle dest, Color tint);
+void sprite_unload(struct sprite *sp);
@@ -0,0 +1,287 @@
+#include "select.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernels.h"
+
+// Seeds of the wand, kept between uses like the fill's.
+static struct seed
+{
+    short x, y;
+} *stack;
+static int stack_cap;
+
+// Canvas rows on their way through a blit.
+static unsigned char row[MAX_CANVAS_SIZE];
+
+static bool stack_push(int *len, int x, int y)
+{
+    if (*len == stack_cap)
+    {
+        int cap = stack_cap ? 2 * stack_cap : 1024;
+        struct seed *grown = realloc(stack, cap * sizeof(*stack));
+        if (!grown)
+            return false;
+        stack = grown;
+        stack_cap = cap;
+    }
+    stack[*len].x = x;
+    stack[*len].y = y;
+    *len += 1;
+    return true;
+}
+
+static bool bit_get(const unsigned char *bits, int stride, int x, int y)
+{
+    return bits[y * stride + x / 8] & (1 << (x % 8));
+}
+
+static void bit_set(unsigned char *bits, int stride, int x, int y)
+{
+    bits[y * stride + x / 8] |= 1 << (x % 8);
+}
+
+void selection_clear(struct selection *sel)
+{
+    free(sel->bits);
+    memset(sel, 0, sizeof(*sel));
+}
+
+// Makes room for a w x h selection at (x, y) with no cell selected yet.
+static bool selection_alloc(struct selection *sel, int x, int y, int w, int h)
+{
+    selection_clear(sel);
+    int stride = (w + 7) / 8;
+    sel->bits = calloc((size_t)stride * h, 1);
+    if (!sel->bits)
+        return false;
+    sel->x = x;
+    sel->y = y;
+    sel->w = w;
+    sel->h = h;
+    sel->stride = stride;
+    return true;
+}
+
+bool selection_rect(struct selection *sel, int x0, int y0, int x1, int y1)
+{
+    if (x1 <= x0 || y1 <= y0)
+    {
+        selection_clear(sel);
+        return true;
+    }
+    if (!selection_alloc(sel, x0, y0, x1 - x0, y1 - y0))
+        return false;
+    memset(sel->bits, 0xFF, (size_t)sel->stride * sel->h);
+    sel->rect = true;
+    return true;
+}
+
+bool selection_wand(struct selection *sel, const struct state *st, int x, int y, bool diagonal)
+{
+    selection_clear(sel);
+    int size = st->size;
+    if (x < 0 || y < 0 || x >= size || y >= size)
+        return false;
+
+    // Spans of the region like flood_fill's, marked in a canvas sized mask
+    int stride = (size + 7) / 8;
+    unsigned char *seen = calloc((size_t)stride * size, 1);
+    if (!seen)
+        return false;
+    const struct matrix *mat = &st->mat;
+    int target = matrix_get(mat, x, y);
+    int x_min = x, x_max = x;
+    int y_min = y, y_max = y;
+    int len = 0;
+    stack_push(&len, x, y);
+    while (len > 0)
+    {
+        len -= 1;
+        x = stack[len].x;
+        y = stack[len].y;
+        if (bit_get(seen, stride, x, y))
+            continue;
+
+        int left = x, right = x;
+        while (left > 0 && !bit_get(seen, stride, left - 1, y) && matrix_get(mat, left - 1, y) == target)
+            left -= 1;
+        while (right < size - 1 && !bit_get(seen, stride, right + 1, y) && matrix_get(mat, right + 1, y) == target)
+            right += 1;
+        for (int i = left; i <= right; ++i)
+            bit_set(seen, stride, i, y);
+        if (left < x_min) x_min = left;
+        if (right > x_max) x_max = right;
+        if (y < y_min) y_min = y;
+        if (y > y_max) y_max = y;
+
+        if (diagonal)
+        {
+            if (left > 0) left -= 1;
+            if (right < size - 1) right += 1;
+        }
+        for (int ny = y - 1; ny <= y + 1; ny += 2)
+        {
+            if (ny < 0 || ny >= size)
+                continue;
+            bool in_run = false;
+            for (int nx = left; nx <= right; ++nx)
+            {
+                if (bit_get(seen, stride, nx, ny) || matrix_get(mat, nx, ny) != target)
+                {
+                    in_run = false;
+                }
+                else if (!in_run)
+                {
+                    in_run = true;
+                    if (!stack_push(&len, nx, ny))
+                        break; // Out of memory, the region stops short
+                }
+            }
+        }
+    }
+
+    // Cropped to the region
+    bool ok = selection_alloc(sel, x_min, y_min, x_max - x_min + 1, y_max - y_min + 1);
+    for (int sy = 0; ok && sy < sel->h; ++sy)
+    {
+        for (int sx = 0; sx < sel->w; ++sx)
+        {
+            if (bit_get(seen, stride, x_min + sx, y_min + sy))
+                bit_set(sel->bits, sel->stride, sx, sy);
+        }
+    }
+    free(seen);
+    return ok;
+}
+
+bool selection_has(const struct selection *sel, int x, int y)
+{
+    x -= sel->x;
+    y -= sel->y;
+    if (x < 0 || y < 0 || x >= sel->w || y >= sel->h)
+        return false;
+    return bit_get(sel->bits, sel->stride, x, y);
+}
+
+bool selection_copy(const struct selection *sel, const struct state *st, struct image *out)
+{
+    image_free(out);
+    out->cells = malloc((size_t)sel->w * sel->h);
+    if (!out->cells)
+        return false;
+    out->w = sel->w;
+    out->h = sel->h;
+    for (int y = 0; y < sel->h; ++y)
+    {
+        unsigned char *cells = &out->cells[(size_t)y * sel->w];
+        matrix_read_row(&st->mat, sel->x, sel->y + y, sel->w, cells);
+        const unsigned char *bits = &sel->bits[y * sel->stride];
+        for (int x = 0; x < sel->w; x += 8)
+        {
+            // Whole bytes of selected cells are the common case
+            if (bits[x / 8] == 0xFF && x + 8 <= sel->w)
+                continue;
+            for (int k = x; k < x + 8 && k < sel->w; ++k)
+            {
+                if (!(bits[x / 8] & (1 << (k % 8))))
+                    cells[k] = SELECT_NONE;
+            }
+        }
+    }
+    return true;
+}
+
+void selection_erase(const struct selection *sel, struct state *st, int color)
+{
+    if (sel->w == 0)
+        return;
+    // By runs of selected cells along each row, whole rows for rectangles
+    for (int y = 0; y < sel->h; ++y)
+    {
+        if (sel->rect)
+        {
+            matrix_fill_row(&st->mat, sel->x, sel->y + y, sel->w, color);
+            continue;
+        }
+        int x = 0;
+        while (x < sel->w)
+        {
+            while (x < sel->w && !bit_get(sel->bits, sel->stride, x, y))
+                x += 1;
+            int start = x;
+            while (x < sel->w && bit_get(sel->bits, sel->stride, x, y))
+                x += 1;
+            if (x > start)
+                matrix_fill_row(&st->mat, sel->x + start, sel->y + y, x - start, color);
+        }
+    }
+    state_touch_rect(st, sel->x, sel->y, sel->x + sel->w, sel->y + sel->h);
+}
+
+bool image_copy(const struct image *src, struct image *out)
+{
+    image_free(out);
+    out->cells = malloc((size_t)src->w * src->h);
+    if (!out->cells)
+        return false;
+    memcpy(out->cells, src->cells, (size_t)src->w * src->h);
+    out->w = src->w;
+    out->h = src->h;
+    return true;
+}
+
+void image_free(struct image *img)
+{
+    free(img->cells);
+    memset(img, 0, sizeof(*img));
+}
+
+// Splits n cells from x along a side of the canvas into the pieces inside
+// it: up to two when wrapping around, one or none when clipping. Each
+// piece starts at start on the canvas and at offset in the image.
+static int split(int x, int n, int size, bool wrap, int start[2], int offset[2], int len[2])
+{
+    if (wrap)
+    {
+        if (n > size)
+            n = size;
+        start[0] = (x % size + size) % size;
+        offset[0] = 0;
+        len[0] = (n < size - start[0]) ? n : size - start[0];
+        if (len[0] == n)
+            return 1;
+        start[1] = 0;
+        offset[1] = len[0];
+        len[1] = n - len[0];
+        return 2;
+    }
+    int skip = (x < 0) ? -x : 0;
+    start[0] = x + skip;
+    offset[0] = skip;
+    len[0] = (n - skip < size - start[0]) ? n - skip : size - start[0];
+    return (len[0] > 0) ? 1 : 0;
+}
+
+void image_blit(struct state *st, const struct image *img, int x, int y, int transparent, bool wrap)
+{
+    int xs[2], xo[2], xl[2];
+    int ys[2], yo[2], yl[2];
+    int nx = split(x, img->w, st->size, wrap, xs, xo, xl);
+    int ny = split(y, img->h, st->size, wrap, ys, yo, yl);
+    for (int j = 0; j < ny; ++j)
+    {
+        for (int i = 0; i < nx; ++i)
+        {
+            for (int r = 0; r < yl[j]; ++r)
+            {
+                const unsigned char *src = &img->cells[(size_t)(yo[j] + r) * img->w + xo[i]];
+                matrix_read_row(&st->mat, xs[i], ys[j] + r, xl[i], row);
+                kernel_blit(row, src, xl[i], transparent);
+                matrix_write_row(&st->mat, xs[i], ys[j] + r, xl[i], row);
+            }
+            state_touch_rect(st, xs[i], ys[j], xs[i] + xl[i], ys[j] + yl[j]);
+        }
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "state.h"
+
+// Images hold this where there is no cell, outside of the selection they
+// were copied from. Cells are below 16.
+#define SELECT_NONE 0xFF
+
+// Cells of the canvas picked to copy or move: a rectangle around them with
+// one bit per cell, rows padded to whole bytes and the first cell of each
+// byte in its low bit.
+struct selection
+{
+    int x, y, w, h; // Bounding rectangle on the canvas, w is 0 when empty
+    int stride;     // Bytes per row of bits
+    unsigned char *bits;
+    bool rect;      // Every cell of the rectangle is selected
+};
+
+// Cells of a rectangle, one per byte, like the clipboard or a selection
+// floating over the canvas while it is moved.
+struct image
+{
+    int w, h;
+    unsigned char *cells;
+};
+
+void selection_clear(struct selection *sel);
+// Selects the cells in [x0, x1) x [y0, y1), false if out of memory.
+bool selection_rect(struct selection *sel, int x0, int y0, int x1, int y1);
+// Selects the region of (x, y): the cells of its color it connects to, like
+// a fill would. False if out of memory or outside the canvas.
+bool selection_wand(struct selection *sel, const struct state *st, int x, int y, bool diagonal);
+bool selection_has(const struct selection *sel, int x, int y);
+
+// Copies the selected cells, SELECT_NONE in the others, false if out of
+// memory.
+bool selection_copy(const struct selection *sel, const struct state *st, struct image *out);
+// Paints the selected cells with color.
+void selection_erase(const struct selection *sel, struct state *st, int color);
+
+bool image_copy(const struct image *src, struct image *out);
+void image_free(struct image *img);
+// Draws the cells of img with its top left at (x, y), but for the
+// transparent color (-1 for none). Cells past the edges of the canvas come
+// in through the other side when wrapping, or are left out.
+void image_blit(struct state *st, const struct image *img, int x, int y, int transparent, bool wrap);
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "frames.h"
+#include "matrix.h"
+
+struct state
+{
+    struct matrix mat; // Cells of the current frame
+    struct frames frames;
+    int size;
+    int pal; // Current palette
+    int col1, col2;
+    bool grid;
+
+    // Change tracking, not persisted. The revision grows with every change
+    // and each tile remembers the revision of its last change, so consumers
+    // (undo, texture upload, autosave) can tell what changed since they
+    // last looked by keeping the revision they saw.
+    unsigned int revision;
+    unsigned int tile_revision[TILES_MAX][TILES_MAX];
+};
+
+// Records a change that is not in the cells, like the palette or colors.
+static inline void state_touch(struct state *st)
+{
+    st->revision += 1;
+}
+
+// Records a change to the cells in [x0, x1) x [y0, y1).
+static inline unsigned int state_touch_rect(struct state *st, int x0, int y0, int x1, int y1)
+{
+    st->revision += 1;
+    for (int ty = y0 / TILE_SIZE; ty * TILE_SIZE < y1; ++ty)
+    {
+        for (int tx = x0 / TILE_SIZE; tx * TILE_SIZE < x1; ++tx)
+            st->tile_revision[ty][tx] = st->revision;
+    }
+    return st->revision;
+}
+
+// Records a change to the cells of tile (tx, ty).
+static inline void state_touch_tile(struct state *st, int tx, int ty)
+{
+    st->revision += 1;
+    st->tile_revision[ty][tx] = st->revision;
+}
+
+static inline int state_get(const struct state *st, int x, int y)
+{
+    return matrix_get(&st->mat, x, y);
+}
+
+static inline void state_set(struct state *st, int x, int y, int c)
+{
+    if (matrix_get(&st->mat, x, y) == c)
+        return;
+    matrix_set(&st->mat, x, y, c);
+    st->revision += 1;
+    st->tile_revision[y / TILE_SIZE][x / TILE_SIZE] = st->revision;
+}
@@ -0,0 +1,50 @@
+#include "stroke.h"
+
+#include <stdlib.h>
+
+void stroke_begin(struct stroke *stroke)
+{
+    stroke->active = true;
+    stroke->started = false;
+}
+
+int stroke_to(struct stroke *stroke, int x, int y, struct point *out)
+{
+    if (!stroke->started)
+    {
+        stroke->started = true;
+        stroke->x = x;
+        stroke->y = y;
+        out[0] = (struct point){x, y};
+        return 1;
+    }
+
+    // Bresenham, stepping from the last cell
+    int cx = stroke->x;
+    int cy = stroke->y;
+    int dx = abs(x - cx);
+    int dy = -abs(y - cy);
+    int sx = (cx < x) ? 1 : -1;
+    int sy = (cy < y) ? 1 : -1;
+    int err = dx + dy;
+    int len = 0;
+    while (cx != x || cy != y)
+    {
+        int e2 = 2 * err;
+        if (e2 >= dy)
+        {
+            err += dy;
+            cx += sx;
+        }
+        if (e2 <= dx)
+        {
+            err += dx;
+            cy += sy;
+        }
+        out[len++] = (struct point){cx, cy};
+    }
+
+    stroke->x = x;
+    stroke->y = y;
+    return len;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "state.h"
+
+// Most cells stroke_to can emit at once, a line across the whole canvas.
+#define STROKE_MAX_CELLS MAX_CANVAS_SIZE
+
+struct point
+{
+    int x, y;
+};
+
+// A brush stroke of one mouse button, from the press to the release.
+struct stroke
+{
+    bool active;  // Button went down on the canvas and is still held
+    bool started; // A cell was painted already
+    int x, y;     // Last painted cell
+};
+
+// Starts a stroke, the next stroke_to paints only its own cell.
+void stroke_begin(struct stroke *stroke);
+
+// Writes to out the cells of the line from the last painted cell to (x, y),
+// without the last painted one, and returns how many there are. Lines are
+// 8-connected, so each cell of a segment is visited exactly once.
+int stroke_to(struct stroke *stroke, int x, int y, struct point *out);
@@ -0,0 +1,135 @@
+#include "transform.h"
+
+#include <string.h>
+
+// Transposes go by square blocks of this many cells, a pair of them is in
+// the buffers at once.
+#define BLOCK_SIZE TILE_SIZE
+
+static unsigned char saved[MAX_CANVAS_SIZE];
+static unsigned char line[MAX_CANVAS_SIZE];
+static unsigned char moved[MAX_CANVAS_SIZE];
+static unsigned char block_a[BLOCK_SIZE][BLOCK_SIZE];
+static unsigned char block_b[BLOCK_SIZE][BLOCK_SIZE];
+
+// Rotates the n cells of in right by d into out.
+static void rotate_line(const unsigned char *in, int n, int d, unsigned char *out)
+{
+    memcpy(&out[d], in, n - d);
+    memcpy(out, &in[n - d], d);
+}
+
+static void shift_cells(struct matrix *mat, int size, int dx, int dy)
+{
+    dx = (dx % size + size) % size;
+    dy = (dy % size + size) % size;
+
+    // Each row takes the one dy rows above, rotated by dx. Rows move in
+    // cycles, the first row of each one is kept aside until its end.
+    int done = 0;
+    for (int start = 0; done < size; ++start)
+    {
+        matrix_read_row(mat, 0, start, size, saved);
+        int y = start;
+        for (int from = (y - dy + size) % size; from != start; from = (y - dy + size) % size)
+        {
+            matrix_read_row(mat, 0, from, size, line);
+            rotate_line(line, size, dx, moved);
+            matrix_write_row(mat, 0, y, size, moved);
+            y = from;
+            done += 1;
+        }
+        rotate_line(saved, size, dx, moved);
+        matrix_write_row(mat, 0, y, size, moved);
+        done += 1;
+    }
+}
+
+static void flip_cells(struct matrix *mat, int size, bool vertical)
+{
+    if (vertical)
+    {
+        for (int y = 0; y < size/2; ++y)
+        {
+            matrix_read_row(mat, 0, y, size, line);
+            matrix_read_row(mat, 0, size - 1 - y, size, moved);
+            matrix_write_row(mat, 0, y, size, moved);
+            matrix_write_row(mat, 0, size - 1 - y, size, line);
+        }
+        return;
+    }
+    for (int y = 0; y < size; ++y)
+    {
+        matrix_read_row(mat, 0, y, size, line);
+        for (int x = 0; x < size; ++x)
+            moved[x] = line[size - 1 - x];
+        matrix_write_row(mat, 0, y, size, moved);
+    }
+}
+
+static void read_block(const struct matrix *mat, int x0, int y0, int w, int h,
+        unsigned char block[BLOCK_SIZE][BLOCK_SIZE])
+{
+    for (int y = 0; y < h; ++y)
+        matrix_read_row(mat, x0, y0 + y, w, block[y]);
+}
+
+// Writes the transpose of the w x h block read at (y0, x0) to (x0, y0).
+static void write_block_transposed(struct matrix *mat, int x0, int y0, int w, int h,
+        unsigned char block[BLOCK_SIZE][BLOCK_SIZE])
+{
+    unsigned char row[BLOCK_SIZE];
+    for (int y = 0; y < w; ++y)
+    {
+        for (int x = 0; x < h; ++x)
+            row[x] = block[x][y];
+        matrix_write_row(mat, x0, y0 + y, h, row);
+    }
+}
+
+// Swaps each block above the diagonal with its mirror below, both
+// transposed, so every cell is read and written once.
+static void transpose_cells(struct matrix *mat, int size)
+{
+    for (int by = 0; by < size; by += BLOCK_SIZE)
+    {
+        int h = (size - by < BLOCK_SIZE) ? size - by : BLOCK_SIZE;
+        for (int bx = by; bx < size; bx += BLOCK_SIZE)
+        {
+            int w = (size - bx < BLOCK_SIZE) ? size - bx : BLOCK_SIZE;
+            read_block(mat, bx, by, w, h, block_a);
+            if (bx != by)
+            {
+                read_block(mat, by, bx, h, w, block_b);
+                write_block_transposed(mat, bx, by, h, w, block_b);
+            }
+            write_block_transposed(mat, by, bx, w, h, block_a);
+        }
+    }
+}
+
+void transform_shift(struct state *st, int dx, int dy)
+{
+    shift_cells(&st->mat, st->size, dx, dy);
+    state_touch_rect(st, 0, 0, st->size, st->size);
+}
+
+void transform_flip(struct state *st, bool vertical)
+{
+    flip_cells(&st->mat, st->size, vertical);
+    state_touch_rect(st, 0, 0, st->size, st->size);
+}
+
+void transform_transpose(struct state *st)
+{
+    transpose_cells(&st->mat, st->size);
+    state_touch_rect(st, 0, 0, st->size, st->size);
+}
+
+void transform_rotate(struct state *st, bool clockwise)
+{
+    // A transpose and a mirror, left to right turns it clockwise
+    transpose_cells(&st->mat, st->size);
+    flip_cells(&st->mat, st->size, !clockwise);
+    state_touch_rect(st, 0, 0, st->size, st->size);
+}
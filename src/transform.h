@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "state.h"
+
+// Whole canvas transforms, each one a single change of the state. Only the
+// cells inside the canvas size move, they work in place by rows and blocks.
+
+// Moves the cells by (dx, dy), wrapping around the edges.
+void transform_shift(struct state *st, int dx, int dy);
+// Mirrors left to right, or top to bottom when vertical.
+void transform_flip(struct state *st, bool vertical);
+// Swaps rows and columns.
+void transform_transpose(struct state *st);
+// Turns the canvas a quarter.
+void transform_rotate(struct state *st, bool clockwise);
@@ -0,0 +1,269 @@
+#include "undo.h"
+
+#include <string.h>
+
+#include "kernels.h"
+
+#define TILE_CELLS (TILE_SIZE * TILE_SIZE)
+#define TILE_BYTES (TILE_SIZE * TILE_ROW_BYTES)
+
+static const struct tile empty;
+
+// Longest run entry: two 5 byte varints and the change.
+#define DELTA_RUN_MAX 11
+
+// Deltas are built here before they get their place in the pool, larger
+// ones are dropped anyway.
+static unsigned char scratch[UNDO_POOL_SIZE];
+
+static unsigned int put_varint(unsigned char *out, unsigned int v)
+{
+    unsigned int len = 0;
+    while (v >= 0x80)
+    {
+        out[len++] = (v & 0x7F) | 0x80;
+        v >>= 7;
+    }
+    out[len++] = v;
+    return len;
+}
+
+static unsigned int get_varint(const unsigned char *in, unsigned int *i)
+{
+    unsigned int v = 0;
+    int shift = 0;
+    do
+    {
+        v |= (unsigned int)(in[*i] & 0x7F) << shift;
+        shift += 7;
+    } while (in[(*i)++] & 0x80);
+    return v;
+}
+
+// Encodes the changes from the shadow in the tiles of st that changed after
+// revision since. Returns more than UNDO_POOL_SIZE if they don't fit.
+static unsigned int delta_encode(const struct matrix *from, const struct state *st,
+        unsigned int since, unsigned char *out)
+{
+    unsigned int len = 0;
+    unsigned int last = 0; // Position after the previous run
+    unsigned int run_pos = 0, run_len = 0;
+    unsigned char run_change = 0;
+    for (int ty = 0; ty < TILES_MAX; ++ty)
+    {
+        for (int tx = 0; tx < TILES_MAX; ++tx)
+        {
+            if (st->tile_revision[ty][tx] <= since)
+                continue;
+            const struct tile *a = matrix_tile(from, tx, ty);
+            const struct tile *b = matrix_tile(&st->mat, tx, ty);
+            if (!a && !b)
+                continue;
+            const unsigned char *pa = a ? &a->packed[0][0] : &empty.packed[0][0];
+            const unsigned char *pb = b ? &b->packed[0][0] : &empty.packed[0][0];
+
+            // Jump between the bytes that differ, each holds two cells
+            unsigned int base = (ty * TILES_MAX + tx) * TILE_CELLS;
+            for (int i = kernel_mismatch(pa, pb, TILE_BYTES, 0); i < TILE_BYTES;
+                    i = kernel_mismatch(pa, pb, TILE_BYTES, i + 1))
+            {
+                for (int cell = 2 * i; cell < 2 * i + 2; ++cell)
+                {
+                    unsigned char before = (cell & 1) ? pa[i] & 0xF : pa[i] >> 4;
+                    unsigned char after = (cell & 1) ? pb[i] & 0xF : pb[i] >> 4;
+                    if (before == after)
+                        continue;
+                    unsigned char change = (before << 4) | after;
+                    unsigned int pos = base + cell;
+                    if (run_len > 0 && pos == run_pos + run_len && change == run_change)
+                    {
+                        run_len += 1;
+                        continue;
+                    }
+                    if (run_len > 0)
+                    {
+                        if (len + DELTA_RUN_MAX > UNDO_POOL_SIZE)
+                            return UNDO_POOL_SIZE + 1;
+                        len += put_varint(&out[len], run_pos - last);
+                        len += put_varint(&out[len], run_len);
+                        out[len++] = run_change;
+                        last = run_pos + run_len;
+                    }
+                    run_pos = pos;
+                    run_len = 1;
+                    run_change = change;
+                }
+            }
+        }
+    }
+    if (run_len > 0)
+    {
+        if (len + DELTA_RUN_MAX > UNDO_POOL_SIZE)
+            return UNDO_POOL_SIZE + 1;
+        len += put_varint(&out[len], run_pos - last);
+        len += put_varint(&out[len], run_len);
+        out[len++] = run_change;
+    }
+    return len;
+}
+
+// Sets the cells touched by delta to their old (undo) or new value, the
+// tiles they are in get the given revision if tile_revision is not NULL.
+static void delta_apply(struct matrix *mat, unsigned int (*tile_revision)[TILES_MAX], unsigned int revision,
+        const unsigned char *delta, unsigned int len, bool undo)
+{
+    unsigned int pos = 0;
+    unsigned int i = 0;
+    while (i < len)
+    {
+        pos += get_varint(delta, &i);
+        unsigned int count = get_varint(delta, &i);
+        unsigned char change = delta[i++];
+        unsigned char c = undo ? change >> 4 : change & 0xF;
+        for (unsigned int end = pos + count; pos < end; ++pos)
+        {
+            int tile = pos / TILE_CELLS;
+            int cell = pos % TILE_CELLS;
+            int tx = tile % TILES_MAX;
+            int ty = tile / TILES_MAX;
+            matrix_set(mat, tx * TILE_SIZE + cell % TILE_SIZE, ty * TILE_SIZE + cell / TILE_SIZE, c);
+            if (tile_revision)
+                tile_revision[ty][tx] = revision;
+        }
+    }
+}
+
+static struct undo_entry *undostack_entry(struct undostack *stack, int i)
+{
+    return &stack->entries[(stack->first + i) % UNDO_LEVELS];
+}
+
+static void undostack_evict(struct undostack *stack)
+{
+    stack->first = (stack->first + 1) % UNDO_LEVELS;
+    stack->len -= 1;
+    stack->redo_len -= 1;
+}
+
+void undostack_save(const struct state *st, struct undostack *stack)
+{
+    if (!stack->init)
+    {
+        for (int ty = 0; ty < TILES_MAX; ++ty)
+        {
+            for (int tx = 0; tx < TILES_MAX; ++tx)
+                matrix_copy_tile(&stack->shadow, &st->mat, tx, ty);
+        }
+        stack->revision = st->revision;
+        stack->init = true;
+        return;
+    }
+
+    // Check that currrent state is different to last saved state, only in
+    // the tiles that changed since then
+    unsigned int len = delta_encode(&stack->shadow, st, stack->revision, scratch);
+    for (int ty = 0; ty < TILES_MAX; ++ty)
+    {
+        for (int tx = 0; tx < TILES_MAX; ++tx)
+        {
+            if (st->tile_revision[ty][tx] > stack->revision)
+                matrix_copy_tile(&stack->shadow, &st->mat, tx, ty);
+        }
+    }
+    stack->revision = st->revision;
+    if (len == 0)
+        return;
+
+    // Drop the redos, or the whole history if the delta can't fit
+    stack->redo_len = stack->len;
+    if (len > UNDO_POOL_SIZE)
+    {
+        stack->len = 0;
+        stack->redo_len = 0;
+        return;
+    }
+    if (stack->len == UNDO_LEVELS)
+        undostack_evict(stack);
+
+    // Place the delta after the newest one, wrapping around the pool, and
+    // evict the oldest deltas that lie where it goes.
+    unsigned int offset = 0;
+    if (stack->len > 0)
+    {
+        struct undo_entry *top = undostack_entry(stack, stack->len - 1);
+        offset = top->offset + top->length;
+    }
+    if (offset + len > UNDO_POOL_SIZE)
+    {
+        // The tail of the pool is skipped, deltas still there are the oldest
+        while (stack->len > 0 && undostack_entry(stack, 0)->offset >= offset)
+            undostack_evict(stack);
+        offset = 0;
+    }
+    while (stack->len > 0)
+    {
+        struct undo_entry *old = undostack_entry(stack, 0);
+        if (old->offset >= offset + len || offset >= old->offset + old->length)
+            break;
+        undostack_evict(stack);
+    }
+
+    memcpy(&stack->pool[offset], scratch, len);
+    *undostack_entry(stack, stack->len) = (struct undo_entry){offset, len};
+    stack->len += 1;
+    stack->redo_len = stack->len;
+}
+
+void undostack_reset(const struct state *st, struct undostack *stack)
+{
+    if (!stack->init)
+    {
+        undostack_save(st, stack);
+        return;
+    }
+    for (int ty = 0; ty < TILES_MAX; ++ty)
+    {
+        for (int tx = 0; tx < TILES_MAX; ++tx)
+        {
+            if (st->tile_revision[ty][tx] > stack->revision)
+                matrix_copy_tile(&stack->shadow, &st->mat, tx, ty);
+        }
+    }
+    stack->revision = st->revision;
+    stack->len = 0;
+    stack->redo_len = 0;
+}
+
+bool undostack_can_undo(const struct undostack *stack)
+{
+    return stack->len > 0;
+}
+
+void undostack_undo(struct state *st, struct undostack *stack)
+{
+    if (!undostack_can_undo(stack))
+        return;
+    stack->len -= 1;
+    struct undo_entry *entry = undostack_entry(stack, stack->len);
+    st->revision += 1;
+    delta_apply(&st->mat, st->tile_revision, st->revision, &stack->pool[entry->offset], entry->length, true);
+    delta_apply(&stack->shadow, NULL, 0, &stack->pool[entry->offset], entry->length, true);
+    stack->revision = st->revision;
+}
+
+bool undostack_can_redo(const struct undostack *stack)
+{
+    return stack->len < stack->redo_len;
+}
+
+void undostack_redo(struct state *st, struct undostack *stack)
+{
+    if (!undostack_can_redo(stack))
+        return;
+    struct undo_entry *entry = undostack_entry(stack, stack->len);
+    st->revision += 1;
+    delta_apply(&st->mat, st->tile_revision, st->revision, &stack->pool[entry->offset], entry->length, false);
+    delta_apply(&stack->shadow, NULL, 0, &stack->pool[entry->offset], entry->length, false);
+    stack->revision = st->revision;
+    stack->len += 1;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "state.h"
+
+#define UNDO_LEVELS 4096
+#define UNDO_POOL_SIZE (1 << 20)
+
+// An undo level, the cells that changed from the previous one.
+struct undo_entry
+{
+    unsigned int offset; // Position of the delta in the pool
+    unsigned int length;
+};
+
+// Circular history of deltas. Cells are numbered tile by tile, and each
+// delta is a list of (cells skipped, cells changed, old color << 4 | new
+// color) runs, the counts as varints, so a stroke costs about three bytes
+// per touched cell and a filled tile a few bytes. Entries and their bytes
+// are evicted oldest first when either the ring or the pool is full.
+struct undostack
+{
+    struct matrix shadow; // Matrix as of the newest entry that was not undone
+    unsigned int revision; // State revision the shadow matches
+    struct undo_entry entries[UNDO_LEVELS];
+    int first;    // Ring index of the oldest entry
+    int len;      // Entries that can be undone
+    int redo_len; // Entries that can be redone, from the oldest one
+    bool init;
+    unsigned char pool[UNDO_POOL_SIZE];
+};
+
+// Pushes the changes since the last saved state, if there are any.
+void undostack_save(const struct state *st, struct undostack *stack);
+// Forgets the history, taking the cells as they are now as the starting
+// point. For when they are replaced rather than edited, like switching
+// animation frames.
+void undostack_reset(const struct state *st, struct undostack *stack);
+bool undostack_can_undo(const struct undostack *stack);
+void undostack_undo(struct state *st, struct undostack *stack);
+bool undostack_can_redo(const struct undostack *stack);
+void undostack_redo(struct state *st, struct undostack *stack);
@@ -0,0 +1,333 @@
+#include "workspace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "journal.h"
+#include "palette.h"
+
+#define HEADER_SIZE 16
+#define ENTRY_SIZE (WORKSPACE_NAME + 8 + 16*4 + THUMB_SIZE*THUMB_SIZE/2)
+
+static void put_u16(unsigned char *p, unsigned int v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+}
+
+static void put_u32(unsigned char *p, unsigned int v)
+{
+    put_u16(p, v & 0xFFFF);
+    put_u16(p + 2, v >> 16);
+}
+
+static unsigned int get_u16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static unsigned int get_u32(const unsigned char *p)
+{
+    return get_u16(p) | (get_u16(p + 2) << 16);
+}
+
+const char *workspace_file(const struct workspace *ws, int i)
+{
+    return TextFormat("documents/%s", ws->docs[i].name);
+}
+
+static const char *doc_path(const struct workspace *ws, int i)
+{
+    return TextFormat("%s/%s", ws->dir, ws->docs[i].name);
+}
+
+static int doc_find(const struct workspace *ws, const char *name)
+{
+    for (int i = 0; i < ws->count; ++i)
+    {
+        if (strcmp(ws->docs[i].name, name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+// Appends a document with a blank, stale thumbnail.
+static struct workspace_doc *doc_append(struct workspace *ws, const char *name)
+{
+    if (strlen(name) >= WORKSPACE_NAME)
+        return NULL;
+    if (ws->count == ws->cap)
+    {
+        int cap = ws->cap ? 2*ws->cap : 64;
+        struct workspace_doc *docs = realloc(ws->docs, cap * sizeof(*docs));
+        if (!docs)
+            return NULL;
+        ws->docs = docs;
+        ws->cap = cap;
+    }
+    struct workspace_doc *doc = &ws->docs[ws->count++];
+    memset(doc, 0, sizeof(*doc));
+    strcpy(doc->name, name);
+    doc->stale = true;
+    doc->changed = true;
+    return doc;
+}
+
+static void doc_uncache(struct workspace_doc *doc)
+{
+    if (!doc->st)
+        return;
+    matrix_free(&doc->st->mat);
+    frames_free(&doc->st->frames);
+    free(doc->st);
+    doc->st = NULL;
+}
+
+// Documents in the index that still have their file, in its order, and
+// the active one.
+static void index_read(struct workspace *ws)
+{
+    int len = 0;
+    unsigned char *data = LoadFileData(ws->index, &len);
+    if (!data)
+        return;
+    if (len >= HEADER_SIZE && memcmp(data, "JWSP", 4) == 0 &&
+            get_u16(&data[4]) == WORKSPACE_VERSION && get_u16(&data[6]) == THUMB_SIZE)
+    {
+        unsigned int count = get_u32(&data[8]);
+        unsigned int active = get_u32(&data[12]);
+        const unsigned char *p = &data[HEADER_SIZE];
+        for (unsigned int i = 0; i < count && p + ENTRY_SIZE <= data + len; ++i, p += ENTRY_SIZE)
+        {
+            char name[WORKSPACE_NAME];
+            memcpy(name, p, WORKSPACE_NAME);
+            name[WORKSPACE_NAME - 1] = '\0';
+            if (doc_find(ws, name) >= 0 || !FileExists(TextFormat("%s/%s", ws->dir, name)))
+                continue;
+            struct workspace_doc *doc = doc_append(ws, name);
+            if (!doc)
+                break;
+            if (i == active)
+                ws->active = ws->count - 1;
+            doc->mtime = (long)(get_u32(&p[WORKSPACE_NAME]) | (unsigned long long)get_u32(&p[WORKSPACE_NAME + 4]) << 32);
+            memcpy(doc->colors, &p[WORKSPACE_NAME + 8], sizeof(doc->colors));
+            memcpy(doc->cells, &p[WORKSPACE_NAME + 8 + sizeof(doc->colors)], sizeof(doc->cells));
+            doc->stale = GetFileModTime(doc_path(ws, ws->count - 1)) != doc->mtime;
+        }
+    }
+    UnloadFileData(data);
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+void workspace_open(struct workspace *ws, const char *storage_dir)
+{
+    memset(ws, 0, sizeof(*ws));
+    snprintf(ws->dir, sizeof(ws->dir), "%s/documents", storage_dir);
+    snprintf(ws->index, sizeof(ws->index), "%s/workspace.data", storage_dir);
+    if (!DirectoryExists(ws->dir))
+        MakeDirectory(ws->dir);
+
+    index_read(ws);
+
+    // Files the index doesn't know about go last, in name order
+    FilePathList files = LoadDirectoryFilesEx(ws->dir, ".data", false);
+    if (files.count > 0)
+        qsort(files.paths, files.count, sizeof(files.paths[0]), compare_paths);
+    for (unsigned int i = 0; i < files.count; ++i)
+    {
+        const char *name = GetFileName(files.paths[i]);
+        if (doc_find(ws, name) >= 0)
+            continue;
+        if (strlen(name) >= WORKSPACE_NAME)
+            TraceLog(LOG_WARNING, "Skipping %s, document names are shorter than %d characters",
+                    files.paths[i], WORKSPACE_NAME);
+        else if (!doc_append(ws, name))
+            TraceLog(LOG_WARNING, "Could not add %s to the workspace", files.paths[i]);
+    }
+    UnloadDirectoryFiles(files);
+
+    // The single document of older versions
+    const char *legacy = TextFormat("%s/state.data", storage_dir);
+    if (ws->count == 0 && FileExists(legacy))
+    {
+        char path[sizeof(ws->dir) + WORKSPACE_NAME];
+        snprintf(path, sizeof(path), "%s/doc-0001.data", ws->dir);
+        if (rename(legacy, path) == 0)
+            doc_append(ws, "doc-0001.data");
+    }
+
+    if (ws->count == 0)
+        workspace_add(ws);
+    if (ws->active >= ws->count)
+        ws->active = 0;
+}
+
+bool workspace_save_index(const struct workspace *ws)
+{
+    int len = HEADER_SIZE + ws->count*ENTRY_SIZE;
+    unsigned char *data = calloc(len, 1);
+    if (!data)
+        return false;
+    memcpy(data, "JWSP", 4);
+    put_u16(&data[4], WORKSPACE_VERSION);
+    put_u16(&data[6], THUMB_SIZE);
+    put_u32(&data[8], ws->count);
+    put_u32(&data[12], ws->active);
+    unsigned char *p = &data[HEADER_SIZE];
+    for (int i = 0; i < ws->count; ++i, p += ENTRY_SIZE)
+    {
+        const struct workspace_doc *doc = &ws->docs[i];
+        memcpy(p, doc->name, strlen(doc->name));
+        put_u32(&p[WORKSPACE_NAME], (unsigned long long)doc->mtime & 0xFFFFFFFF);
+        put_u32(&p[WORKSPACE_NAME + 4], (unsigned long long)doc->mtime >> 32);
+        memcpy(&p[WORKSPACE_NAME + 8], doc->colors, sizeof(doc->colors));
+        memcpy(&p[WORKSPACE_NAME + 8 + sizeof(doc->colors)], doc->cells, sizeof(doc->cells));
+    }
+    bool ok = SaveFileData(ws->index, data, len);
+    free(data);
+    return ok;
+}
+
+void workspace_close(struct workspace *ws)
+{
+    if (ws->count > 0 && !workspace_save_index(ws))
+        TraceLog(LOG_WARNING, "Could not save the workspace index");
+    for (int i = 0; i < ws->count; ++i)
+        doc_uncache(&ws->docs[i]);
+    free(ws->docs);
+    memset(ws, 0, sizeof(*ws));
+}
+
+int workspace_add(struct workspace *ws)
+{
+    for (int n = ws->count + 1; ; ++n)
+    {
+        char name[WORKSPACE_NAME];
+        snprintf(name, sizeof(name), "doc-%04d.data", n);
+        if (doc_find(ws, name) >= 0 || FileExists(TextFormat("%s/%s", ws->dir, name)))
+            continue;
+        if (!doc_append(ws, name))
+            return -1;
+        // Nothing to show until it is saved
+        ws->docs[ws->count - 1].stale = false;
+        return ws->count - 1;
+    }
+}
+
+bool workspace_switch(struct workspace *ws, int i, struct state *st)
+{
+    struct workspace_doc *old = &ws->docs[ws->active];
+    struct workspace_doc *doc = &ws->docs[i];
+    old->st = malloc(sizeof(*old->st));
+    if (old->st)
+        *old->st = *st;
+    else
+    {
+        matrix_free(&st->mat);
+        frames_free(&st->frames);
+    }
+    old->used = ++ws->clock;
+
+    memset(st, 0, sizeof(*st));
+    bool loaded = true;
+    if (doc->st)
+    {
+        *st = *doc->st;
+        free(doc->st);
+        doc->st = NULL;
+    }
+    else
+        loaded = journal_load(NULL, doc_path(ws, i), st);
+    ws->active = i;
+
+    // Evict the least recently used ones past the limit
+    for (;;)
+    {
+        int cached = 0, oldest = -1;
+        for (int j = 0; j < ws->count; ++j)
+        {
+            if (!ws->docs[j].st)
+                continue;
+            cached += 1;
+            if (oldest < 0 || ws->docs[j].used < ws->docs[oldest].used)
+                oldest = j;
+        }
+        if (cached <= WORKSPACE_CACHED)
+            break;
+        doc_uncache(&ws->docs[oldest]);
+    }
+    return loaded;
+}
+
+void workspace_thumb_update(struct workspace *ws, int i, const struct state *st)
+{
+    struct workspace_doc *doc = &ws->docs[i];
+    memcpy(doc->colors, palette_get(st->pal)->colors, sizeof(doc->colors));
+    // Nearest cell to the center of each pixel
+    memset(doc->cells, 0, sizeof(doc->cells));
+    for (int y = 0; y < THUMB_SIZE; ++y)
+    {
+        int cy = (2*y + 1) * st->size / (2*THUMB_SIZE);
+        for (int x = 0; x < THUMB_SIZE; ++x)
+        {
+            int cx = (2*x + 1) * st->size / (2*THUMB_SIZE);
+            doc->cells[y][x / 2] |= state_get(st, cx, cy) << ((x % 2) ? 0 : 4);
+        }
+    }
+    doc->mtime = GetFileModTime(doc_path(ws, i));
+    doc->stale = false;
+    doc->changed = true;
+}
+
+bool workspace_thumb_refresh(struct workspace *ws)
+{
+    for (int i = 0; i < ws->count; ++i)
+    {
+        struct workspace_doc *doc = &ws->docs[i];
+        // The caller makes the active one's from its state
+        if (!doc->stale || i == ws->active)
+            continue;
+        if (doc->st)
+        {
+            workspace_thumb_update(ws, i, doc->st);
+            return true;
+        }
+        struct state *st = calloc(1, sizeof(*st));
+        if (!st)
+            return false;
+        if (journal_load(NULL, doc_path(ws, i), st))
+        {
+            if (st->pal >= palette_count())
+                st->pal = 0;
+            workspace_thumb_update(ws, i, st);
+        }
+        else
+        {
+            TraceLog(LOG_WARNING, "Could not read %s", doc_path(ws, i));
+            doc->stale = false;
+        }
+        matrix_free(&st->mat);
+        frames_free(&st->frames);
+        free(st);
+        return true;
+    }
+    return false;
+}
+
+void workspace_thumb_pixels(const struct workspace *ws, int i, Color pixels[THUMB_SIZE * THUMB_SIZE])
+{
+    const struct workspace_doc *doc = &ws->docs[i];
+    for (int y = 0; y < THUMB_SIZE; ++y)
+    {
+        for (int x = 0; x < THUMB_SIZE; ++x)
+        {
+            unsigned char b = doc->cells[y][x / 2];
+            pixels[y*THUMB_SIZE + x] = doc->colors[(x % 2) ? b & 0xF : b >> 4];
+        }
+    }
+}
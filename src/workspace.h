@@ -0,0 +1,75 @@
+#pragma once
+
+#include <raylib.h>
+#include <stdbool.h>
+
+#include "state.h"
+
+// Documents of the workspace, one file each in the documents directory of
+// the storage. Only the one being edited, which the caller keeps, and the
+// last WORKSPACE_CACHED used are decoded; the others are read when opened.
+//
+// Thumbnails of every document live in an index file next to them, with
+// the order of the documents and the one last open, so a workspace opens
+// without decoding any of them:
+//
+//   header  "JWSP", u16 version, u16 thumbnail size, u32 document count,
+//           u32 active document
+//   entry   32 byte file name (NUL padded), i64 file modification time,
+//           16 RGBA colors, THUMB_SIZE x THUMB_SIZE cells packed like PIXL
+//           chunks (two per byte, high nibble first)
+//
+// Thumbnails whose file changed since are made again, a few at a time.
+#define WORKSPACE_VERSION 1
+#define WORKSPACE_CACHED 3 // Decoded documents kept besides the active one
+#define WORKSPACE_NAME 32
+#define THUMB_SIZE 64 // Pixels along each side of a thumbnail
+
+struct workspace_doc
+{
+    char name[WORKSPACE_NAME]; // File in the documents directory
+    long mtime;   // Of the file the thumbnail was made from
+    bool stale;   // The thumbnail doesn't show the file
+    bool changed; // The thumbnail changed since the caller took it
+    Color colors[16];
+    unsigned char cells[THUMB_SIZE][THUMB_SIZE / 2];
+    struct state *st;  // Decoded copy, NULL when only on storage
+    unsigned int used; // When it was last active, for eviction
+};
+
+struct workspace
+{
+    char dir[1024];   // Documents directory
+    char index[1024]; // Index file
+    struct workspace_doc *docs;
+    int count, cap;
+    int active;
+    unsigned int clock;
+};
+
+// Lists the documents under storage_dir and reads the index. A state.data
+// from before workspaces becomes the first document. There is always at
+// least one document, its file may not exist yet.
+void workspace_open(struct workspace *ws, const char *storage_dir);
+// Writes the index and releases everything.
+void workspace_close(struct workspace *ws);
+bool workspace_save_index(const struct workspace *ws);
+
+// File of document i relative to the storage directory.
+const char *workspace_file(const struct workspace *ws, int i);
+
+// Adds a document with no file yet after the others, returns its index,
+// -1 if out of memory.
+int workspace_add(struct workspace *ws);
+
+// Makes document i the active one: st, the active one until now, is kept
+// decoded and i's state is moved into st, decoded from its file when it
+// wasn't cached. Returns false when it has no file, st is then zeroed.
+bool workspace_switch(struct workspace *ws, int i, struct state *st);
+
+// Remakes the thumbnail of document i from st, after it was saved.
+void workspace_thumb_update(struct workspace *ws, int i, const struct state *st);
+// Remakes the thumbnail of one stale document, false if none was.
+bool workspace_thumb_refresh(struct workspace *ws);
+// Thumbnail of document i as RGBA pixels.
+void workspace_thumb_pixels(const struct workspace *ws, int i, Color pixels[THUMB_SIZE * THUMB_SIZE]);
@@ -0,0 +1,24 @@
+#!/bin/bash -x
+
+SCRIPT=$(realpath -s "$0")
+SCRIPTPATH=$(dirname "$SCRIPT")
+
+cd "$SCRIPTPATH"
+
+# Checks the cell kernels against their plain C versions, built once for
+# each instruction set they have a path for. Levels the machine can't run
+# are built but skipped. Needs no raylib.
+status=0
+for isa in avx2 ssse3 sse2 scalar; do
+  case $isa in
+    scalar) flags=-mgeneral-regs-only ;;
+    *) flags=-m$isa ;;
+  esac
+  gcc -o kernel-test-$isa src/kernel_test.c src/kernels.c \
+    -O2 $flags -g -Wall \
+    -I. || exit 1
+  if [ $isa = scalar ] || grep -qw $isa /proc/cpuinfo; then
+    ./kernel-test-$isa || status=1
+  fi
+done
+exit $status